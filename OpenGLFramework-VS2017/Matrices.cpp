@@ -544,3 +544,48 @@ Matrix4& Matrix4::rotateZ(float angle)
 
     return *this;
 }
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+// transform an array of points by M, taking w = 1 and dropping the w row
+// scalar even with MATRICES_SSE: shuffling packed xyz triples into lanes cost
+// more than it saved, bulk work goes to the SoA transformPoints(PointCloud)
+///////////////////////////////////////////////////////////////////////////////
+void transformPoints(const Matrix4& m, const Vector3* src, Vector3* dst, size_t count)
+{
+    // copied out of M so the stores to dst, which the compiler cannot tell apart from M, do not reload it
+    const float* a = m.get();
+    const float a0 = a[0], a1 = a[1], a2 = a[2],  a3 = a[3],
+                a4 = a[4], a5 = a[5], a6 = a[6],  a7 = a[7],
+                a8 = a[8], a9 = a[9], a10 = a[10], a11 = a[11];
+    for(size_t i = 0; i < count; ++i)
+    {
+        Vector3 v = src[i];
+        dst[i].x = a0*v.x + a1*v.y + a2*v.z  + a3;
+        dst[i].y = a4*v.x + a5*v.y + a6*v.z  + a7;
+        dst[i].z = a8*v.x + a9*v.y + a10*v.z + a11;
+    }
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+// compose T * Rx * Ry * Rz * S directly
+// every element is the same products, in the same association, that the
+// matrix multiplications would compute (their other terms are exact zeros)
+///////////////////////////////////////////////////////////////////////////////
+Matrix4 composeTRS(const Vector3& translation, const Vector3& angles, const Vector3& scale)
+{
+    float sx = sinf(angles.x), cx = cosf(angles.x);
+    float sy = sinf(angles.y), cy = cosf(angles.y);
+    float sz = sinf(angles.z), cz = cosf(angles.z);
+
+    // Rx * Ry
+    float sxsy = sx * sy, cxsy = cx * sy;
+
+    return Matrix4((cy * cz) * scale.x,                  -(cy * sz) * scale.y,                 sy * scale.z,         translation.x,
+                   (sxsy * cz + cx * sz) * scale.x,      (-(sxsy * sz) + cx * cz) * scale.y,   -(sx * cy) * scale.z, translation.y,
+                   (-(cxsy * cz) + sx * sz) * scale.x,   (cxsy * sz + sx * cz) * scale.y,      (cx * cy) * scale.z,  translation.z,
+                   0,                                    0,                                    0,                    1);
+}
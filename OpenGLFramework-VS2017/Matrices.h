@@ -19,8 +19,17 @@
 #ifndef MATH_MATRICES_H
 #define MATH_MATRICES_H
 
+#include <stddef.h>
 #include "Vectors.h"
 
+// SSE kernels for the Matrix4 products, define MATRICES_NO_SIMD for the scalar code.
+// Both add the products in the same order, so they give the same bits (as long as
+// the compiler is not allowed to contract the scalar code into FMAs).
+#if !defined(MATRICES_NO_SIMD) && (defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1))
+#define MATRICES_SSE
+#include <xmmintrin.h>
+#endif
+
 ///////////////////////////////////////////////////////////////////////////
 // 2x2 matrix
 ///////////////////////////////////////////////////////////////////////////
@@ -135,13 +144,13 @@ private:
 class Matrix4
 {
 public:
-    // constructors
-    Matrix4();  // init with identity
-    Matrix4(const float src[16]);
-    Matrix4(float xx, float xy, float xz, float xw,
-            float yx, float yy, float yz, float yw,
-            float zx, float zy, float zz, float zw,
-            float wx, float wy, float wz, float ww);
+    // constructors, usable in constant expressions
+    constexpr Matrix4();  // init with identity
+    constexpr Matrix4(const float src[16]);
+    constexpr Matrix4(float xx, float xy, float xz, float xw,
+                      float yx, float yy, float yz, float yw,
+                      float zx, float zy, float zz, float zw,
+                      float wx, float wy, float wz, float ww);
 
     void        set(const float src[16]);
     void        set(float xx, float xy, float xz, float xw,
@@ -155,8 +164,8 @@ public:
     void        setColumn(int index, const Vector4& v);
     void        setColumn(int index, const Vector3& v);
 
-    const float* get() const;
-    const float* getTranspose();                        // return transposed matrix
+    constexpr const float* get() const;
+    void        getTranspose(float dst[16]) const;      // write the transposed (column-major) matrix to dst
     float        getDeterminant();
 
     Matrix4&    identity();
@@ -189,7 +198,7 @@ public:
     Matrix4&    operator*=(const Matrix4& rhs);         // multiplication: M1' = M1 * M2
     bool        operator==(const Matrix4& rhs) const;   // exact compare, no epsilon
     bool        operator!=(const Matrix4& rhs) const;   // exact compare, no epsilon
-    float       operator[](int index) const;            // subscript operator v[0], v[1]
+    constexpr float operator[](int index) const;        // subscript operator v[0], v[1]
     float&      operator[](int index);                  // subscript operator v[0], v[1]
 
     friend Matrix4 operator-(const Matrix4& m);                     // unary operator (-)
@@ -206,10 +215,17 @@ private:
                             float m6, float m7, float m8);
 
     float m[16];
-    float tm[16];                                       // transpose m
 
 };
 
+// dst[i] = M * (src[i], 1) without the w row, for count points; src and dst may be the same array
+// Scalar, for many points the PointCloud overload in pointcloud.h is the SIMD one
+void transformPoints(const Matrix4& m, const Vector3* src, Vector3* dst, size_t count);
+
+// T * Rx * Ry * Rz * S in closed form, one sin and cos per axis and no matrix products.
+// angles are in radians; the result has the same bits as multiplying the four matrices.
+Matrix4 composeTRS(const Vector3& translation, const Vector3& angles, const Vector3& scale);
+
 
 
 ///////////////////////////////////////////////////////////////////////////
@@ -631,27 +647,30 @@ inline std::ostream& operator<<(std::ostream& os, const Matrix3& m)
 ///////////////////////////////////////////////////////////////////////////
 // inline functions for Matrix4
 ///////////////////////////////////////////////////////////////////////////
-inline Matrix4::Matrix4()
-{
+inline constexpr Matrix4::Matrix4()
     // initially identity matrix
-    identity();
+    : m{1, 0, 0, 0,  0, 1, 0, 0,  0, 0, 1, 0,  0, 0, 0, 1}
+{
 }
 
 
 
-inline Matrix4::Matrix4(const float src[16])
+inline constexpr Matrix4::Matrix4(const float src[16])
+    : m{src[0],  src[1],  src[2],  src[3],
+        src[4],  src[5],  src[6],  src[7],
+        src[8],  src[9],  src[10], src[11],
+        src[12], src[13], src[14], src[15]}
 {
-    set(src);
 }
 
 
 
-inline Matrix4::Matrix4(float xx, float xy, float xz, float xw,
-                        float yx, float yy, float yz, float yw,
-                        float zx, float zy, float zz, float zw,
-                        float wx, float wy, float wz, float ww)
+inline constexpr Matrix4::Matrix4(float xx, float xy, float xz, float xw,
+                                  float yx, float yy, float yz, float yw,
+                                  float zx, float zy, float zz, float zw,
+                                  float wx, float wy, float wz, float ww)
+    : m{xx, xy, xz, xw,  yx, yy, yz, yw,  zx, zy, zz, zw,  wx, wy, wz, ww}
 {
-    set(xx, xy, xz, xw,  yx, yy, yz, yw,  zx, zy, zz, zw,  wx, wy, wz, ww);
 }
 
 
@@ -721,20 +740,19 @@ inline void Matrix4::setColumn(int index, const Vector3& v)
 
 
 
-inline const float* Matrix4::get() const
+inline constexpr const float* Matrix4::get() const
 {
     return m;
 }
 
 
 
-inline const float* Matrix4::getTranspose()
+inline void Matrix4::getTranspose(float tm[16]) const
 {
     tm[0] = m[0];   tm[1] = m[4];   tm[2] = m[8];   tm[3] = m[12];
     tm[4] = m[1];   tm[5] = m[5];   tm[6] = m[9];   tm[7] = m[13];
     tm[8] = m[2];   tm[9] = m[6];   tm[10]= m[10];  tm[11]= m[14];
     tm[12]= m[3];   tm[13]= m[7];   tm[14]= m[11];  tm[15]= m[15];
-    return tm;
 }
 
 
@@ -792,10 +810,26 @@ inline Matrix4& Matrix4::operator-=(const Matrix4& rhs)
 
 inline Vector4 Matrix4::operator*(const Vector4& rhs) const
 {
+#ifdef MATRICES_SSE
+    // weighted sum of the columns, lane i is row i dotted with rhs
+    __m128 c0 = _mm_loadu_ps(&m[0]);
+    __m128 c1 = _mm_loadu_ps(&m[4]);
+    __m128 c2 = _mm_loadu_ps(&m[8]);
+    __m128 c3 = _mm_loadu_ps(&m[12]);
+    _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+    __m128 r = _mm_mul_ps(c0, _mm_set1_ps(rhs.x));
+    r = _mm_add_ps(r, _mm_mul_ps(c1, _mm_set1_ps(rhs.y)));
+    r = _mm_add_ps(r, _mm_mul_ps(c2, _mm_set1_ps(rhs.z)));
+    r = _mm_add_ps(r, _mm_mul_ps(c3, _mm_set1_ps(rhs.w)));
+    float v[4];
+    _mm_storeu_ps(v, r);
+    return Vector4(v[0], v[1], v[2], v[3]);
+#else
     return Vector4(m[0]*rhs.x  + m[1]*rhs.y  + m[2]*rhs.z  + m[3]*rhs.w,
                    m[4]*rhs.x  + m[5]*rhs.y  + m[6]*rhs.z  + m[7]*rhs.w,
                    m[8]*rhs.x  + m[9]*rhs.y  + m[10]*rhs.z + m[11]*rhs.w,
                    m[12]*rhs.x + m[13]*rhs.y + m[14]*rhs.z + m[15]*rhs.w);
+#endif
 }
 
 
@@ -811,10 +845,28 @@ inline Vector3 Matrix4::operator*(const Vector3& rhs) const
 
 inline Matrix4 Matrix4::operator*(const Matrix4& n) const
 {
+#ifdef MATRICES_SSE
+    // row i of the product is the rows of n weighted by row i of this matrix
+    __m128 n0 = _mm_loadu_ps(&n.m[0]);
+    __m128 n1 = _mm_loadu_ps(&n.m[4]);
+    __m128 n2 = _mm_loadu_ps(&n.m[8]);
+    __m128 n3 = _mm_loadu_ps(&n.m[12]);
+    Matrix4 result;
+    for(int i = 0; i < 16; i += 4)
+    {
+        __m128 row = _mm_mul_ps(_mm_set1_ps(m[i]), n0);
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(m[i+1]), n1));
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(m[i+2]), n2));
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(m[i+3]), n3));
+        _mm_storeu_ps(&result.m[i], row);
+    }
+    return result;
+#else
     return Matrix4(m[0]*n[0]  + m[1]*n[4]  + m[2]*n[8]  + m[3]*n[12],   m[0]*n[1]  + m[1]*n[5]  + m[2]*n[9]  + m[3]*n[13],   m[0]*n[2]  + m[1]*n[6]  + m[2]*n[10]  + m[3]*n[14],   m[0]*n[3]  + m[1]*n[7]  + m[2]*n[11]  + m[3]*n[15],
                    m[4]*n[0]  + m[5]*n[4]  + m[6]*n[8]  + m[7]*n[12],   m[4]*n[1]  + m[5]*n[5]  + m[6]*n[9]  + m[7]*n[13],   m[4]*n[2]  + m[5]*n[6]  + m[6]*n[10]  + m[7]*n[14],   m[4]*n[3]  + m[5]*n[7]  + m[6]*n[11]  + m[7]*n[15],
                    m[8]*n[0]  + m[9]*n[4]  + m[10]*n[8] + m[11]*n[12],  m[8]*n[1]  + m[9]*n[5]  + m[10]*n[9] + m[11]*n[13],  m[8]*n[2]  + m[9]*n[6]  + m[10]*n[10] + m[11]*n[14],  m[8]*n[3]  + m[9]*n[7]  + m[10]*n[11] + m[11]*n[15],
                    m[12]*n[0] + m[13]*n[4] + m[14]*n[8] + m[15]*n[12],  m[12]*n[1] + m[13]*n[5] + m[14]*n[9] + m[15]*n[13],  m[12]*n[2] + m[13]*n[6] + m[14]*n[10] + m[15]*n[14],  m[12]*n[3] + m[13]*n[7] + m[14]*n[11] + m[15]*n[15]);
+#endif
 }
 
 
@@ -847,7 +899,7 @@ inline bool Matrix4::operator!=(const Matrix4& n) const
 
 
 
-inline float Matrix4::operator[](int index) const
+inline constexpr float Matrix4::operator[](int index) const
 {
     return m[index];
 }
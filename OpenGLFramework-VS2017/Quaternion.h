@@ -0,0 +1,147 @@
+///////////////////////////////////////////////////////////////////////////////
+// Quaternion.h
+// ============
+// Quaternion for 3D rotations: q = s + xi + yj + zk
+//
+// Only unit quaternions are rotations; conjugate(), rotate() and getMatrix()
+// assume unit length. Angles are in radians and matrices are row major, as in
+// Matrices.h. The product q1 * q2 rotates by q2 first, then by q1, the same
+// order as the matrix product M1 * M2.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef MATH_QUATERNION_H
+#define MATH_QUATERNION_H
+
+#include <cmath>
+#include "Vectors.h"
+#include "Matrices.h"
+
+struct Quaternion
+{
+    float s;    // scalar part
+    float x;    // vector part
+    float y;
+    float z;
+
+    // ctors
+    constexpr Quaternion() : s(1), x(0), y(0), z(0) {};    // no rotation
+    constexpr Quaternion(float s, float x, float y, float z) : s(s), x(x), y(y), z(z) {};
+    Quaternion(const Vector3& axis, float angle);           // rotate angle around a unit axis
+
+    // utils functions
+    void        set(float s, float x, float y, float z);
+    float       length() const;
+    Quaternion& normalize();
+    Quaternion  conjugate() const;                          // inverse rotation
+    Vector3     rotate(const Vector3& v) const;             // v' = q * v * q^-1
+    Matrix4     getMatrix() const;                          // rotation matrix, no translation
+
+    // the rotation of Rx(angles.x) * Ry(angles.y) * Rz(angles.z), one sin and cos per axis
+    static Quaternion fromEuler(const Vector3& angles);
+
+    // operators
+    Quaternion  operator*(const Quaternion& rhs) const;     // Hamilton product
+    Quaternion& operator*=(const Quaternion& rhs);
+    bool        operator==(const Quaternion& rhs) const;    // exact compare, no epsilon
+    bool        operator!=(const Quaternion& rhs) const;    // exact compare, no epsilon
+
+    friend std::ostream& operator<<(std::ostream& os, const Quaternion& q);
+};
+
+// T * R * S with R from a unit quaternion, without matrix products
+Matrix4 composeTRS(const Vector3& translation, const Quaternion& rotation, const Vector3& scale);
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+// inline functions for Quaternion
+///////////////////////////////////////////////////////////////////////////////
+inline Quaternion::Quaternion(const Vector3& axis, float angle) {
+    float h = 0.5f * angle;
+    float sinH = sinf(h);
+    s = cosf(h);
+    x = axis.x * sinH;
+    y = axis.y * sinH;
+    z = axis.z * sinH;
+}
+
+inline void Quaternion::set(float s, float x, float y, float z) {
+    this->s = s; this->x = x; this->y = y; this->z = z;
+}
+
+inline float Quaternion::length() const {
+    return sqrtf(s*s + x*x + y*y + z*z);
+}
+
+inline Quaternion& Quaternion::normalize() {
+    float invLength = 1.0f / length();
+    s *= invLength;
+    x *= invLength;
+    y *= invLength;
+    z *= invLength;
+    return *this;
+}
+
+inline Quaternion Quaternion::conjugate() const {
+    return Quaternion(s, -x, -y, -z);
+}
+
+inline Vector3 Quaternion::rotate(const Vector3& v) const {
+    // v + 2r x (r x v + sv) with r = (x, y, z), two cross products instead of two quaternion products
+    Vector3 r(x, y, z);
+    Vector3 t = r.cross(v) + v * s;
+    return v + r.cross(t) * 2.0f;
+}
+
+inline Matrix4 Quaternion::getMatrix() const {
+    return composeTRS(Vector3(0, 0, 0), *this, Vector3(1, 1, 1));
+}
+
+inline Quaternion Quaternion::fromEuler(const Vector3& angles) {
+    float sx = sinf(0.5f * angles.x), cx = cosf(0.5f * angles.x);
+    float sy = sinf(0.5f * angles.y), cy = cosf(0.5f * angles.y);
+    float sz = sinf(0.5f * angles.z), cz = cosf(0.5f * angles.z);
+
+    // (cx + sx i) * (cy + sy j) * (cz + sz k), multiplied out
+    float a = cx * cy, b = sx * cy, c = cx * sy, d = sx * sy;
+    return Quaternion(a * cz - d * sz, b * cz + c * sz, c * cz - b * sz, a * sz + d * cz);
+}
+
+inline Quaternion Quaternion::operator*(const Quaternion& q) const {
+    return Quaternion(s*q.s - x*q.x - y*q.y - z*q.z,
+                      s*q.x + x*q.s + y*q.z - z*q.y,
+                      s*q.y - x*q.z + y*q.s + z*q.x,
+                      s*q.z + x*q.y - y*q.x + z*q.s);
+}
+
+inline Quaternion& Quaternion::operator*=(const Quaternion& q) {
+    *this = *this * q;
+    return *this;
+}
+
+inline bool Quaternion::operator==(const Quaternion& rhs) const {
+    return (s == rhs.s) && (x == rhs.x) && (y == rhs.y) && (z == rhs.z);
+}
+
+inline bool Quaternion::operator!=(const Quaternion& rhs) const {
+    return (s != rhs.s) || (x != rhs.x) || (y != rhs.y) || (z != rhs.z);
+}
+
+inline std::ostream& operator<<(std::ostream& os, const Quaternion& q) {
+    os << "(" << q.s << ", " << q.x << ", " << q.y << ", " << q.z << ")";
+    return os;
+}
+
+inline Matrix4 composeTRS(const Vector3& translation, const Quaternion& q, const Vector3& scale) {
+    float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+    float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+    float sx = q.s * q.x, sy = q.s * q.y, sz = q.s * q.z;
+
+    return Matrix4((1 - 2 * (yy + zz)) * scale.x,  2 * (xy - sz) * scale.y,        2 * (xz + sy) * scale.z,        translation.x,
+                   2 * (xy + sz) * scale.x,        (1 - 2 * (xx + zz)) * scale.y,  2 * (yz - sx) * scale.z,        translation.y,
+                   2 * (xz - sy) * scale.x,        2 * (yz + sx) * scale.y,        (1 - 2 * (xx + yy)) * scale.z,  translation.z,
+                   0,                              0,                              0,                              1);
+}
+// END OF QUATERNION //////////////////////////////////////////////////////////
+
+#endif
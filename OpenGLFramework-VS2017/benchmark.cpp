@@ -0,0 +1,1908 @@
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <string.h>
+#include <float.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include "benchmark.h"
+#include "main.h"
+#include "Quaternion.h"
+
+using namespace std;
+
+static EGLDisplay display = EGL_NO_DISPLAY;
+static EGLContext context = EGL_NO_CONTEXT;
+static GLuint fbo, colorBuffer, depthBuffer;
+
+bool createHeadlessContext(int width, int height)
+{
+	// prefer the surfaceless platform so no X/Wayland server is needed
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+		(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (getPlatformDisplay)
+	{
+		display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	}
+	if (display == EGL_NO_DISPLAY)
+	{
+		display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	}
+
+	EGLint major, minor;
+	if (!eglInitialize(display, &major, &minor))
+	{
+		std::cout << "Failed to initialize EGL (0x" << std::hex << eglGetError() << std::dec << ")" << std::endl;
+		return false;
+	}
+	eglBindAPI(EGL_OPENGL_API);
+
+	EGLint configAttribs[] = {EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE};
+	EGLConfig config = NULL;
+	EGLint numConfigs = 0;
+	eglChooseConfig(display, configAttribs, &config, 1, &numConfigs);
+
+	// same version and profile as the windowed build
+	EGLint contextAttribs[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 3,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE};
+	context = eglCreateContext(display, numConfigs > 0 ? config : (EGLConfig)0, EGL_NO_CONTEXT, contextAttribs);
+	if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+	{
+		std::cout << "Failed to create EGL context (0x" << std::hex << eglGetError() << std::dec << ")" << std::endl;
+		return false;
+	}
+
+	if (!gladLoadGLLoader((GLADloadproc)eglGetProcAddress))
+	{
+		std::cout << "Failed to initialize GLAD" << std::endl;
+		return false;
+	}
+
+	// surfaceless contexts have no default framebuffer, render into an FBO instead
+	glGenRenderbuffers(1, &colorBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	glGenRenderbuffers(1, &depthBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		std::cout << "Offscreen framebuffer is incomplete" << std::endl;
+		return false;
+	}
+	glViewport(0, 0, width, height);
+	return true;
+}
+
+void *headlessProcAddress(const char *name)
+{
+	return (void *)eglGetProcAddress(name);
+}
+
+void destroyHeadlessContext()
+{
+	if (context != EGL_NO_CONTEXT)
+	{
+		glDeleteFramebuffers(1, &fbo);
+		glDeleteRenderbuffers(1, &colorBuffer);
+		glDeleteRenderbuffers(1, &depthBuffer);
+		eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		eglDestroyContext(display, context);
+		context = EGL_NO_CONTEXT;
+	}
+	if (display != EGL_NO_DISPLAY)
+	{
+		eglTerminate(display);
+		display = EGL_NO_DISPLAY;
+	}
+}
+
+GpuTimer::GpuTimer()
+{
+	glGenQueries(1, &query);
+}
+
+GpuTimer::~GpuTimer()
+{
+	glDeleteQueries(1, &query);
+}
+
+void GpuTimer::start()
+{
+	glBeginQuery(GL_TIME_ELAPSED, query);
+}
+
+void GpuTimer::stop()
+{
+	glEndQuery(GL_TIME_ELAPSED);
+}
+
+double GpuTimer::resultMs()
+{
+	GLuint64 ns = 0;
+	glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+	return ns / 1.0e6;
+}
+
+VertexInvocationCounter::VertexInvocationCounter() : query(0)
+{
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count; i++)
+	{
+		if (strcmp((const char *)glGetStringi(GL_EXTENSIONS, i), "GL_ARB_pipeline_statistics_query") == 0)
+		{
+			glGenQueries(1, &query);
+			break;
+		}
+	}
+}
+
+VertexInvocationCounter::~VertexInvocationCounter()
+{
+	if (query != 0)
+	{
+		glDeleteQueries(1, &query);
+	}
+}
+
+void VertexInvocationCounter::start()
+{
+	if (query != 0)
+	{
+		glBeginQuery(GL_VERTEX_SHADER_INVOCATIONS_ARB, query);
+	}
+}
+
+void VertexInvocationCounter::stop()
+{
+	if (query != 0)
+	{
+		glEndQuery(GL_VERTEX_SHADER_INVOCATIONS_ARB);
+	}
+}
+
+long long VertexInvocationCounter::result()
+{
+	if (query == 0)
+	{
+		return -1;
+	}
+	GLuint64 invocations = 0;
+	glGetQueryObjectui64v(query, GL_QUERY_RESULT, &invocations);
+	return (long long)invocations;
+}
+
+SampleStats summarize(std::vector<double> samples)
+{
+	SampleStats s = {0, 0, 0, 0, 0};
+	if (samples.empty())
+	{
+		return s;
+	}
+
+	std::sort(samples.begin(), samples.end());
+	double sum = 0;
+	for (size_t i = 0; i < samples.size(); i++)
+	{
+		sum += samples[i];
+	}
+	s.mean = sum / samples.size();
+	s.median = samples[samples.size() / 2];
+	s.p95 = samples[min(samples.size() - 1, samples.size() * 95 / 100)];
+	s.min = samples.front();
+	s.max = samples.back();
+	return s;
+}
+
+void JsonWriter::prefix(const char *key)
+{
+	if (!first.empty())
+	{
+		if (!first.back())
+		{
+			os << ",";
+		}
+		first.back() = false;
+		os << "\n" << std::string(first.size() * 2, ' ');
+	}
+	if (key)
+	{
+		os << "\"" << key << "\": ";
+	}
+}
+
+JsonWriter &JsonWriter::beginObject(const char *key)
+{
+	prefix(key);
+	os << "{";
+	first.push_back(true);
+	return *this;
+}
+
+JsonWriter &JsonWriter::endObject()
+{
+	first.pop_back();
+	os << "\n" << std::string(first.size() * 2, ' ') << "}";
+	if (first.empty())
+	{
+		os << "\n";
+	}
+	return *this;
+}
+
+JsonWriter &JsonWriter::beginArray(const char *key)
+{
+	prefix(key);
+	os << "[";
+	first.push_back(true);
+	return *this;
+}
+
+JsonWriter &JsonWriter::endArray()
+{
+	first.pop_back();
+	os << "\n" << std::string(first.size() * 2, ' ') << "]";
+	return *this;
+}
+
+JsonWriter &JsonWriter::value(const char *key, double v)
+{
+	prefix(key);
+	os << v;
+	return *this;
+}
+
+JsonWriter &JsonWriter::value(const char *key, long long v)
+{
+	prefix(key);
+	os << v;
+	return *this;
+}
+
+JsonWriter &JsonWriter::value(const char *key, const std::string &v)
+{
+	prefix(key);
+	os << "\"";
+	for (size_t i = 0; i < v.size(); i++)
+	{
+		if (v[i] == '"' || v[i] == '\\')
+		{
+			os << '\\';
+		}
+		os << v[i];
+	}
+	os << "\"";
+	return *this;
+}
+
+JsonWriter &JsonWriter::stats(const char *key, const SampleStats &s)
+{
+	beginObject(key);
+	value("mean", s.mean);
+	value("median", s.median);
+	value("p95", s.p95);
+	value("min", s.min);
+	value("max", s.max);
+	return endObject();
+}
+
+// The suites and main() of the benchmark build, driving main.cpp through main.h
+struct BenchmarkOptions
+{
+	int frames = 200;
+	int warmup = 20;
+	int repeat = 5;
+	int max_instances = 100000;
+	int max_lights = 1024;
+	string suite = "render";
+	LightMode light_mode = DirectionalLight;
+	bool animate = false;
+	string out = "benchmark.json";
+	string dump_prefix; // write the last frame of each model as <prefix><idx>.ppm
+};
+
+int countTriangles(const model &m)
+{
+	int triangles = 0;
+	for (int i = 0; i < m.shapes.size(); i++)
+	{
+		triangles += m.shapes[i].indexCount / 3;
+	}
+	return triangles;
+}
+
+int countVertices(const model &m)
+{
+	int vertices = 0;
+	for (int i = 0; i < m.shapes.size(); i++)
+	{
+		vertices += m.shapes[i].vertex_count;
+	}
+	return vertices;
+}
+
+// GPU memory used by the vertex and index buffers of a model
+long long geometryBytes(const model &m)
+{
+	long long bytes = 0;
+	for (int i = 0; i < m.shapes.size(); i++)
+	{
+		const Shape &shape = m.shapes[i];
+		bytes += (long long)shape.vertex_count * vertexStride(vertex_layout);
+		bytes += (long long)shape.indexCount * (shape.indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint));
+	}
+	return bytes;
+}
+
+void writeGeometryPoolStats(JsonWriter &json, const char *key)
+{
+	GeometryPoolStats stats = geometryPoolStats();
+	json.beginObject(key);
+	json.value("pages", stats.pages);
+	json.value("resident_bytes", stats.resident_bytes);
+	json.value("used_bytes", stats.used_bytes);
+	json.value("free_bytes", stats.free_bytes);
+	json.value("largest_free_block", stats.largest_free_block);
+	json.value("free_blocks", stats.free_blocks);
+	json.value("fragmentation", stats.fragmentation);
+	json.endObject();
+}
+
+// Save the current color buffer as a binary PPM, handy for checking what the benchmark drew
+void dumpFramebuffer(const string &path)
+{
+	vector<unsigned char> pixels(WINDOW_WIDTH * WINDOW_HEIGHT * 3);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT, GL_RGB, GL_UNSIGNED_BYTE, &pixels[0]);
+
+	ofstream ppm(path, ios::binary);
+	ppm << "P6\n" << WINDOW_WIDTH << " " << WINDOW_HEIGHT << "\n255\n";
+	// GL rows start at the bottom
+	for (int y = WINDOW_HEIGHT - 1; y >= 0; y--)
+	{
+		ppm.write((const char *)&pixels[y * WINDOW_WIDTH * 3], WINDOW_WIDTH * 3);
+	}
+}
+
+// Render every loaded model for opt.frames frames and report per-frame CPU/GPU cost
+void benchmarkRender(JsonWriter &json, const BenchmarkOptions &opt, const char *key = "models")
+{
+	CpuTimer cpu_timer;
+	GpuTimer gpu_timer;
+	VertexInvocationCounter vertex_counter;
+
+	json.beginArray(key);
+	for (int idx = 0; idx < models.size(); idx++)
+	{
+		cur_idx = idx;
+		for (int f = 0; f < opt.warmup; f++)
+		{
+			RenderScene();
+		}
+		glFinish();
+
+		vector<double> cpu_ms, gpu_ms, frame_ms, uniform_calls;
+		long long vertex_invocations = 0;
+		for (int f = 0; f < opt.frames; f++)
+		{
+			if (opt.animate)
+			{
+				models[idx].rotation.y += degree_to_radian(1.0);
+			}
+
+			cpu_timer.start();
+			gpu_timer.start();
+			vertex_counter.start();
+			RenderScene();
+			vertex_counter.stop();
+			gpu_timer.stop();
+			cpu_ms.push_back(cpu_timer.elapsedMs());
+			glFinish();
+			frame_ms.push_back(cpu_timer.elapsedMs());
+			gpu_ms.push_back(gpu_timer.resultMs());
+			uniform_calls.push_back(uniform_stats.calls);
+			vertex_invocations = vertex_counter.result();
+		}
+
+		// every shape is drawn twice, once per viewport
+		long long triangles = 2LL * countTriangles(models[idx]);
+		SampleStats frame = summarize(frame_ms);
+
+		json.beginObject();
+		json.value("file", filenames[idx]);
+		json.value("shapes", (int)models[idx].shapes.size());
+		json.value("triangles_per_frame", triangles);
+		json.value("vertices", countVertices(models[idx]));
+		json.value("geometry_bytes", geometryBytes(models[idx]));
+		json.stats("cpu_ms", summarize(cpu_ms));
+		json.stats("gpu_ms", summarize(gpu_ms));
+		json.stats("frame_ms", frame);
+		json.stats("uniform_calls", summarize(uniform_calls));
+		json.value("draw_calls", draw_calls);
+		json.value("objects_drawn", objects_drawn);
+		json.value("objects_culled", objects_culled);
+		json.value("program_switches", program_switches);
+		json.value("material_binds", material_binds);
+		json.value("vao_binds", vao_binds);
+		json.value("vertex_invocations", vertex_invocations); // per frame, -1 without GL_ARB_pipeline_statistics_query
+		json.value("triangles_per_sec", frame.mean > 0 ? triangles / (frame.mean / 1000.0) : 0.0);
+		json.endObject();
+
+		if (!opt.dump_prefix.empty())
+		{
+			string tag = strcmp(key, "models") == 0 ? "" : string(key) + "_";
+			dumpFramebuffer(opt.dump_prefix + tag + to_string(idx) + ".ppm");
+		}
+	}
+	json.endArray();
+}
+
+// Render the first model as a growing crowd of instances, up to opt.max_instances copies
+void benchmarkInstancing(JsonWriter &json, const BenchmarkOptions &opt)
+{
+	CpuTimer cpu_timer;
+	GpuTimer gpu_timer;
+
+	if (models.empty() || !models[0].resident)
+	{
+		cerr << "No model to instance" << std::endl;
+		return;
+	}
+	cur_idx = 0;
+	model &m = models[0];
+	json.value("file", filenames[0]);
+	json.beginArray("instancing");
+	for (int count = 1; count <= opt.max_instances; count *= 10)
+	{
+		scatterInstances(count, m.instances);
+		setModelInstances(m);
+
+		for (int f = 0; f < opt.warmup; f++)
+		{
+			RenderScene();
+		}
+		glFinish();
+
+		vector<double> cpu_ms, gpu_ms, frame_ms;
+		for (int f = 0; f < opt.frames; f++)
+		{
+			cpu_timer.start();
+			gpu_timer.start();
+			RenderScene();
+			gpu_timer.stop();
+			cpu_ms.push_back(cpu_timer.elapsedMs());
+			glFinish();
+			frame_ms.push_back(cpu_timer.elapsedMs());
+			gpu_ms.push_back(gpu_timer.resultMs());
+		}
+
+		// every shape is drawn twice, once per viewport
+		long long triangles = 2LL * countTriangles(m) * count;
+		SampleStats frame = summarize(frame_ms);
+
+		json.beginObject();
+		json.value("instances", count);
+		json.value("draw_calls", draw_calls);
+		json.value("objects_drawn", objects_drawn);
+		json.value("objects_culled", objects_culled);
+		json.value("triangles_per_frame", triangles);
+		json.stats("cpu_ms", summarize(cpu_ms));
+		json.stats("gpu_ms", summarize(gpu_ms));
+		json.stats("frame_ms", frame);
+		json.value("instances_per_sec", frame.mean > 0 ? count / (frame.mean / 1000.0) : 0.0);
+		json.value("triangles_per_sec", frame.mean > 0 ? triangles / (frame.mean / 1000.0) : 0.0);
+		json.endObject();
+
+		if (!opt.dump_prefix.empty())
+		{
+			dumpFramebuffer(opt.dump_prefix + to_string(count) + ".ppm");
+		}
+	}
+	json.endArray();
+	m.instances.clear();
+	setModelInstances(m);
+}
+
+// The first model as a crowd spread well past the view, most of it off screen or behind the camera,
+// drawn without and with frustum culling. cull_ms is the cull pass alone.
+void benchmarkCulling(JsonWriter &json, const BenchmarkOptions &opt)
+{
+	CpuTimer cpu_timer, cull_timer;
+
+	if (models.empty() || !models[0].resident)
+	{
+		cerr << "No model to instance" << std::endl;
+		return;
+	}
+	cur_idx = 0;
+	model &m = models[0];
+	bool culling = frustum_culling;
+	Matrix4 mvp = project_matrix * view_matrix * composeTRS(m.position, m.rotation, m.scale);
+	json.value("file", filenames[0]);
+	json.beginArray("culling");
+	for (int count = 1000; count <= opt.max_instances; count *= 10)
+	{
+		scatterInstances(count, m.instances, 4);
+		setModelInstances(m);
+
+		json.beginObject();
+		json.value("instances", count);
+		for (int pass = 0; pass < 2; pass++)
+		{
+			frustum_culling = pass == 1;
+			for (int f = 0; f < opt.warmup; f++)
+			{
+				RenderScene();
+			}
+			glFinish();
+
+			vector<double> cpu_ms, frame_ms;
+			for (int f = 0; f < opt.frames; f++)
+			{
+				cpu_timer.start();
+				RenderScene();
+				cpu_ms.push_back(cpu_timer.elapsedMs());
+				glFinish();
+				frame_ms.push_back(cpu_timer.elapsedMs());
+			}
+
+			json.beginObject(frustum_culling ? "culled" : "unculled");
+			json.stats("cpu_ms", summarize(cpu_ms));
+			json.stats("frame_ms", summarize(frame_ms));
+			json.value("draw_calls", draw_calls);
+			json.value("objects_drawn", objects_drawn);
+			json.value("objects_culled", objects_culled);
+			json.value("instance_runs", (int)m.instance_runs.size());
+			json.endObject();
+
+			if (!opt.dump_prefix.empty())
+			{
+				dumpFramebuffer(opt.dump_prefix + to_string(count) + (frustum_culling ? "_culled.ppm" : "_unculled.ppm"));
+			}
+		}
+
+		vector<double> cull_ms;
+		for (int f = 0; f < opt.frames; f++)
+		{
+			cull_timer.start();
+			cullModel(m, mvp);
+			cull_ms.push_back(cull_timer.elapsedMs());
+		}
+		json.stats("cull_ms", summarize(cull_ms));
+		json.endObject();
+	}
+	json.endArray();
+	frustum_culling = culling;
+	m.instances.clear();
+	setModelInstances(m);
+}
+
+// Instance transform updates as the crowd grows, with a share of the instances turning every frame.
+// rebuild_ms is the whole-buffer path: every matrix from translate() * rotate() * scaling() and a general
+// inverse for its normal matrix, then one glBufferData.
+void benchmarkTransforms(JsonWriter &json, const BenchmarkOptions &opt)
+{
+	CpuTimer timer;
+
+	if (models.empty() || !models[0].resident)
+	{
+		cerr << "No model to instance" << std::endl;
+		return;
+	}
+	model &m = models[0];
+	TransformBatch &batch = m.instances;
+	Matrix4 view_projection = project_matrix * view_matrix;
+	const int moving_percent[] = {0, 1, 10, 100};
+
+	json.value("file", filenames[0]);
+	json.value("update_threads", framePool()->size() + 1);
+	json.beginArray("transforms");
+	for (int count = 1000; count <= opt.max_instances; count *= 10)
+	{
+		scatterInstances(count, batch);
+		setModelInstances(m);
+
+		vector<double> rebuild_ms, mvp_ms;
+		vector<InstanceData> instances(count);
+		vector<Matrix4> mvp;
+		for (int f = 0; f < opt.frames; f++)
+		{
+			timer.start();
+			for (int i = 0; i < count; i++)
+			{
+				Matrix4 transform = translate(batch.position(i)) * rotate(batch.rotation(i)) * scaling(batch.scale(i));
+				memcpy(instances[i].model, transform.get(), sizeof(instances[i].model));
+				setGLNormalMatrix(instances[i].normal, transform);
+			}
+			glBindBuffer(GL_ARRAY_BUFFER, m.instance_vbo);
+			glBufferData(GL_ARRAY_BUFFER, count * sizeof(InstanceData), &instances[0], GL_DYNAMIC_DRAW);
+			rebuild_ms.push_back(timer.elapsedMs());
+
+			timer.start();
+			batch.computeMVP(view_projection, mvp, framePool());
+			mvp_ms.push_back(timer.elapsedMs());
+		}
+
+		json.beginObject();
+		json.value("instances", count);
+		json.stats("rebuild_ms", summarize(rebuild_ms));
+		json.stats("mvp_ms", summarize(mvp_ms));
+		json.beginArray("updates");
+		for (int p = 0; p < sizeof(moving_percent) / sizeof(moving_percent[0]); p++)
+		{
+			// spread the moving instances over the whole crowd, the worst case for the dirty range
+			int step = moving_percent[p] > 0 ? 100 / moving_percent[p] : 0;
+			vector<double> serial_ms, pooled_ms;
+			int updated = 0;
+			for (int f = 0; f < 2 * opt.frames; f++)
+			{
+				for (int i = 0; step > 0 && i < count; i += step)
+				{
+					batch.setRotation(i, batch.rotation(i) + Vector3(0, degree_to_radian(1.0), 0));
+				}
+				bool pooled = f % 2 == 1;
+				timer.start();
+				updated = updateModelInstances(m, pooled ? framePool() : NULL);
+				(pooled ? pooled_ms : serial_ms).push_back(timer.elapsedMs());
+			}
+
+			json.beginObject();
+			json.value("moving_percent", moving_percent[p]);
+			json.value("updated", updated);
+			json.stats("serial_ms", summarize(serial_ms));
+			json.stats("pooled_ms", summarize(pooled_ms));
+			json.endObject();
+		}
+		json.endArray();
+		json.endObject();
+	}
+	json.endArray();
+	batch.clear();
+	setModelInstances(m);
+}
+
+// A scene of count shapes, cycling through every shape of the loaded models, each placed by its own
+// transform, drawn in the single-pass side-by-side view. per_shape is the RenderScene() loop run once per
+// object: matrices as uniforms, then material, VAO and draw. The multi-draw list takes the whole scene
+// in one glMultiDrawElementsIndirect per material page and index type, or one base-instance draw
+// per shape, the fallback before GL 4.3. cpu_ms is the time to issue a frame, frame_ms adds glFinish().
+void benchmarkMultiDraw(JsonWriter &json, const BenchmarkOptions &opt)
+{
+	CpuTimer cpu_timer, build_timer;
+	vector<ShapeRef> shapes;
+	for (int m = 0; m < models.size(); m++)
+	{
+		for (int i = 0; models[m].resident && i < models[m].shapes.size(); i++)
+		{
+			ShapeRef ref = {m, i};
+			shapes.push_back(ref);
+		}
+	}
+	if (shapes.empty() || multi_draw_support == NoMultiDraw)
+	{
+		cerr << (shapes.empty() ? "No model to draw" : "Multi-draw needs GL 4.2") << std::endl;
+		return;
+	}
+
+	build_timer.start();
+	buildSceneMaterials();
+	json.value("materials_ms", build_timer.elapsedMs());
+	json.value("indirect", multi_draw_support == IndirectMultiDraw ? 1 : 0);
+
+	useSideBySideMode(true);
+	MultiDrawSupport support = multi_draw_support;
+	const char *methods[] = {"per_shape", "base_instance_loop", "multi_draw_indirect"};
+	json.beginArray("multidraw");
+	for (int count = 10; count <= opt.max_instances; count *= 100)
+	{
+		vector<ShapeRef> draws(count);
+		long long triangles = 0;
+		for (int i = 0; i < count; i++)
+		{
+			draws[i] = shapes[i % shapes.size()];
+			triangles += 2 * (models[draws[i].model].shapes[draws[i].shape].indexCount / 3);
+		}
+		TransformBatch transforms;
+		scatterInstances(count, transforms);
+
+		MultiDrawList list;
+		build_timer.start();
+		setMultiDrawList(list, draws, transforms);
+		double list_ms = build_timer.elapsedMs();
+
+		json.beginObject();
+		json.value("shapes", count);
+		json.value("triangles_per_frame", triangles);
+		json.value("list_ms", list_ms);
+		for (int method = 0; method <= (int)support; method++)
+		{
+			multi_draw_support = (MultiDrawSupport)max(method, 1);
+			auto frame = [&]() {
+				resetDrawState();
+				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+				updateFrameBlock();
+				useShadingMode(SideBySideShading);
+				glViewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
+
+				GLfloat normal[9];
+				if (method > 0)
+				{
+					setGLNormalMatrix(normal, view_matrix);
+					uploadDrawMatrices(project_matrix * view_matrix, view_matrix, normal);
+					drawMultiDrawList(list);
+					return;
+				}
+				for (int i = 0; i < count; i++)
+				{
+					const model &m = models[draws[i].model];
+					const Shape &shape = m.shapes[draws[i].shape];
+					Matrix4 MV = view_matrix * transforms.matrix(i);
+					setGLNormalMatrix(normal, MV);
+					uploadDrawMatrices(project_matrix * MV, MV, normal);
+					bindMaterialPage(m.material_ubo, shape.materialIndex / MaterialsPerPage);
+					setMaterialIndex(shape.materialIndex % MaterialsPerPage);
+					drawShape(m, shape);
+				}
+			};
+
+			for (int f = 0; f < opt.warmup; f++)
+			{
+				frame();
+			}
+			glFinish();
+
+			vector<double> cpu_ms, frame_ms;
+			for (int f = 0; f < opt.frames; f++)
+			{
+				cpu_timer.start();
+				frame();
+				cpu_ms.push_back(cpu_timer.elapsedMs());
+				glFinish();
+				frame_ms.push_back(cpu_timer.elapsedMs());
+			}
+
+			json.beginObject(methods[method]);
+			json.stats("cpu_ms", summarize(cpu_ms));
+			json.stats("frame_ms", summarize(frame_ms));
+			json.value("draw_calls", draw_calls);
+			json.value("vao_binds", vao_binds);
+			json.value("material_binds", material_binds);
+			json.value("uniform_calls", uniform_stats.calls);
+			json.endObject();
+
+			if (!opt.dump_prefix.empty())
+			{
+				dumpFramebuffer(opt.dump_prefix + methods[method] + "_" + to_string(count) + ".ppm");
+			}
+		}
+		json.endObject();
+		releaseMultiDrawList(list);
+	}
+	json.endArray();
+	multi_draw_support = support;
+}
+
+// Clustered shading as the light list grows; lights are binned and uploaded every frame
+void benchmarkLights(JsonWriter &json, const BenchmarkOptions &opt)
+{
+	CpuTimer cpu_timer, binning_timer;
+	GpuTimer gpu_timer;
+
+	if (models.empty() || !models[0].resident)
+	{
+		cerr << "No model to light" << std::endl;
+		return;
+	}
+	cur_idx = 0;
+	cur_light_mode = ClusteredLights;
+	json.value("file", filenames[0]);
+	json.value("clusters", light_clusters.clusterCount());
+	json.beginArray("lights");
+	for (int count = 3; count <= opt.max_lights; count = count == 3 ? 16 : count * 4)
+	{
+		scatterLights(count, scene_lights);
+
+		for (int f = 0; f < opt.warmup; f++)
+		{
+			RenderScene();
+		}
+		glFinish();
+
+		// binning is also timed on its own; RenderScene() bins again, so frame_ms includes it
+		vector<double> binning_ms, cpu_ms, gpu_ms, frame_ms;
+		for (int f = 0; f < opt.frames; f++)
+		{
+			binning_timer.start();
+			updateLightClusters();
+			binning_ms.push_back(binning_timer.elapsedMs());
+
+			cpu_timer.start();
+			gpu_timer.start();
+			RenderScene();
+			gpu_timer.stop();
+			cpu_ms.push_back(cpu_timer.elapsedMs());
+			glFinish();
+			frame_ms.push_back(cpu_timer.elapsedMs());
+			gpu_ms.push_back(gpu_timer.resultMs());
+		}
+
+		json.beginObject();
+		json.value("lights", count);
+		json.value("binning_threads", framePool()->size() + 1);
+		json.stats("binning_ms", summarize(binning_ms));
+		json.value("light_indices", (int)light_clusters.indices().size());
+		json.value("mean_lights_per_cluster", (double)light_clusters.indices().size() / light_clusters.clusterCount());
+		json.value("max_lights_per_cluster", light_clusters.maxLightsPerCluster());
+		json.stats("cpu_ms", summarize(cpu_ms));
+		json.stats("gpu_ms", summarize(gpu_ms));
+		json.stats("frame_ms", summarize(frame_ms));
+		json.endObject();
+
+		if (!opt.dump_prefix.empty())
+		{
+			dumpFramebuffer(opt.dump_prefix + to_string(count) + ".ppm");
+		}
+	}
+	json.endArray();
+	scatterLights(256, scene_lights);
+}
+
+// Matrices.h products as they were before its SSE kernels, the reference of the math suite
+Matrix4 referenceMultiply(const Matrix4 &m, const Matrix4 &n)
+{
+	return Matrix4(m[0] * n[0] + m[1] * n[4] + m[2] * n[8] + m[3] * n[12], m[0] * n[1] + m[1] * n[5] + m[2] * n[9] + m[3] * n[13], m[0] * n[2] + m[1] * n[6] + m[2] * n[10] + m[3] * n[14], m[0] * n[3] + m[1] * n[7] + m[2] * n[11] + m[3] * n[15],
+				   m[4] * n[0] + m[5] * n[4] + m[6] * n[8] + m[7] * n[12], m[4] * n[1] + m[5] * n[5] + m[6] * n[9] + m[7] * n[13], m[4] * n[2] + m[5] * n[6] + m[6] * n[10] + m[7] * n[14], m[4] * n[3] + m[5] * n[7] + m[6] * n[11] + m[7] * n[15],
+				   m[8] * n[0] + m[9] * n[4] + m[10] * n[8] + m[11] * n[12], m[8] * n[1] + m[9] * n[5] + m[10] * n[9] + m[11] * n[13], m[8] * n[2] + m[9] * n[6] + m[10] * n[10] + m[11] * n[14], m[8] * n[3] + m[9] * n[7] + m[10] * n[11] + m[11] * n[15],
+				   m[12] * n[0] + m[13] * n[4] + m[14] * n[8] + m[15] * n[12], m[12] * n[1] + m[13] * n[5] + m[14] * n[9] + m[15] * n[13], m[12] * n[2] + m[13] * n[6] + m[14] * n[10] + m[15] * n[14], m[12] * n[3] + m[13] * n[7] + m[14] * n[11] + m[15] * n[15]);
+}
+
+Vector4 referenceTransform(const Matrix4 &m, const Vector4 &v)
+{
+	return Vector4(m[0] * v.x + m[1] * v.y + m[2] * v.z + m[3] * v.w,
+				   m[4] * v.x + m[5] * v.y + m[6] * v.z + m[7] * v.w,
+				   m[8] * v.x + m[9] * v.y + m[10] * v.z + m[11] * v.w,
+				   m[12] * v.x + m[13] * v.y + m[14] * v.z + m[15] * v.w);
+}
+
+// Runs of one kernel, in ms per run
+template <typename Kernel>
+SampleStats timeKernel(int repeat, Kernel run)
+{
+	CpuTimer timer;
+	vector<double> ms;
+	for (int r = 0; r < repeat; r++)
+	{
+		timer.start();
+		run();
+		ms.push_back(timer.elapsedMs());
+	}
+	return summarize(ms);
+}
+
+// One math suite entry: reference and Matrices.h timings over count operations, and how far apart their results are
+void reportKernel(JsonWriter &json, const char *name, int count, const SampleStats &reference, const SampleStats &simd,
+				  const float *reference_out, const float *simd_out, size_t floats)
+{
+	float max_diff = 0;
+	for (size_t i = 0; i < floats; i++)
+	{
+		max_diff = max(max_diff, fabsf(reference_out[i] - simd_out[i]));
+	}
+
+	json.beginObject();
+	json.value("kernel", string(name));
+	json.value("count", count);
+	json.stats("reference_ms", reference);
+	json.stats("simd_ms", simd);
+	json.value("reference_ns_per_op", reference.mean * 1e6 / count);
+	json.value("simd_ns_per_op", simd.mean * 1e6 / count);
+	json.value("speedup", simd.mean > 0 ? reference.mean / simd.mean : 0.0);
+	json.value("identical", memcmp(reference_out, simd_out, floats * sizeof(float)) == 0 ? 1 : 0);
+	json.value("max_abs_diff", (double)max_diff);
+	json.endObject();
+}
+
+// Matrix4 products, transformPoints(), the PointCloud kernels and composeTRS() against scalar references, no GL involved
+void benchmarkMath(JsonWriter &json, const BenchmarkOptions &opt)
+{
+	const int matrix_count = 1 << 14;
+	const int point_count = 1 << 16; // in and out still fit in L2
+
+	// the same pseudo-random inputs in [-2, 2) every run
+	unsigned int seed = 12345;
+	auto next = [&seed]() {
+		seed = seed * 1664525u + 1013904223u;
+		return (seed >> 8) * (4.0f / 16777216.0f) - 2.0f;
+	};
+	vector<Matrix4> a(matrix_count), b(matrix_count);
+	for (int i = 0; i < matrix_count; i++)
+	{
+		for (int k = 0; k < 16; k++)
+		{
+			a[i][k] = next();
+			b[i][k] = next();
+		}
+	}
+	vector<Vector3> points(point_count);
+	for (int i = 0; i < point_count; i++)
+	{
+		points[i] = Vector3(next(), next(), next());
+	}
+
+#ifdef MATRICES_SSE
+	json.value("simd", string("sse"));
+#else
+	json.value("simd", string("none"));
+#endif
+	json.value("repeat", opt.repeat);
+	json.beginArray("math");
+
+	// Matrix4 x Matrix4
+	vector<float> reference_out(16 * matrix_count), simd_out(16 * matrix_count);
+	SampleStats reference = timeKernel(opt.repeat, [&]() {
+		for (int i = 0; i < matrix_count; i++)
+		{
+			memcpy(&reference_out[16 * i], referenceMultiply(a[i], b[i]).get(), 16 * sizeof(float));
+		}
+	});
+	SampleStats simd = timeKernel(opt.repeat, [&]() {
+		for (int i = 0; i < matrix_count; i++)
+		{
+			memcpy(&simd_out[16 * i], (a[i] * b[i]).get(), 16 * sizeof(float));
+		}
+	});
+	reportKernel(json, "matrix4_multiply", matrix_count, reference, simd, &reference_out[0], &simd_out[0], reference_out.size());
+
+	// Matrix4 x Vector4, a different matrix for every vector
+	vector<Vector4> reference_v(point_count), simd_v(point_count);
+	reference = timeKernel(opt.repeat, [&]() {
+		for (int i = 0; i < point_count; i++)
+		{
+			reference_v[i] = referenceTransform(a[i % matrix_count], Vector4(points[i].x, points[i].y, points[i].z, 1.0f));
+		}
+	});
+	simd = timeKernel(opt.repeat, [&]() {
+		for (int i = 0; i < point_count; i++)
+		{
+			simd_v[i] = a[i % matrix_count] * Vector4(points[i].x, points[i].y, points[i].z, 1.0f);
+		}
+	});
+	reportKernel(json, "matrix4_vector4", point_count, reference, simd, &reference_v[0].x, &simd_v[0].x, 4 * point_count);
+
+	// one Matrix4 over a Vector3 array
+	vector<Vector3> reference_p(point_count), simd_p(point_count);
+	reference = timeKernel(opt.repeat, [&]() {
+		for (int i = 0; i < point_count; i++)
+		{
+			Vector4 p = referenceTransform(a[0], Vector4(points[i].x, points[i].y, points[i].z, 1.0f));
+			reference_p[i] = Vector3(p.x, p.y, p.z);
+		}
+	});
+	simd = timeKernel(opt.repeat, [&]() {
+		transformPoints(a[0], &points[0], &simd_p[0], point_count);
+	});
+	reportKernel(json, "transform_points", point_count, reference, simd, &reference_p[0].x, &simd_p[0].x, 3 * point_count);
+
+	// PointCloud batches against the same work one Vector3 at a time
+	PointCloud cloud, cloud_out, normals;
+	cloud.assign(&points[0].x, point_count);
+	vector<Vector3> normal_in(point_count);
+	for (int i = 0; i < point_count; i++)
+	{
+		normal_in[i] = Vector3(next(), next(), next());
+	}
+	normals.assign(&normal_in[0].x, point_count);
+	vector<float> simd_xyz(3 * point_count);
+
+	reference = timeKernel(opt.repeat, [&]() {
+		for (int i = 0; i < point_count; i++)
+		{
+			Vector4 p = a[0] * Vector4(points[i].x, points[i].y, points[i].z, 1.0f);
+			reference_p[i] = Vector3(p.x, p.y, p.z);
+		}
+	});
+	simd = timeKernel(opt.repeat, [&]() {
+		transformPoints(a[0], cloud, cloud_out);
+	});
+	cloud_out.storeInterleaved(&simd_xyz[0]);
+	reportKernel(json, "soa_transform_points", point_count, reference, simd, &reference_p[0].x, &simd_xyz[0], 3 * point_count);
+
+	reference = timeKernel(opt.repeat, [&]() {
+		for (int i = 0; i < point_count; i++)
+		{
+			reference_p[i] = normal_in[i];
+			reference_p[i].normalize();
+		}
+	});
+	simd = timeKernel(opt.repeat, [&]() {
+		cloud_out = normals;
+		normalize(cloud_out);
+	});
+	cloud_out.storeInterleaved(&simd_xyz[0]);
+	reportKernel(json, "soa_normalize", point_count, reference, simd, &reference_p[0].x, &simd_xyz[0], 3 * point_count);
+
+	float reference_bounds[6], simd_bounds[6];
+	reference = timeKernel(opt.repeat, [&]() {
+		Vector3 lo = points[0], hi = points[0];
+		for (int i = 1; i < point_count; i++)
+		{
+			lo = Vector3(min(lo.x, points[i].x), min(lo.y, points[i].y), min(lo.z, points[i].z));
+			hi = Vector3(max(hi.x, points[i].x), max(hi.y, points[i].y), max(hi.z, points[i].z));
+		}
+		copyVector3(reference_bounds, lo);
+		copyVector3(reference_bounds + 3, hi);
+	});
+	simd = timeKernel(opt.repeat, [&]() {
+		Vector3 lo, hi;
+		bounds(cloud, lo, hi);
+		copyVector3(simd_bounds, lo);
+		copyVector3(simd_bounds + 3, hi);
+	});
+	reportKernel(json, "soa_bounds", point_count, reference, simd, reference_bounds, simd_bounds, 6);
+
+	vector<float> reference_dot(point_count), simd_dot(point_count);
+	reference = timeKernel(opt.repeat, [&]() {
+		for (int i = 0; i < point_count; i++)
+		{
+			reference_dot[i] = points[i].dot(normal_in[i]);
+		}
+	});
+	simd = timeKernel(opt.repeat, [&]() {
+		dot(cloud, normals, &simd_dot[0]);
+	});
+	reportKernel(json, "soa_dot", point_count, reference, simd, &reference_dot[0], &simd_dot[0], point_count);
+
+	reference = timeKernel(opt.repeat, [&]() {
+		for (int i = 0; i < point_count; i++)
+		{
+			reference_p[i] = points[i].cross(normal_in[i]);
+		}
+	});
+	simd = timeKernel(opt.repeat, [&]() {
+		cross(cloud, normals, cloud_out);
+	});
+	cloud_out.storeInterleaved(&simd_xyz[0]);
+	reportKernel(json, "soa_cross", point_count, reference, simd, &reference_p[0].x, &simd_xyz[0], 3 * point_count);
+
+	// model matrices: translate() * rotate() * scaling() against the closed forms
+	vector<Vector3> position(matrix_count), rotation(matrix_count), scale(matrix_count);
+	for (int i = 0; i < matrix_count; i++)
+	{
+		position[i] = Vector3(next(), next(), next());
+		rotation[i] = Vector3(next(), next(), next()) * 1.57f;
+		scale[i] = Vector3(next(), next(), next()) + Vector3(2.5f, 2.5f, 2.5f);
+	}
+	reference = timeKernel(opt.repeat, [&]() {
+		for (int i = 0; i < matrix_count; i++)
+		{
+			Matrix4 m = translate(position[i]) * rotate(rotation[i]) * scaling(scale[i]);
+			memcpy(&reference_out[16 * i], m.get(), 16 * sizeof(float));
+		}
+	});
+	simd = timeKernel(opt.repeat, [&]() {
+		for (int i = 0; i < matrix_count; i++)
+		{
+			memcpy(&simd_out[16 * i], composeTRS(position[i], rotation[i], scale[i]).get(), 16 * sizeof(float));
+		}
+	});
+	reportKernel(json, "compose_trs", matrix_count, reference, simd, &reference_out[0], &simd_out[0], 16 * matrix_count);
+
+	// the same rotations through a quaternion, equal up to rounding
+	simd = timeKernel(opt.repeat, [&]() {
+		for (int i = 0; i < matrix_count; i++)
+		{
+			Quaternion q = Quaternion::fromEuler(rotation[i]);
+			memcpy(&simd_out[16 * i], composeTRS(position[i], q, scale[i]).get(), 16 * sizeof(float));
+		}
+	});
+	reportKernel(json, "compose_trs_quaternion", matrix_count, reference, simd, &reference_out[0], &simd_out[0], 16 * matrix_count);
+
+	json.endArray();
+}
+
+template <typename T>
+bool sameBits(const vector<T> &a, const vector<T> &b)
+{
+	return a.size() == b.size() && (a.empty() || memcmp(&a[0], &b[0], a.size() * sizeof(T)) == 0);
+}
+
+// Whether two parses of an .obj produced exactly the same attributes and shapes
+bool sameObjData(const tinyobj::attrib_t &a, const vector<tinyobj::shape_t> &a_shapes,
+				 const tinyobj::attrib_t &b, const vector<tinyobj::shape_t> &b_shapes)
+{
+	if (!sameBits(a.vertices, b.vertices) || !sameBits(a.normals, b.normals) ||
+		!sameBits(a.texcoords, b.texcoords) || !sameBits(a.colors, b.colors) ||
+		a_shapes.size() != b_shapes.size())
+	{
+		return false;
+	}
+	for (int i = 0; i < a_shapes.size(); i++)
+	{
+		const tinyobj::mesh_t &am = a_shapes[i].mesh, &bm = b_shapes[i].mesh;
+		if (a_shapes[i].name != b_shapes[i].name || !sameBits(am.indices, bm.indices) ||
+			!sameBits(am.num_face_vertices, bm.num_face_vertices) || !sameBits(am.material_ids, bm.material_ids) ||
+			!sameBits(am.smoothing_group_ids, bm.smoothing_group_ids))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// Churn the geometry pool: every round releases every other model and uploads them again in reverse
+// order, so freed ranges get refilled by shapes of other sizes. Reports the upload times and the pool
+// state with the holes open and after the refill.
+void benchmarkPool(JsonWriter &json, const BenchmarkOptions &opt)
+{
+	CpuTimer timer;
+	vector<ModelData> data(models.size());
+	for (int m = 0; m < models.size(); m++)
+	{
+		if (!models[m].resident || !readModelData(filenames[m], objParseThreads(1), data[m]))
+		{
+			cerr << "Cannot reload " << filenames[m] << std::endl;
+			return;
+		}
+	}
+
+	json.beginArray("pool");
+	for (int r = 0; r < opt.repeat; r++)
+	{
+		vector<int> churned;
+		for (int m = r % 2; m < models.size(); m += 2)
+		{
+			releaseModel(models[m]);
+			churned.push_back(m);
+		}
+		json.beginObject();
+		json.value("churned_models", (int)churned.size());
+		writeGeometryPoolStats(json, "released");
+
+		vector<double> upload_ms;
+		for (int i = (int)churned.size() - 1; i >= 0; i--)
+		{
+			timer.start();
+			uploadModel(data[churned[i]], models[churned[i]]);
+			glFinish();
+			upload_ms.push_back(timer.elapsedMs());
+		}
+		json.stats("upload_ms", summarize(upload_ms));
+		writeGeometryPoolStats(json, "reuploaded");
+		json.endObject();
+	}
+	json.endArray();
+}
+
+// normalization() as it was before the single pass, the reference of the load suite. It ran once per
+// shape over all of attrib, each time followed by referenceExpansion() of that shape.
+void referenceNormalization(tinyobj::attrib_t *attrib)
+{
+	vector<float> xVector, yVector, zVector;
+	float minX = 10000, maxX = -10000, minY = 10000, maxY = -10000, minZ = 10000, maxZ = -10000;
+
+	// find out min and max value of X, Y and Z axis
+	for (int i = 0; i < attrib->vertices.size(); i++)
+	{
+		if (i % 3 == 0)
+		{
+
+			xVector.push_back(attrib->vertices.at(i));
+
+			if (attrib->vertices.at(i) < minX)
+			{
+				minX = attrib->vertices.at(i);
+			}
+
+			if (attrib->vertices.at(i) > maxX)
+			{
+				maxX = attrib->vertices.at(i);
+			}
+		}
+		else if (i % 3 == 1)
+		{
+			yVector.push_back(attrib->vertices.at(i));
+
+			if (attrib->vertices.at(i) < minY)
+			{
+				minY = attrib->vertices.at(i);
+			}
+
+			if (attrib->vertices.at(i) > maxY)
+			{
+				maxY = attrib->vertices.at(i);
+			}
+		}
+		else if (i % 3 == 2)
+		{
+			zVector.push_back(attrib->vertices.at(i));
+
+			if (attrib->vertices.at(i) < minZ)
+			{
+				minZ = attrib->vertices.at(i);
+			}
+
+			if (attrib->vertices.at(i) > maxZ)
+			{
+				maxZ = attrib->vertices.at(i);
+			}
+		}
+	}
+
+	float offsetX = (maxX + minX) / 2;
+	float offsetY = (maxY + minY) / 2;
+	float offsetZ = (maxZ + minZ) / 2;
+
+	for (int i = 0; i < attrib->vertices.size(); i++)
+	{
+		if (offsetX != 0 && i % 3 == 0)
+		{
+			attrib->vertices.at(i) = attrib->vertices.at(i) - offsetX;
+		}
+		else if (offsetY != 0 && i % 3 == 1)
+		{
+			attrib->vertices.at(i) = attrib->vertices.at(i) - offsetY;
+		}
+		else if (offsetZ != 0 && i % 3 == 2)
+		{
+			attrib->vertices.at(i) = attrib->vertices.at(i) - offsetZ;
+		}
+	}
+
+	float greatestAxis = maxX - minX;
+	float distanceOfYAxis = maxY - minY;
+	float distanceOfZAxis = maxZ - minZ;
+
+	if (distanceOfYAxis > greatestAxis)
+	{
+		greatestAxis = distanceOfYAxis;
+	}
+
+	if (distanceOfZAxis > greatestAxis)
+	{
+		greatestAxis = distanceOfZAxis;
+	}
+
+	float scale = greatestAxis / 2;
+
+	for (int i = 0; i < attrib->vertices.size(); i++)
+	{
+		attrib->vertices.at(i) = attrib->vertices.at(i) / scale;
+	}
+}
+
+// The rest of the old normalization(): the shape expanded to one vertex per corner, what weldShape() replaced
+void referenceExpansion(const tinyobj::attrib_t *attrib, vector<GLfloat> &vertices, vector<GLfloat> &colors, vector<GLfloat> &normals, const tinyobj::shape_t *shape)
+{
+	size_t index_offset = 0;
+	for (size_t f = 0; f < shape->mesh.num_face_vertices.size(); f++)
+	{
+		int fv = shape->mesh.num_face_vertices[f];
+
+		// Loop over vertices in the face.
+		for (size_t v = 0; v < fv; v++)
+		{
+			// access to vertex
+			tinyobj::index_t idx = shape->mesh.indices[index_offset + v];
+			vertices.push_back(attrib->vertices[3 * idx.vertex_index + 0]);
+			vertices.push_back(attrib->vertices[3 * idx.vertex_index + 1]);
+			vertices.push_back(attrib->vertices[3 * idx.vertex_index + 2]);
+			// Optional: vertex colors
+			colors.push_back(attrib->colors[3 * idx.vertex_index + 0]);
+			colors.push_back(attrib->colors[3 * idx.vertex_index + 1]);
+			colors.push_back(attrib->colors[3 * idx.vertex_index + 2]);
+			// Optional: vertex normals
+			if (idx.normal_index >= 0)
+			{
+				normals.push_back(attrib->normals[3 * idx.normal_index + 0]);
+				normals.push_back(attrib->normals[3 * idx.normal_index + 1]);
+				normals.push_back(attrib->normals[3 * idx.normal_index + 2]);
+			}
+		}
+		index_offset += fv;
+	}
+}
+
+// Time the CPU stages of LoadModels() (parse, normalization, per-shape weld) for every file against
+// referenceNormalization() and referenceExpansion(), then the whole LoadModels() with and without the mesh cache, and how long
+// after it the model can be picked.
+// The .obj is parsed both serially and with objParseThreads(1), the two results must match.
+void benchmarkLoad(JsonWriter &json, const BenchmarkOptions &opt)
+{
+	CpuTimer timer;
+
+	json.beginArray("load");
+	for (int idx = 0; idx < filenames.size(); idx++)
+	{
+		uint64_t file_size = 0;
+		int64_t file_time;
+		getFileStamp(filenames[idx], &file_size, &file_time);
+		double file_mb = file_size / 1e6;
+
+		vector<double> parse_ms, parallel_parse_ms, parse_mbps, parallel_parse_mbps, normalize_ms, weld_ms, reference_normalize_ms, reference_expand_ms;
+		size_t vertex_count = 0, corner_count = 0, welded_count = 0, shape_count = 0;
+		bool identical = true;
+
+		for (int r = 0; r < opt.repeat; r++)
+		{
+			vector<tinyobj::shape_t> shapes, serial_shapes;
+			vector<tinyobj::material_t> materials, serial_materials;
+			tinyobj::attrib_t attrib, serial_attrib;
+			string warn, err;
+
+			timer.start();
+			if (!loadObjFile(filenames[idx], 1, serial_attrib, serial_shapes, serial_materials, warn, err))
+			{
+				cerr << err << std::endl;
+				break;
+			}
+			parse_ms.push_back(timer.elapsedMs());
+			parse_mbps.push_back(file_mb / (parse_ms.back() / 1000.0));
+
+			warn.clear();
+			err.clear();
+			timer.start();
+			if (!loadObjFile(filenames[idx], objParseThreads(1), attrib, shapes, materials, warn, err))
+			{
+				cerr << err << std::endl;
+				break;
+			}
+			parallel_parse_ms.push_back(timer.elapsedMs());
+			parallel_parse_mbps.push_back(file_mb / (parallel_parse_ms.back() / 1000.0));
+			identical = identical && sameObjData(serial_attrib, serial_shapes, attrib, shapes);
+
+			double reference_normalize = 0, reference_expand = 0;
+			for (int i = 0; i < serial_shapes.size(); i++)
+			{
+				vector<GLfloat> vertices, colors, normals;
+				timer.start();
+				referenceNormalization(&serial_attrib);
+				reference_normalize += timer.elapsedMs();
+				timer.start();
+				referenceExpansion(&serial_attrib, vertices, colors, normals, &serial_shapes[i]);
+				reference_expand += timer.elapsedMs();
+			}
+			reference_normalize_ms.push_back(reference_normalize);
+			reference_expand_ms.push_back(reference_expand);
+
+			timer.start();
+			normalization(&attrib);
+			normalize_ms.push_back(timer.elapsedMs());
+
+			timer.start();
+			corner_count = welded_count = 0;
+			for (int i = 0; i < shapes.size(); i++)
+			{
+				vector<Vertex> vertices;
+				vector<GLuint> indices;
+				weldShape(&attrib, &shapes[i], vertices, indices);
+				corner_count += indices.size();
+				welded_count += vertices.size();
+			}
+			weld_ms.push_back(timer.elapsedMs());
+
+			vertex_count = attrib.vertices.size() / 3;
+			shape_count = shapes.size();
+		}
+
+		// whole LoadModels(), parsing the .obj and then mapping the cache written by the first run, and
+		// until the pick meshes built after it are in
+		vector<double> uncached_ms, cached_ms, uncached_pick_ms, cached_pick_ms;
+		bool cache_setting = use_mesh_cache;
+		for (int pass = 0; pass < 2; pass++)
+		{
+			use_mesh_cache = pass == 1;
+			if (use_mesh_cache)
+			{
+				LoadModels(filenames[idx]); // make sure the cache exists
+				waitForPickMeshes(models.size() - 1);
+				releaseModel(models.back());
+				models.pop_back();
+			}
+			for (int r = 0; r < opt.repeat; r++)
+			{
+				timer.start();
+				LoadModels(filenames[idx]);
+				glFinish();
+				(use_mesh_cache ? cached_ms : uncached_ms).push_back(timer.elapsedMs());
+				waitForPickMeshes(models.size() - 1);
+				(use_mesh_cache ? cached_pick_ms : uncached_pick_ms).push_back(timer.elapsedMs());
+				releaseModel(models.back());
+				models.pop_back();
+			}
+		}
+		use_mesh_cache = cache_setting;
+
+		json.beginObject();
+		json.value("file", filenames[idx]);
+		json.value("shapes", (long long)shape_count);
+		json.value("vertices", (long long)vertex_count);
+		json.value("corners", (long long)corner_count);
+		json.value("welded_vertices", (long long)welded_count);
+		json.value("file_bytes", (long long)file_size);
+		json.value("parallel_identical", identical ? 1 : 0);
+		json.stats("parse_ms", summarize(parse_ms));
+		json.stats("parse_mbps", summarize(parse_mbps));
+		json.stats("parallel_parse_ms", summarize(parallel_parse_ms));
+		json.stats("parallel_parse_mbps", summarize(parallel_parse_mbps));
+		json.stats("normalize_ms", summarize(normalize_ms));
+		json.stats("weld_ms", summarize(weld_ms));
+		// the old per-shape normalization against normalization(), and with its expansion against it plus the weld
+		SampleStats normalize = summarize(normalize_ms), reference_normalize = summarize(reference_normalize_ms);
+		SampleStats reference_expand = summarize(reference_expand_ms);
+		double current = normalize.mean + summarize(weld_ms).mean;
+		json.stats("reference_normalize_ms", reference_normalize);
+		json.stats("reference_expand_ms", reference_expand);
+		json.value("normalize_speedup", normalize.mean > 0 ? reference_normalize.mean / normalize.mean : 0.0);
+		json.value("normalize_and_expand_speedup", current > 0 ? (reference_normalize.mean + reference_expand.mean) / current : 0.0);
+		json.stats("load_uncached_ms", summarize(uncached_ms));
+		json.stats("load_cached_ms", summarize(cached_ms));
+		json.stats("pick_ready_uncached_ms", summarize(uncached_pick_ms));
+		json.stats("pick_ready_cached_ms", summarize(cached_pick_ms));
+		json.endObject();
+	}
+	json.endArray();
+}
+
+// The scene BVH on its own, over 1000 to --instances boxes, grown 10x per step, spread like the culling
+// suite's crowd. update_ms is refitting after a tenth of the objects moved, one update() per moved object,
+// refit_ms the same moves followed by one refit() of every node; sah_cost against build_cost shows how far
+// the moves let the tree drift. Frustum and ray queries are timed against a linear scan of the same boxes,
+// which has to find the same objects. No GL involved.
+void benchmarkBVH(JsonWriter &json, const BenchmarkOptions &opt)
+{
+	const int frustum_queries = 64; // views turning around the center of the crowd
+	const int ray_queries = 10000;
+	const float extent = 4;
+
+	// the same pseudo-random inputs in [-2, 2) every run
+	unsigned int seed = 12345;
+	auto next = [&seed]() {
+		seed = seed * 1664525u + 1013904223u;
+		return (seed >> 8) * (4.0f / 16777216.0f) - 2.0f;
+	};
+
+	vector<Frustum> views;
+	for (int q = 0; q < frustum_queries; q++)
+	{
+		views.push_back(Frustum(project_matrix * rotateY(2 * PI * q / frustum_queries)));
+	}
+
+	CpuTimer timer;
+	const AABB unit = {Vector3(-1, -1, -1), Vector3(1, 1, 1)};
+	json.value("repeat", opt.repeat);
+	json.beginArray("bvh");
+	for (int count = 1000; count <= opt.max_instances; count *= 10)
+	{
+		TransformBatch batch;
+		scatterInstances(count, batch, extent);
+		batch.update(NULL, framePool());
+		vector<AABB> boxes(count);
+		for (int i = 0; i < count; i++)
+		{
+			boxes[i] = transformBox(unit, batch.matrix(i));
+		}
+
+		BVH tree;
+		SampleStats build = timeKernel(opt.repeat, [&]() { tree.build(boxes); });
+
+		// every tenth object moves a little, the same moves for both refits
+		vector<AABB> moved_boxes = boxes;
+		vector<double> update_ms, refit_ms;
+		for (int r = 0; r < opt.repeat; r++)
+		{
+			for (int i = 0; i < count; i += 10)
+			{
+				Vector3 offset = Vector3(next(), next(), next()) * 0.05f;
+				moved_boxes[i].lo += offset;
+				moved_boxes[i].hi += offset;
+			}
+			timer.start();
+			for (int i = 0; i < count; i += 10)
+			{
+				tree.update(i, moved_boxes[i]);
+			}
+			update_ms.push_back(timer.elapsedMs());
+
+			tree.build(boxes);
+			timer.start();
+			tree.refit(moved_boxes);
+			refit_ms.push_back(timer.elapsedMs());
+			boxes = moved_boxes;
+		}
+
+		json.beginObject();
+		json.value("objects", count);
+		json.value("nodes", tree.nodeCount());
+		json.stats("build_ms", build);
+		json.value("moved", (count + 9) / 10);
+		json.stats("update_ms", summarize(update_ms));
+		json.stats("refit_ms", summarize(refit_ms));
+		json.value("build_cost", (double)tree.buildCost());
+		json.value("sah_cost", (double)tree.sahCost());
+
+		// frustum culling, the linear scan being Frustum::intersectsBox() on every box
+		vector<uint8_t> visible, linear_visible(count);
+		bool cull_matches = true;
+		int visible_total = 0;
+		for (int q = 0; q < frustum_queries; q++)
+		{
+			visible_total += tree.cull(views[q], visible);
+			for (int i = 0; i < count; i++)
+			{
+				linear_visible[i] = views[q].intersectsBox(boxes[i].lo, boxes[i].hi) ? 1 : 0;
+			}
+			cull_matches = cull_matches && visible == linear_visible;
+		}
+		SampleStats cull = timeKernel(opt.repeat, [&]() {
+			for (int q = 0; q < frustum_queries; q++)
+			{
+				tree.cull(views[q], visible);
+			}
+		});
+		SampleStats linear_cull = timeKernel(opt.repeat, [&]() {
+			for (int q = 0; q < frustum_queries; q++)
+			{
+				for (int i = 0; i < count; i++)
+				{
+					linear_visible[i] = views[q].intersectsBox(boxes[i].lo, boxes[i].hi) ? 1 : 0;
+				}
+			}
+		});
+		json.value("visible_per_query", (double)visible_total / frustum_queries);
+		json.value("cull_queries_per_sec", cull.mean > 0 ? frustum_queries * 1000.0 / cull.mean : 0.0);
+		json.value("linear_cull_queries_per_sec", linear_cull.mean > 0 ? frustum_queries * 1000.0 / linear_cull.mean : 0.0);
+		json.value("cull_matches_linear", cull_matches ? 1 : 0);
+
+		// rays from a shell around the crowd toward points inside it; the linear scan only gets
+		// enough rays for about 10M box tests
+		vector<Vector3> origins(ray_queries), directions(ray_queries);
+		for (int i = 0; i < ray_queries; i++)
+		{
+			Vector3 out(next(), next(), next());
+			origins[i] = out.normalize() * (2 * extent);
+			Vector3 target = Vector3(next(), next(), next()) * (extent / 2);
+			directions[i] = (target - origins[i]).normalize();
+		}
+		int linear_rays = min(ray_queries, max(10, 10000000 / count));
+		vector<float> ray_t(ray_queries), linear_t(linear_rays);
+		int hits = 0;
+		SampleStats rays = timeKernel(opt.repeat, [&]() {
+			hits = 0;
+			for (int i = 0; i < ray_queries; i++)
+			{
+				ray_t[i] = FLT_MAX;
+				hits += tree.raycastBoxes(origins[i], directions[i], ray_t[i]) >= 0;
+			}
+		});
+		SampleStats linear = timeKernel(opt.repeat, [&]() {
+			for (int i = 0; i < linear_rays; i++)
+			{
+				Vector3 inv(1.0f / directions[i].x, 1.0f / directions[i].y, 1.0f / directions[i].z);
+				linear_t[i] = FLT_MAX;
+				for (int k = 0; k < count; k++)
+				{
+					float t;
+					if (intersectRayBox(origins[i], inv, boxes[k], linear_t[i], t))
+					{
+						linear_t[i] = min(linear_t[i], t);
+					}
+				}
+			}
+		});
+		bool rays_match = true;
+		for (int i = 0; i < linear_rays; i++)
+		{
+			rays_match = rays_match && ray_t[i] == linear_t[i];
+		}
+		json.value("ray_hits", (double)hits / ray_queries);
+		json.value("rays_per_sec", rays.mean > 0 ? ray_queries * 1000.0 / rays.mean : 0.0);
+		json.value("linear_rays_per_sec", linear.mean > 0 ? linear_rays * 1000.0 / linear.mean : 0.0);
+		json.value("rays_match_linear", rays_match ? 1 : 0);
+		json.endObject();
+	}
+	json.endArray();
+}
+
+// Picking each model through a grid of rays over the left half of the view. build_ms is building the
+// model's pick meshes, as the loader threads do after upload; pick_ms is one pickAt(), unprojection included, and
+// linear_pick_ms the same against every triangle, on a sample of the rays sized for about 20M
+// triangle tests, which has to find the same hits.
+void benchmarkPicking(JsonWriter &json, const BenchmarkOptions &opt)
+{
+	const int grid = 32;
+	CpuTimer timer;
+
+	json.beginArray("picking");
+	for (int idx = 0; idx < models.size(); idx++)
+	{
+		ModelData data;
+		if (!models[idx].resident || !readModelData(filenames[idx], objParseThreads(1), data))
+		{
+			continue;
+		}
+		vector<TriangleMesh> meshes;
+		SampleStats build = timeKernel(opt.repeat, [&]() { buildPickMeshes(data, meshes); });
+		int triangles = 0, nodes = 0;
+		for (int i = 0; i < meshes.size(); i++)
+		{
+			triangles += meshes[i].triangleCount();
+			nodes += meshes[i].tree().nodeCount();
+		}
+
+		cur_idx = idx;
+		waitForPickMeshes(idx); // not part of the first pick_ms
+		vector<double> pick_ms, linear_ms;
+		vector<PickHit> hits;
+		int hit_count = 0;
+		for (int r = 0; r < grid * grid; r++)
+		{
+			float x = (r % grid + 0.5f) * WINDOW_WIDTH / 2 / grid, y = (r / grid + 0.5f) * WINDOW_HEIGHT / grid;
+			timer.start();
+			hits.push_back(pickAt(x, y, WINDOW_WIDTH, WINDOW_HEIGHT));
+			pick_ms.push_back(timer.elapsedMs());
+			hit_count += hits.back().model >= 0;
+		}
+
+		int step = max(1, (int)((long long)grid * grid * triangles / 20000000));
+		bool matches = true;
+		for (int r = 0; r < grid * grid; r += step)
+		{
+			float x = (r % grid + 0.5f) * WINDOW_WIDTH / 2 / grid, y = (r / grid + 0.5f) * WINDOW_HEIGHT / grid;
+			timer.start();
+			PickHit linear = pickAt(x, y, WINDOW_WIDTH, WINDOW_HEIGHT, true);
+			linear_ms.push_back(timer.elapsedMs());
+			// equally close triangles, e.g. across a shared edge, may be found in either order
+			matches = matches && linear.model == hits[r].model && linear.t == hits[r].t;
+		}
+
+		json.beginObject();
+		json.value("file", filenames[idx]);
+		json.value("shapes", (int)meshes.size());
+		json.value("triangles", triangles);
+		json.value("bvh_nodes", nodes);
+		json.stats("build_ms", build);
+		json.value("rays", grid * grid);
+		json.value("hit_rate", (double)hit_count / (grid * grid));
+		json.stats("pick_ms", summarize(pick_ms));
+		json.stats("linear_pick_ms", summarize(linear_ms));
+		json.value("matches_linear", matches ? 1 : 0);
+		json.endObject();
+	}
+	json.endArray();
+}
+
+void printBenchmarkUsage(const char *exe)
+{
+	cout << "usage: " << exe << " [options] [model.obj ...]\n"
+		 << "  --suite NAME    render (default), load, math, instancing, transforms (instance updates), lights (clustered)\n"
+		 << "                  sidebyside (two-pass vs single-pass halves) or multidraw (per-shape draws vs one\n"
+		 << "                  multi-draw, 10 to --instances shapes; small models keep the GPU side short)\n"
+		 << "                  pool (release and re-upload models, geometry pool fragmentation) or culling\n"
+		 << "                  (a crowd spread past the view, with and without frustum culling) or bvh (scene BVH\n"
+		 << "                  build, refit and query times against linear scans, 1000 to --instances boxes) or\n"
+		 << "                  picking (cursor rays against each model's triangle BVHs and a linear scan)\n"
+		 << "  --frames N      measured frames per model (default 200)\n"
+		 << "  --warmup N      unmeasured frames per model (default 20)\n"
+		 << "  --size WxH      offscreen framebuffer size (default 800x800)\n"
+		 << "  --repeat N      runs per file for the load suite, per kernel for the math suite, rounds of the pool suite (default 5)\n"
+		 << "  --instances N   largest crowd of the instancing, transforms, culling and bvh suites, grown 10x per step (default 100000)\n"
+		 << "  --lights N      largest light list of the lights suite, 3 then 16 grown 4x per step (default 1024, at most 65536)\n"
+		 << "  --light N       light mode: 0 directional (default), 1 point, 2 spot, 3 clustered (256 lights)\n"
+		 << "  --animate       rotate the model every frame\n"
+		 << "  --single-pass   draw both halves from one vertex pass through shader.gs instead of one pass per half\n"
+		 << "  --multi-draw    draw each model's shapes as one multi-draw list instead of one draw per shape\n"
+		 << "  --no-cull       draw every shape and instance, without testing them against the view frustum\n"
+		 << "  --packed        16-byte packed vertices instead of 36-byte float vertices\n"
+		 << "  --no-cache      always parse the .obj files, never read or write .meshcache files\n"
+		 << "  --parse-threads N  threads per .obj parse, 0 one per hardware thread, 1 serial (default: 0 for a\n"
+		 << "                  single file, 1 per file when the loader threads parse several at once)\n"
+		 << "  --out FILE      JSON report path (default benchmark.json, - for stdout)\n"
+		 << "  --dump PREFIX   save the last frame of each model to PREFIX<n>.ppm\n"
+		 << "Run from the project directory so shader.vs/shader.fs and ../NormalModels resolve.\n";
+}
+
+int main(int argc, char **argv)
+{
+	BenchmarkOptions opt;
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		bool has_value = i + 1 < argc;
+		if (arg == "--frames" && has_value)
+			opt.frames = atoi(argv[++i]);
+		else if (arg == "--warmup" && has_value)
+			opt.warmup = atoi(argv[++i]);
+		else if (arg == "--size" && has_value)
+			sscanf(argv[++i], "%dx%d", &WINDOW_WIDTH, &WINDOW_HEIGHT);
+		else if (arg == "--suite" && has_value)
+			opt.suite = argv[++i];
+		else if (arg == "--repeat" && has_value)
+			opt.repeat = atoi(argv[++i]);
+		else if (arg == "--instances" && has_value)
+			opt.max_instances = atoi(argv[++i]);
+		else if (arg == "--lights" && has_value)
+		{
+			opt.max_lights = atoi(argv[++i]);
+			if (opt.max_lights > LightClusters::MaxLights)
+			{
+				cerr << "--lights is limited to " << LightClusters::MaxLights << " (16-bit light numbers)" << std::endl;
+				opt.max_lights = LightClusters::MaxLights;
+			}
+		}
+		else if (arg == "--light" && has_value)
+		{
+			int mode = atoi(argv[++i]);
+			if (mode < 0 || mode >= LightModeCount)
+			{
+				cerr << "--light must be 0 to " << LightModeCount - 1 << std::endl;
+				return 1;
+			}
+			opt.light_mode = (LightMode)mode;
+		}
+		else if (arg == "--animate")
+			opt.animate = true;
+		else if (arg == "--single-pass")
+			single_pass_side_by_side = true;
+		else if (arg == "--two-pass")
+			single_pass_side_by_side = false;
+		else if (arg == "--packed")
+			vertex_layout = InterleavedPacked;
+		else if (arg == "--multi-draw")
+			multi_draw = true;
+		else if (arg == "--no-cull")
+			frustum_culling = false;
+		else if (arg == "--no-cache")
+			use_mesh_cache = false;
+		else if (arg == "--parse-threads" && has_value)
+			obj_parse_threads = atoi(argv[++i]);
+		else if (arg == "--out" && has_value)
+			opt.out = argv[++i];
+		else if (arg == "--dump" && has_value)
+			opt.dump_prefix = argv[++i];
+		else if (arg[0] == '-')
+		{
+			printBenchmarkUsage(argv[0]);
+			return arg == "--help" ? 0 : 1;
+		}
+		else
+			filenames.push_back(arg);
+	}
+
+	const char *suites[] = {"render", "load", "math", "bvh", "instancing", "transforms", "lights", "multidraw", "pool", "culling", "picking", "sidebyside"};
+	if (find(begin(suites), end(suites), opt.suite) == end(suites))
+	{
+		cerr << "Unknown suite " << opt.suite << std::endl;
+		printBenchmarkUsage(argv[0]);
+		return 1;
+	}
+
+	if (!createHeadlessContext(WINDOW_WIDTH, WINDOW_HEIGHT))
+	{
+		return -1;
+	}
+	glPrintContextInfo(false);
+	loadExtensions(headlessProcAddress);
+
+	if (filenames.empty())
+	{
+		filenames = default_filenames;
+	}
+
+	ofstream file;
+	if (opt.out != "-")
+	{
+		file.open(opt.out);
+		if (!file)
+		{
+			cerr << "Cannot write " << opt.out << std::endl;
+			destroyHeadlessContext();
+			return 1;
+		}
+	}
+	JsonWriter json(opt.out != "-" ? file : cout);
+
+	json.beginObject();
+	json.value("renderer", string((const char *)glGetString(GL_RENDERER)));
+	json.value("gl_version", string((const char *)glGetString(GL_VERSION)));
+	json.value("width", WINDOW_WIDTH);
+	json.value("height", WINDOW_HEIGHT);
+	json.value("suite", opt.suite);
+	json.value("parse_threads", obj_parse_threads);
+	if (opt.suite == "math")
+	{
+		benchmarkMath(json, opt);
+	}
+	else if (opt.suite == "bvh")
+	{
+		initParameter(); // the default projection
+		benchmarkBVH(json, opt);
+	}
+	else if (opt.suite == "load")
+	{
+		json.value("repeat", opt.repeat);
+		setShaders(); // LoadModels() needs the uniform block layout
+		benchmarkLoad(json, opt);
+	}
+	else
+	{
+		glEnable(GL_DEPTH_TEST);
+		CpuTimer load_timer;
+		load_timer.start();
+		setupRC();
+		RenderScene();
+		glFinish();
+		json.value("first_frame_ms", load_timer.elapsedMs());
+		waitForModels();
+		if (failed_models > 0)
+		{
+			// no report, a model that is not there would be measured as an empty one
+			cerr << failed_models << " of " << models.size() << " models could not be loaded" << std::endl;
+			if (opt.out != "-")
+			{
+				file.close();
+				remove(opt.out.c_str());
+			}
+			shutdownThreadPools();
+			destroyHeadlessContext();
+			return 1;
+		}
+		cur_light_mode = opt.light_mode;
+		json.value("load_ms", load_timer.elapsedMs());
+		json.value("frames", opt.frames);
+		json.value("light_mode", (int)opt.light_mode);
+		json.value("vertex_stride", vertexStride(vertex_layout));
+		json.value("single_pass_side_by_side", single_pass_side_by_side ? 1 : 0);
+		json.value("multi_draw", multi_draw ? 1 : 0);
+		json.value("frustum_culling", frustum_culling ? 1 : 0);
+		writeGeometryPoolStats(json, "geometry_pool");
+		if (opt.suite == "instancing")
+			benchmarkInstancing(json, opt);
+		else if (opt.suite == "transforms")
+			benchmarkTransforms(json, opt);
+		else if (opt.suite == "lights")
+			benchmarkLights(json, opt);
+		else if (opt.suite == "multidraw")
+			benchmarkMultiDraw(json, opt);
+		else if (opt.suite == "pool")
+			benchmarkPool(json, opt);
+		else if (opt.suite == "culling")
+			benchmarkCulling(json, opt);
+		else if (opt.suite == "picking")
+			benchmarkPicking(json, opt);
+		else if (opt.suite == "sidebyside")
+		{
+			useSideBySideMode(false);
+			benchmarkRender(json, opt, "two_pass");
+			useSideBySideMode(true);
+			benchmarkRender(json, opt, "single_pass");
+		}
+		else
+			benchmarkRender(json, opt);
+	}
+	json.endObject();
+
+	if (opt.out != "-")
+	{
+		file.close();
+		if (!file)
+		{
+			cerr << "Cannot write " << opt.out << std::endl;
+			shutdownThreadPools();
+			destroyHeadlessContext();
+			return 1;
+		}
+		cout << "Benchmark report written to " << opt.out << endl;
+	}
+	shutdownThreadPools();
+	destroyHeadlessContext();
+	return 0;
+}
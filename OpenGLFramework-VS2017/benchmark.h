@@ -0,0 +1,95 @@
+#ifndef BENCHMARK_H_DEF
+#define BENCHMARK_H_DEF
+
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <glad/glad.h>
+
+// Headless benchmark support: an offscreen GL context (EGL surfaceless, e.g. Mesa llvmpipe)
+// plus the timing and JSON reporting helpers of the benchmark suites in benchmark.cpp.
+
+// Create a core profile context with no window and bind a width x height FBO as render target
+bool createHeadlessContext(int width, int height);
+void destroyHeadlessContext();
+// Entry point lookup of the headless context, for functions past the GL 4.2 glad loads
+void *headlessProcAddress(const char *name);
+
+// Wall clock timer in milliseconds
+class CpuTimer
+{
+public:
+	void start() { begin = std::chrono::steady_clock::now(); }
+	double elapsedMs() const
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+	}
+
+private:
+	std::chrono::steady_clock::time_point begin;
+};
+
+// GL_TIME_ELAPSED query around a block of GL commands
+class GpuTimer
+{
+public:
+	GpuTimer();
+	~GpuTimer();
+	void start();
+	void stop();
+	double resultMs(); // blocks until the result is available
+
+private:
+	GLuint query;
+};
+
+#ifndef GL_VERTEX_SHADER_INVOCATIONS_ARB
+#define GL_VERTEX_SHADER_INVOCATIONS_ARB 0x82F0
+#endif
+
+// GL_ARB_pipeline_statistics_query count of vertex shader runs around a block of GL commands
+class VertexInvocationCounter
+{
+public:
+	VertexInvocationCounter(); // query stays 0 when the driver lacks the extension
+	~VertexInvocationCounter();
+	bool supported() const { return query != 0; }
+	void start();
+	void stop();
+	long long result(); // blocks until the result is available, -1 when unsupported
+
+private:
+	GLuint query;
+};
+
+struct SampleStats
+{
+	double mean, median, p95, min, max;
+};
+SampleStats summarize(std::vector<double> samples);
+
+// Minimal streaming JSON writer, handles nesting and comma placement
+class JsonWriter
+{
+public:
+	explicit JsonWriter(std::ostream &os) : os(os) {}
+
+	JsonWriter &beginObject(const char *key = NULL);
+	JsonWriter &endObject();
+	JsonWriter &beginArray(const char *key = NULL);
+	JsonWriter &endArray();
+	JsonWriter &value(const char *key, double v);
+	JsonWriter &value(const char *key, long long v);
+	JsonWriter &value(const char *key, int v) { return value(key, (long long)v); }
+	JsonWriter &value(const char *key, const std::string &v);
+	JsonWriter &stats(const char *key, const SampleStats &s);
+
+private:
+	void prefix(const char *key);
+
+	std::ostream &os;
+	std::vector<bool> first; // one entry per open scope
+};
+
+#endif
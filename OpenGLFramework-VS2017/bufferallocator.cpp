@@ -0,0 +1,99 @@
+#include "bufferallocator.h"
+
+#include <iterator>
+
+void BufferAllocator::reset(size_t capacity)
+{
+	total = capacity;
+	used = 0;
+	free_by_offset.clear();
+	free_by_size.clear();
+	allocations.clear();
+	if (capacity > 0)
+	{
+		addFree(0, capacity);
+	}
+}
+
+void BufferAllocator::addFree(size_t offset, size_t size)
+{
+	free_by_offset[offset] = size;
+	free_by_size.insert(std::make_pair(size, offset));
+}
+
+void BufferAllocator::removeFree(std::map<size_t, size_t>::iterator block)
+{
+	auto range = free_by_size.equal_range(block->second);
+	for (auto it = range.first; it != range.second; ++it)
+	{
+		if (it->second == block->first)
+		{
+			free_by_size.erase(it);
+			break;
+		}
+	}
+	free_by_offset.erase(block);
+}
+
+size_t BufferAllocator::allocate(size_t size, size_t alignment)
+{
+	if (size == 0)
+	{
+		size = 1; // every allocation needs an offset of its own
+	}
+
+	// smallest block that still fits once its start is aligned
+	for (auto it = free_by_size.lower_bound(size); it != free_by_size.end(); ++it)
+	{
+		size_t start = it->second, block_size = it->first;
+		size_t offset = (start + alignment - 1) / alignment * alignment;
+		if (offset + size > start + block_size)
+		{
+			continue;
+		}
+
+		removeFree(free_by_offset.find(start));
+		size_t end = offset + size;
+		if (end < start + block_size)
+		{
+			addFree(end, start + block_size - end);
+		}
+		Block block = {start, end - start};
+		allocations[offset] = block;
+		used += block.size;
+		return offset;
+	}
+	return NoSpace;
+}
+
+void BufferAllocator::free(size_t offset)
+{
+	auto found = allocations.find(offset);
+	if (found == allocations.end())
+	{
+		return;
+	}
+	size_t start = found->second.start, size = found->second.size;
+	used -= size;
+	allocations.erase(found);
+
+	// merge with the free blocks right after and right before
+	auto next = free_by_offset.lower_bound(start);
+	if (next != free_by_offset.end() && next->first == start + size)
+	{
+		size += next->second;
+		removeFree(next);
+	}
+	auto after = free_by_offset.lower_bound(start);
+	if (after != free_by_offset.begin())
+	{
+		auto prev = std::prev(after);
+		if (prev->first + prev->second == start)
+		{
+			start = prev->first;
+			size += prev->second;
+			removeFree(prev);
+		}
+	}
+	addFree(start, size);
+}
@@ -0,0 +1,46 @@
+#ifndef BUFFERALLOCATOR_H_DEF
+#define BUFFERALLOCATOR_H_DEF
+
+#include <stddef.h>
+#include <map>
+#include <unordered_map>
+
+// Offset bookkeeping for one fixed-size buffer: best fit from a free list, and freed blocks merge
+// with their free neighbours. It never touches GL, the owner uploads into the ranges it hands out.
+class BufferAllocator
+{
+public:
+	static const size_t NoSpace = (size_t)-1;
+
+	explicit BufferAllocator(size_t capacity = 0) { reset(capacity); }
+	void reset(size_t capacity); // forget every allocation, the whole range is one free block
+
+	// Offset of size bytes at a multiple of alignment (any positive value, e.g. a vertex stride),
+	// NoSpace when no free block is large enough
+	size_t allocate(size_t size, size_t alignment);
+	void free(size_t offset); // an offset allocate() returned
+
+	size_t capacity() const { return total; }
+	size_t usedBytes() const { return used; } // alignment padding included
+	size_t freeBytes() const { return total - used; }
+	int freeBlocks() const { return (int)free_by_offset.size(); }
+	size_t largestFreeBlock() const { return free_by_size.empty() ? 0 : free_by_size.rbegin()->first; }
+	bool empty() const { return used == 0; }
+
+private:
+	void addFree(size_t offset, size_t size);
+	void removeFree(std::map<size_t, size_t>::iterator block);
+
+	struct Block
+	{
+		size_t start; // before the alignment padding
+		size_t size;  // padding included
+	};
+
+	size_t total, used;
+	std::map<size_t, size_t> free_by_offset;		// offset -> size, to find neighbours
+	std::multimap<size_t, size_t> free_by_size;		// size -> offset, for best fit
+	std::unordered_map<size_t, Block> allocations; // by the offset handed out
+};
+
+#endif
@@ -0,0 +1,348 @@
+#include "bvh.h"
+#include "frustum.h"
+
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+
+// Surface area heuristic: a query pays TraversalCost per inner node and IntersectCost per object it reaches
+static const float TraversalCost = 1.0f;
+static const float IntersectCost = 1.0f;
+static const int Bins = 16;
+static const int MaxLeafObjects = 8; // a larger leaf is split even when SAH prefers the leaf
+static const int MaxDepth = 48;		 // keeps the traversal stacks below 64 entries
+
+AABB AABB::empty()
+{
+	AABB box;
+	box.lo = Vector3(FLT_MAX, FLT_MAX, FLT_MAX);
+	box.hi = Vector3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	return box;
+}
+
+void AABB::grow(const AABB &box)
+{
+	lo = Vector3(std::min(lo.x, box.lo.x), std::min(lo.y, box.lo.y), std::min(lo.z, box.lo.z));
+	hi = Vector3(std::max(hi.x, box.hi.x), std::max(hi.y, box.hi.y), std::max(hi.z, box.hi.z));
+}
+
+float AABB::area() const
+{
+	if (isEmpty())
+	{
+		return 0;
+	}
+	Vector3 d = hi - lo;
+	return 2 * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+static bool sameBox(const AABB &a, const AABB &b)
+{
+	return a.lo == b.lo && a.hi == b.hi;
+}
+
+AABB transformBox(const AABB &box, const Matrix4 &m)
+{
+	if (box.isEmpty())
+	{
+		return box;
+	}
+	Vector3 c = box.center(), e = (box.hi - box.lo) * 0.5f;
+	const float *a = m.get();
+	float center[3], extent[3];
+	for (int row = 0; row < 3; row++)
+	{
+		const float *r = a + 4 * row;
+		center[row] = r[0] * c.x + r[1] * c.y + r[2] * c.z + r[3];
+		extent[row] = fabsf(r[0]) * e.x + fabsf(r[1]) * e.y + fabsf(r[2]) * e.z;
+	}
+	AABB out;
+	out.lo = Vector3(center[0] - extent[0], center[1] - extent[1], center[2] - extent[2]);
+	out.hi = Vector3(center[0] + extent[0], center[1] + extent[1], center[2] + extent[2]);
+	return out;
+}
+
+bool intersectRayBox(const Vector3 &origin, const Vector3 &inv_direction, const AABB &box, float t_max, float &t_near)
+{
+	// near and far slab picked by the direction's sign, so an empty box (lo > hi) never passes
+	float t0 = 0, t1 = t_max;
+	for (int k = 0; k < 3; k++)
+	{
+		float inv = inv_direction[k];
+		float a = ((inv >= 0 ? box.lo[k] : box.hi[k]) - origin[k]) * inv;
+		float b = ((inv >= 0 ? box.hi[k] : box.lo[k]) - origin[k]) * inv;
+		t0 = a > t0 ? a : t0;
+		t1 = b < t1 ? b : t1;
+	}
+	t_near = t0;
+	return t0 <= t1;
+}
+
+const AABB &BVH::bounds() const
+{
+	static const AABB none = AABB::empty();
+	return nodes.empty() ? none : nodes[0].box;
+}
+
+void BVH::build(const std::vector<AABB> &new_boxes)
+{
+	boxes = new_boxes;
+	nodes.clear();
+	parents.clear();
+	int count = (int)boxes.size();
+	objects.resize(count);
+	leaf_of.resize(count);
+	std::vector<Vector3> centers(count);
+	for (int i = 0; i < count; i++)
+	{
+		objects[i] = i;
+		centers[i] = boxes[i].center();
+	}
+	if (count > 0)
+	{
+		nodes.reserve(2 * count);
+		parents.reserve(2 * count);
+		buildNode(-1, 0, count, centers, 0);
+	}
+	build_cost = sahCost();
+}
+
+int BVH::buildNode(int parent, int first, int count, std::vector<Vector3> &centers, int depth)
+{
+	int index = (int)nodes.size();
+	nodes.push_back(Node());
+	parents.push_back(parent);
+
+	AABB box = AABB::empty(), centroids = AABB::empty();
+	for (int i = first; i < first + count; i++)
+	{
+		box.grow(boxes[objects[i]]);
+		AABB point = {centers[objects[i]], centers[objects[i]]};
+		centroids.grow(point);
+	}
+	nodes[index].box = box;
+
+	// cheapest split over Bins centroid bins per axis
+	int best_axis = -1, best_bin = 0;
+	float best_cost = FLT_MAX;
+	if (count > 2 && depth < MaxDepth)
+	{
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float lo = centroids.lo[axis], extent = centroids.hi[axis] - lo;
+			if (!(extent > 0))
+			{
+				continue;
+			}
+			float scale = Bins / extent;
+			AABB bin_box[Bins];
+			int bin_count[Bins] = {0};
+			for (int b = 0; b < Bins; b++)
+			{
+				bin_box[b] = AABB::empty();
+			}
+			for (int i = first; i < first + count; i++)
+			{
+				int b = std::min(Bins - 1, (int)((centers[objects[i]][axis] - lo) * scale));
+				bin_box[b].grow(boxes[objects[i]]);
+				bin_count[b]++;
+			}
+
+			// right side areas swept from the top, left side from the bottom
+			float right_area[Bins];
+			int right_count[Bins];
+			AABB right = AABB::empty();
+			int n = 0;
+			for (int b = Bins - 1; b > 0; b--)
+			{
+				right.grow(bin_box[b]);
+				n += bin_count[b];
+				right_area[b] = right.area();
+				right_count[b] = n;
+			}
+			AABB left = AABB::empty();
+			n = 0;
+			for (int b = 1; b < Bins; b++)
+			{
+				left.grow(bin_box[b - 1]);
+				n += bin_count[b - 1];
+				if (n == 0 || right_count[b] == 0)
+				{
+					continue;
+				}
+				float cost = left.area() * n + right_area[b] * right_count[b];
+				if (cost < best_cost)
+				{
+					best_cost = cost;
+					best_axis = axis;
+					best_bin = b;
+				}
+			}
+		}
+	}
+
+	int mid = first;
+	float leaf_cost = IntersectCost * count;
+	float area = box.area();
+	bool split = false;
+	if (best_axis >= 0)
+	{
+		float split_cost = TraversalCost + IntersectCost * (area > 0 ? best_cost / area : count);
+		if (split_cost < leaf_cost || count > MaxLeafObjects)
+		{
+			float lo = centroids.lo[best_axis], scale = Bins / (centroids.hi[best_axis] - lo);
+			int *middle = std::partition(&objects[first], &objects[first] + count, [&](int object) {
+				return std::min(Bins - 1, (int)((centers[object][best_axis] - lo) * scale)) < best_bin;
+			});
+			mid = (int)(middle - &objects[0]);
+			split = true;
+		}
+	}
+	else if (count > MaxLeafObjects && depth < MaxDepth)
+	{
+		// every centroid in one point, halves are as good as any split
+		mid = first + count / 2;
+		split = true;
+	}
+
+	if (!split || mid == first || mid == first + count)
+	{
+		nodes[index].first = first;
+		nodes[index].count = count;
+		for (int i = first; i < first + count; i++)
+		{
+			leaf_of[objects[i]] = index;
+		}
+		return index;
+	}
+
+	buildNode(index, first, mid - first, centers, depth + 1);
+	int right = buildNode(index, mid, first + count - mid, centers, depth + 1);
+	nodes[index].first = right;
+	nodes[index].count = 0;
+	return index;
+}
+
+void BVH::refitNode(int index)
+{
+	Node &node = nodes[index];
+	AABB box = AABB::empty();
+	if (node.count > 0)
+	{
+		for (int i = node.first; i < node.first + node.count; i++)
+		{
+			box.grow(boxes[objects[i]]);
+		}
+	}
+	else
+	{
+		box = nodes[index + 1].box;
+		box.grow(nodes[node.first].box);
+	}
+	node.box = box;
+}
+
+void BVH::update(int object, const AABB &box)
+{
+	boxes[object] = box;
+	for (int index = leaf_of[object]; index >= 0; index = parents[index])
+	{
+		AABB old = nodes[index].box;
+		refitNode(index);
+		if (sameBox(old, nodes[index].box))
+		{
+			break; // nothing above changes either
+		}
+	}
+}
+
+void BVH::refit(const std::vector<AABB> &new_boxes)
+{
+	boxes = new_boxes;
+	// children come after their parent, so a reverse sweep sees them first
+	for (int index = (int)nodes.size() - 1; index >= 0; index--)
+	{
+		refitNode(index);
+	}
+}
+
+float BVH::sahCost() const
+{
+	if (nodes.empty() || nodes[0].box.area() <= 0)
+	{
+		return 0;
+	}
+	float cost = 0;
+	for (size_t i = 0; i < nodes.size(); i++)
+	{
+		const Node &node = nodes[i];
+		cost += node.box.area() * (node.count > 0 ? IntersectCost * node.count : TraversalCost);
+	}
+	return cost / nodes[0].box.area();
+}
+
+int BVH::cull(const Frustum &frustum, std::vector<uint8_t> &visible) const
+{
+	visible.assign(boxes.size(), 0);
+	if (nodes.empty())
+	{
+		return 0;
+	}
+
+	int inside_count = 0;
+	struct Entry
+	{
+		int node;
+		bool inside; // the node's box is inside every plane, so is everything under it
+	} stack[64];
+	int top = 0;
+	stack[top++] = {0, false};
+	while (top > 0)
+	{
+		Entry entry = stack[--top];
+		const Node &node = nodes[entry.node];
+		if (node.box.isEmpty())
+		{
+			continue;
+		}
+		if (!entry.inside)
+		{
+			if (!frustum.intersectsBox(node.box.lo, node.box.hi))
+			{
+				continue;
+			}
+			entry.inside = frustum.containsBox(node.box.lo, node.box.hi);
+		}
+
+		if (node.count == 0)
+		{
+			stack[top++] = {node.first, entry.inside};
+			stack[top++] = {entry.node + 1, entry.inside};
+			continue;
+		}
+		for (int i = node.first; i < node.first + node.count; i++)
+		{
+			const AABB &box = boxes[objects[i]];
+			if (!box.isEmpty() && (entry.inside || frustum.intersectsBox(box.lo, box.hi)))
+			{
+				visible[objects[i]] = 1;
+				inside_count++;
+			}
+		}
+	}
+	return inside_count;
+}
+
+int BVH::raycastBoxes(const Vector3 &origin, const Vector3 &direction, float &t) const
+{
+	Vector3 inv(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+	return raycast(origin, direction, t, [this, &origin, &inv](int object, float &t_hit) {
+		float t_box;
+		if (intersectRayBox(origin, inv, boxes[object], t_hit, t_box) && t_box < t_hit)
+		{
+			t_hit = t_box;
+			return true;
+		}
+		return false;
+	});
+}
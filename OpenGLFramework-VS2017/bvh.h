@@ -0,0 +1,152 @@
+#ifndef BVH_H_DEF
+#define BVH_H_DEF
+
+#include <stdint.h>
+#include <vector>
+#include "Vectors.h"
+#include "Matrices.h"
+
+class Frustum;
+
+// Axis-aligned box; lo > hi on any axis is empty, and never hit or visible
+struct AABB
+{
+	Vector3 lo, hi;
+
+	static AABB empty();
+	bool isEmpty() const { return lo.x > hi.x || lo.y > hi.y || lo.z > hi.z; }
+	void grow(const AABB &box);
+	float area() const; // surface area, 0 when empty
+	Vector3 center() const { return (lo + hi) * 0.5f; }
+};
+
+// The box around a box under an affine matrix: center transformed, half extents through |M|
+AABB transformBox(const AABB &box, const Matrix4 &m);
+
+// Slab test of a ray, origin + t * direction, given 1 / direction per axis. The entry distance
+// goes to t_near; false when the ray misses or enters past t_max.
+bool intersectRayBox(const Vector3 &origin, const Vector3 &inv_direction, const AABB &box, float t_max, float &t_near);
+
+// Bounding volume hierarchy over the boxes of many objects. build() splits by the surface area
+// heuristic over binned centroids; as objects move, update() refits the path above one object and
+// refit() every node, which keeps queries correct but lets the tree quality drift: rebuild once
+// sahCost() grows well past buildCost(). Nodes are in depth-first order, each left child right
+// after its parent.
+class BVH
+{
+public:
+	BVH() : build_cost(0) {}
+
+	void build(const std::vector<AABB> &boxes);
+	void clear() { build(std::vector<AABB>()); }
+	int size() const { return (int)boxes.size(); }
+	int nodeCount() const { return (int)nodes.size(); }
+	const AABB &box(int object) const { return boxes[object]; }
+	const AABB &bounds() const; // of the whole tree
+
+	void update(int object, const AABB &box); // refit the leaf of object and its ancestors
+	void refit(const std::vector<AABB> &boxes); // new boxes for every object, one bottom-up pass
+
+	// expected cost of a query through the tree, relative to testing the root box; see build()
+	float sahCost() const;
+	float buildCost() const { return build_cost; }
+
+	// visible[i] = whether box i reaches into the frustum, as Frustum::intersectsBox() would say,
+	// skipping subtrees outside the frustum and tests inside it. Returns the visible count.
+	int cull(const Frustum &frustum, std::vector<uint8_t> &visible) const;
+
+	// Closest object along a ray within t. intersect(object, t) tests the object itself, e.g. its
+	// triangles, and lowers t when it finds a closer hit; boxes only skip objects the ray misses.
+	// Children are visited near first, so most far subtrees fail their box test against the
+	// shrinking t. Returns the object hit, or -1 with t unchanged.
+	template <typename Intersect>
+	int raycast(const Vector3 &origin, const Vector3 &direction, float &t, Intersect intersect) const;
+
+	// the closest object box along the ray, t its entry distance
+	int raycastBoxes(const Vector3 &origin, const Vector3 &direction, float &t) const;
+
+private:
+	struct Node
+	{
+		AABB box;
+		int first; // leaf: first object in objects, inner node: right child
+		int count; // objects in a leaf, 0 for an inner node
+	};
+
+	int buildNode(int parent, int first, int count, std::vector<Vector3> &centers, int depth);
+	void refitNode(int node);
+
+	std::vector<AABB> boxes;   // per object
+	std::vector<Node> nodes;   // [0] is the root
+	std::vector<int> parents;  // per node, -1 for the root
+	std::vector<int> objects;  // object ids, leaves own contiguous ranges
+	std::vector<int> leaf_of;  // per object, the leaf listing it
+	float build_cost;
+};
+
+template <typename Intersect>
+int BVH::raycast(const Vector3 &origin, const Vector3 &direction, float &t, Intersect intersect) const
+{
+	if (nodes.empty())
+	{
+		return -1;
+	}
+	Vector3 inv(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+	float t_near;
+	if (!intersectRayBox(origin, inv, nodes[0].box, t, t_near))
+	{
+		return -1;
+	}
+
+	int hit = -1;
+	struct Entry
+	{
+		int node;
+		float t_near;
+	} stack[64];
+	int top = 0;
+	stack[top++] = {0, t_near};
+	while (top > 0)
+	{
+		Entry entry = stack[--top];
+		if (entry.t_near > t)
+		{
+			continue; // a closer hit was found since it was pushed
+		}
+		const Node &node = nodes[entry.node];
+		if (node.count > 0)
+		{
+			for (int i = node.first; i < node.first + node.count; i++)
+			{
+				int object = objects[i];
+				float t_box;
+				if (intersectRayBox(origin, inv, boxes[object], t, t_box) && intersect(object, t))
+				{
+					hit = object;
+				}
+			}
+			continue;
+		}
+
+		int left = entry.node + 1, right = node.first;
+		float t_left, t_right;
+		bool hit_left = intersectRayBox(origin, inv, nodes[left].box, t, t_left);
+		bool hit_right = intersectRayBox(origin, inv, nodes[right].box, t, t_right);
+		// the nearer child goes on top
+		if (hit_left && hit_right && t_left < t_right)
+		{
+			stack[top++] = {right, t_right};
+			stack[top++] = {left, t_left};
+		}
+		else
+		{
+			if (hit_left)
+				stack[top++] = {left, t_left};
+			if (hit_right)
+				stack[top++] = {right, t_right};
+		}
+	}
+	return hit;
+}
+
+#endif
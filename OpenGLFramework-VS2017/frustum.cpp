@@ -0,0 +1,245 @@
+#include "frustum.h"
+
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+BoundingVolume computeBounds(const void *positions, size_t count, size_t stride)
+{
+	BoundingVolume bounds;
+	bounds.lo = bounds.hi = bounds.center = Vector3(0, 0, 0);
+	bounds.radius = 0;
+	if (count == 0)
+	{
+		return bounds;
+	}
+
+	const unsigned char *p = (const unsigned char *)positions;
+	float lo[3], hi[3];
+	memcpy(lo, p, sizeof(lo));
+	memcpy(hi, p, sizeof(hi));
+	for (size_t i = 1; i < count; i++)
+	{
+		const float *v = (const float *)(p + i * stride);
+		for (int k = 0; k < 3; k++)
+		{
+			lo[k] = std::min(lo[k], v[k]);
+			hi[k] = std::max(hi[k], v[k]);
+		}
+	}
+	bounds.lo = Vector3(lo[0], lo[1], lo[2]);
+	bounds.hi = Vector3(hi[0], hi[1], hi[2]);
+	bounds.center = (bounds.lo + bounds.hi) * 0.5f;
+
+	// second pass for the farthest position, usually well inside the half diagonal
+	float radius2 = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		const float *v = (const float *)(p + i * stride);
+		float dx = v[0] - bounds.center.x, dy = v[1] - bounds.center.y, dz = v[2] - bounds.center.z;
+		radius2 = std::max(radius2, dx * dx + dy * dy + dz * dz);
+	}
+	bounds.radius = sqrtf(radius2);
+	return bounds;
+}
+
+BoundingVolume mergeBounds(const BoundingVolume &a, const BoundingVolume &b)
+{
+	BoundingVolume bounds;
+	bounds.lo = Vector3(std::min(a.lo.x, b.lo.x), std::min(a.lo.y, b.lo.y), std::min(a.lo.z, b.lo.z));
+	bounds.hi = Vector3(std::max(a.hi.x, b.hi.x), std::max(a.hi.y, b.hi.y), std::max(a.hi.z, b.hi.z));
+	bounds.center = (bounds.lo + bounds.hi) * 0.5f;
+	bounds.radius = std::max(bounds.center.distance(a.center) + a.radius, bounds.center.distance(b.center) + b.radius);
+	return bounds;
+}
+
+void padBounds(BoundingVolume &bounds, float margin)
+{
+	bounds.lo -= Vector3(margin, margin, margin);
+	bounds.hi += Vector3(margin, margin, margin);
+	bounds.radius += margin;
+}
+
+Frustum::Frustum(const Matrix4 &clip)
+{
+	// Gribb-Hartmann: clip space -w <= x, y, z <= w, each side a sum or difference of row 3 and a row
+	const float *m = clip.get();
+	for (int i = 0; i < 6; i++)
+	{
+		const float *row = m + 4 * (i / 2);
+		float sign = i % 2 == 0 ? 1.0f : -1.0f; // left, right, bottom, top, near, far
+		for (int k = 0; k < 4; k++)
+		{
+			planes[i][k] = m[12 + k] + sign * row[k];
+		}
+		float length = sqrtf(planes[i][0] * planes[i][0] + planes[i][1] * planes[i][1] + planes[i][2] * planes[i][2]);
+		for (int k = 0; k < 4; k++)
+		{
+			planes[i][k] /= length;
+		}
+	}
+}
+
+bool Frustum::intersectsSphere(const Vector3 &center, float radius) const
+{
+	for (int i = 0; i < 6; i++)
+	{
+		const float *p = planes[i];
+		if (p[0] * center.x + p[1] * center.y + p[2] * center.z + p[3] < -radius)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool Frustum::intersectsBox(const Vector3 &lo, const Vector3 &hi) const
+{
+	for (int i = 0; i < 6; i++)
+	{
+		const float *p = planes[i];
+		float x = p[0] >= 0 ? hi.x : lo.x, y = p[1] >= 0 ? hi.y : lo.y, z = p[2] >= 0 ? hi.z : lo.z;
+		if (p[0] * x + p[1] * y + p[2] * z + p[3] < 0)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool Frustum::containsBox(const Vector3 &lo, const Vector3 &hi) const
+{
+	for (int i = 0; i < 6; i++)
+	{
+		const float *p = planes[i];
+		float x = p[0] >= 0 ? lo.x : hi.x, y = p[1] >= 0 ? lo.y : hi.y, z = p[2] >= 0 ? lo.z : hi.z;
+		if (p[0] * x + p[1] * y + p[2] * z + p[3] < 0)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+int Frustum::cullSpheres(const PointCloud &centers, const float *radii, uint8_t *visible) const
+{
+	int count = (int)centers.size();
+	const float *x = centers.x(), *y = centers.y(), *z = centers.z();
+	int inside = 0;
+
+	int i = 0;
+#ifdef MATRICES_SSE
+	const __m128 all_lanes = _mm_cmpeq_ps(_mm_setzero_ps(), _mm_setzero_ps());
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 vx = _mm_loadu_ps(x + i), vy = _mm_loadu_ps(y + i), vz = _mm_loadu_ps(z + i);
+		__m128 neg_radius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(radii + i));
+		__m128 in = all_lanes;
+		for (int k = 0; k < 6; k++)
+		{
+			const float *p = planes[k];
+			__m128 d = _mm_mul_ps(_mm_set1_ps(p[0]), vx);
+			d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(p[1]), vy));
+			d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(p[2]), vz));
+			d = _mm_add_ps(d, _mm_set1_ps(p[3]));
+			in = _mm_and_ps(in, _mm_cmpge_ps(d, neg_radius));
+		}
+		int bits = _mm_movemask_ps(in);
+		for (int lane = 0; lane < 4; lane++)
+		{
+			visible[i + lane] = (bits >> lane) & 1;
+			inside += visible[i + lane];
+		}
+	}
+#endif
+	for (; i < count; i++)
+	{
+		visible[i] = intersectsSphere(Vector3(x[i], y[i], z[i]), radii[i]) ? 1 : 0;
+		inside += visible[i];
+	}
+	return inside;
+}
+
+int Frustum::cullTransformedSpheres(const Matrix4 *matrices, int count, const Vector3 &center, float radius, uint8_t *visible) const
+{
+	int inside = 0;
+
+	int i = 0;
+#ifdef MATRICES_SSE
+	const __m128 cx = _mm_set1_ps(center.x), cy = _mm_set1_ps(center.y), cz = _mm_set1_ps(center.z);
+	const __m128 neg_radius = _mm_set1_ps(-radius);
+	const __m128 all_lanes = _mm_cmpeq_ps(_mm_setzero_ps(), _mm_setzero_ps());
+	for (; i + 4 <= count; i += 4)
+	{
+		// rows 0-2 of four matrices, transposed: e[row][k] holds element k of that row, one matrix per lane
+		__m128 e[3][4];
+		for (int row = 0; row < 3; row++)
+		{
+			__m128 r0 = _mm_loadu_ps(matrices[i].get() + 4 * row);
+			__m128 r1 = _mm_loadu_ps(matrices[i + 1].get() + 4 * row);
+			__m128 r2 = _mm_loadu_ps(matrices[i + 2].get() + 4 * row);
+			__m128 r3 = _mm_loadu_ps(matrices[i + 3].get() + 4 * row);
+			_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+			e[row][0] = r0;
+			e[row][1] = r1;
+			e[row][2] = r2;
+			e[row][3] = r3;
+		}
+
+		__m128 world[3];
+		for (int row = 0; row < 3; row++)
+		{
+			__m128 o = _mm_mul_ps(e[row][0], cx);
+			o = _mm_add_ps(o, _mm_mul_ps(e[row][1], cy));
+			o = _mm_add_ps(o, _mm_mul_ps(e[row][2], cz));
+			world[row] = _mm_add_ps(o, e[row][3]);
+		}
+
+		// squared length of the longest 3x3 column
+		__m128 scale2 = _mm_setzero_ps();
+		for (int k = 0; k < 3; k++)
+		{
+			__m128 column2 = _mm_mul_ps(e[0][k], e[0][k]);
+			column2 = _mm_add_ps(column2, _mm_mul_ps(e[1][k], e[1][k]));
+			column2 = _mm_add_ps(column2, _mm_mul_ps(e[2][k], e[2][k]));
+			scale2 = _mm_max_ps(scale2, column2);
+		}
+		__m128 neg_r = _mm_mul_ps(neg_radius, _mm_sqrt_ps(scale2));
+
+		__m128 in = all_lanes;
+		for (int k = 0; k < 6; k++)
+		{
+			const float *p = planes[k];
+			__m128 d = _mm_mul_ps(_mm_set1_ps(p[0]), world[0]);
+			d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(p[1]), world[1]));
+			d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(p[2]), world[2]));
+			d = _mm_add_ps(d, _mm_set1_ps(p[3]));
+			in = _mm_and_ps(in, _mm_cmpge_ps(d, neg_r));
+		}
+		int bits = _mm_movemask_ps(in);
+		for (int lane = 0; lane < 4; lane++)
+		{
+			visible[i + lane] = (bits >> lane) & 1;
+			inside += visible[i + lane];
+		}
+	}
+#endif
+	for (; i < count; i++)
+	{
+		const float *m = matrices[i].get();
+		float world[3];
+		for (int row = 0; row < 3; row++)
+		{
+			const float *r = m + 4 * row;
+			world[row] = r[0] * center.x + r[1] * center.y + r[2] * center.z + r[3];
+		}
+		float scale2 = 0;
+		for (int k = 0; k < 3; k++)
+		{
+			scale2 = std::max(scale2, m[k] * m[k] + m[4 + k] * m[4 + k] + m[8 + k] * m[8 + k]);
+		}
+		visible[i] = intersectsSphere(Vector3(world[0], world[1], world[2]), radius * sqrtf(scale2)) ? 1 : 0;
+		inside += visible[i];
+	}
+	return inside;
+}
@@ -0,0 +1,55 @@
+#ifndef FRUSTUM_H_DEF
+#define FRUSTUM_H_DEF
+
+#include <stddef.h>
+#include <stdint.h>
+#include "Vectors.h"
+#include "Matrices.h"
+#include "pointcloud.h"
+
+// Axis-aligned box and bounding sphere of a set of points, e.g. a shape's vertices in model space
+struct BoundingVolume
+{
+	Vector3 lo, hi;
+	Vector3 center; // of the box
+	float radius;
+};
+
+// Bounds of count positions, three floats at the start of every stride bytes.
+// The sphere shares the box's center and reaches the farthest position.
+BoundingVolume computeBounds(const void *positions, size_t count, size_t stride);
+// the box around both boxes, and a sphere around both spheres centered on that box
+BoundingVolume mergeBounds(const BoundingVolume &a, const BoundingVolume &b);
+// grow the box and the sphere by margin on every side
+void padBounds(BoundingVolume &bounds, float margin);
+
+// The six planes of a clip matrix's view volume, in the space the matrix maps from: projection * view
+// gives them in world space, an MVP in model space. Planes are normalized, (a, b, c, d) with
+// a*x + b*y + c*z + d the signed distance, positive inside.
+class Frustum
+{
+public:
+	explicit Frustum(const Matrix4 &clip);
+
+	const float *plane(int i) const { return planes[i]; }
+
+	// Only a sphere entirely behind one of the planes is outside, so a sphere off a corner of the
+	// frustum can still pass: conservative, never culls anything visible.
+	bool intersectsSphere(const Vector3 &center, float radius) const;
+	// the same test for a box: its corner farthest along each plane's normal decides
+	bool intersectsBox(const Vector3 &lo, const Vector3 &hi) const;
+	// the whole box is inside every plane
+	bool containsBox(const Vector3 &lo, const Vector3 &hi) const;
+
+	// Batch tests, four spheres per SSE step (see MATRICES_SSE), same results as intersectsSphere().
+	// visible[i] is set to 1 or 0, the number of visible spheres is returned.
+	int cullSpheres(const PointCloud &centers, const float *radii, uint8_t *visible) const;
+	// one sphere placed by each of count matrices: center at matrices[i] * center, radius scaled
+	// by the longest axis of the matrix's 3x3 part
+	int cullTransformedSpheres(const Matrix4 *matrices, int count, const Vector3 &center, float radius, uint8_t *visible) const;
+
+private:
+	float planes[6][4];
+};
+
+#endif
@@ -0,0 +1,126 @@
+#include "lightclusters.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <math.h>
+
+LightClusters::LightClusters(int dimX, int dimY, int dimZ)
+	: near_clip(0), slice_near(0), depth_scale(0), max_lights(0)
+{
+	dims[0] = dimX;
+	dims[1] = dimY;
+	dims[2] = dimZ;
+}
+
+void LightClusters::build(const std::vector<ClusterLight> &lights, const Matrix4 &projection, float nearClip, float farClip, ThreadPool *pool)
+{
+	proj = projection;
+	near_clip = nearClip;
+	// a very close near plane would spend most slices on the first few centimeters
+	slice_near = std::max(nearClip, 0.1f);
+	depth_scale = dims[2] / logf(farClip / slice_near);
+	cluster_lights.resize(clusterCount());
+
+	// every task owns whole slices, so no two of them touch the same cluster list
+	int tasks = pool != NULL ? std::min(pool->size() + 1, dims[2]) : 1;
+	for (int t = 1; t < tasks; t++)
+	{
+		int first = dims[2] * t / tasks, last = dims[2] * (t + 1) / tasks;
+		pool->submit([this, first, last, &lights]() {
+			binSlices(first, last, lights);
+		});
+	}
+	binSlices(0, dims[2] / tasks, lights);
+	if (tasks > 1)
+	{
+		pool->wait();
+	}
+
+	cluster_grid.resize(2 * clusterCount());
+	light_indices.clear();
+	max_lights = 0;
+	for (int c = 0; c < clusterCount(); c++)
+	{
+		const std::vector<uint16_t> &list = cluster_lights[c];
+		cluster_grid[2 * c] = (uint32_t)light_indices.size();
+		cluster_grid[2 * c + 1] = (uint32_t)list.size();
+		light_indices.insert(light_indices.end(), list.begin(), list.end());
+		max_lights = std::max(max_lights, (int)list.size());
+	}
+}
+
+float LightClusters::sliceDepth(int slice) const
+{
+	return slice == 0 ? near_clip : slice_near * expf(slice / depth_scale);
+}
+
+// View-space x (or y) of an NDC coordinate at a positive view depth: ndc = p0 * x / depth - p2
+static inline float unprojectAxis(float ndc, float depth, float p0, float p2)
+{
+	return (ndc + p2) * depth / p0;
+}
+
+void LightClusters::binSlices(int first, int last, const std::vector<ClusterLight> &lights)
+{
+	const float p[2][2] = {{proj[0], proj[2]}, {proj[5], proj[6]}};
+	for (int s = first; s < last; s++)
+	{
+		float slice_min = sliceDepth(s), slice_max = sliceDepth(s + 1);
+		for (int c = dims[0] * dims[1] * s; c < dims[0] * dims[1] * (s + 1); c++)
+		{
+			cluster_lights[c].clear();
+		}
+
+		for (int i = 0; i < std::min((int)lights.size(), (int)MaxLights); i++)
+		{
+			const ClusterLight &light = lights[i];
+			const float center[3] = {light.position.x, light.position.y, -light.position.z};
+			float r = light.range;
+			if (center[2] + r <= slice_min || center[2] - r >= slice_max)
+			{
+				continue;
+			}
+
+			// tiles covered by the light's bounding box, projected at both ends of its depth span in this slice
+			float depth_min = std::max(slice_min, center[2] - r), depth_max = std::min(slice_max, center[2] + r);
+			int tile_min[2], tile_max[2];
+			for (int a = 0; a < 2; a++)
+			{
+				float lo = 1e30f, hi = -1e30f;
+				for (int k = 0; k < 4; k++)
+				{
+					float depth = k < 2 ? depth_min : depth_max;
+					float ndc = p[a][0] * (center[a] + (k & 1 ? r : -r)) / depth - p[a][1];
+					lo = std::min(lo, ndc);
+					hi = std::max(hi, ndc);
+				}
+				tile_min[a] = std::max(0, (int)floorf((lo * 0.5f + 0.5f) * dims[a]));
+				tile_max[a] = std::min(dims[a] - 1, (int)floorf((hi * 0.5f + 0.5f) * dims[a]));
+			}
+
+			// keep the clusters whose view-space bounding box the light's sphere actually reaches
+			for (int y = tile_min[1]; y <= tile_max[1]; y++)
+			{
+				for (int x = tile_min[0]; x <= tile_max[0]; x++)
+				{
+					const int tile[2] = {x, y};
+					float dist2 = 0;
+					for (int a = 0; a < 2; a++)
+					{
+						float ndc_lo = -1 + 2.0f * tile[a] / dims[a], ndc_hi = -1 + 2.0f * (tile[a] + 1) / dims[a];
+						float lo = std::min(unprojectAxis(ndc_lo, slice_min, p[a][0], p[a][1]), unprojectAxis(ndc_lo, slice_max, p[a][0], p[a][1]));
+						float hi = std::max(unprojectAxis(ndc_hi, slice_min, p[a][0], p[a][1]), unprojectAxis(ndc_hi, slice_max, p[a][0], p[a][1]));
+						float d = center[a] < lo ? lo - center[a] : (center[a] > hi ? center[a] - hi : 0);
+						dist2 += d * d;
+					}
+					float dz = center[2] < slice_min ? slice_min - center[2] : (center[2] > slice_max ? center[2] - slice_max : 0);
+					dist2 += dz * dz;
+					if (dist2 < r * r)
+					{
+						cluster_lights[x + dims[0] * (y + dims[1] * s)].push_back((uint16_t)i);
+					}
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,66 @@
+#ifndef LIGHTCLUSTERS_H_DEF
+#define LIGHTCLUSTERS_H_DEF
+
+#include <stdint.h>
+#include <vector>
+#include "Vectors.h"
+#include "Matrices.h"
+
+class ThreadPool;
+
+// A point or spot light of the clustered light list. Three RGBA32F texels, uploaded as is
+// into the shaders' cluster_lights buffer texture once positions are in view space.
+struct ClusterLight
+{
+	Vector3 position;
+	float range; // no contribution at or past this distance
+	Vector3 color;
+	float spotExponent; // 0 for point lights
+	Vector3 direction;	 // spot axis, unused by point lights
+	float spotCosCutoff; // cosine of the cone half angle, -1 for point lights
+};
+static_assert(sizeof(ClusterLight) == 12 * sizeof(float), "ClusterLight is uploaded as three RGBA32F texels");
+
+// View-space cluster grid for forward shading with many lights. The view frustum is cut
+// into dimX * dimY screen tiles and dimZ depth slices, exponentially spaced from sliceNear()
+// to the far plane, and each cluster lists the lights whose range reaches into it.
+class LightClusters
+{
+public:
+	LightClusters(int dimX = 16, int dimY = 9, int dimZ = 24);
+
+	// light numbers in indices() are 16-bit, lights past the first MaxLights are not binned
+	static const int MaxLights = 65536;
+
+	// Bin view-space lights for one frame of a perspective projection. Slices are spread over
+	// the pool's workers and the caller; without a pool the caller bins all of them.
+	void build(const std::vector<ClusterLight> &lights, const Matrix4 &projection, float nearClip, float farClip, ThreadPool *pool);
+
+	int dimX() const { return dims[0]; }
+	int dimY() const { return dims[1]; }
+	int dimZ() const { return dims[2]; }
+	int clusterCount() const { return dims[0] * dims[1] * dims[2]; }
+
+	// slice = log(view depth / sliceNear()) * depthScale(), clamped to [0, dimZ)
+	float sliceNear() const { return slice_near; }
+	float depthScale() const { return depth_scale; }
+
+	// (offset, count) into indices() per cluster; cluster (x, y, z) is at x + dimX * (y + dimY * z)
+	const std::vector<uint32_t> &grid() const { return cluster_grid; }
+	const std::vector<uint16_t> &indices() const { return light_indices; }
+	int maxLightsPerCluster() const { return max_lights; }
+
+private:
+	void binSlices(int first, int last, const std::vector<ClusterLight> &lights);
+	float sliceDepth(int slice) const;
+
+	int dims[3];
+	Matrix4 proj;
+	float near_clip, slice_near, depth_scale;
+	std::vector<std::vector<uint16_t>> cluster_lights; // per cluster, kept between frames to reuse the allocations
+	std::vector<uint32_t> cluster_grid;
+	std::vector<uint16_t> light_indices;
+	int max_lights;
+};
+
+#endif
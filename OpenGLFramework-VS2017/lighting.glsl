@@ -0,0 +1,84 @@
+// Shared by shader.vs and shader.fs: compileShader() inserts it after the #defines it adds,
+// ahead of the shader's own declarations.
+
+struct PhongMaterial
+{
+	vec3 Ka;
+	vec3 Kd;
+	vec3 Ks;
+};
+
+// std140, each vec3 shares its 16-byte slot with the float after it
+struct Light
+{
+	vec3 position;
+	float spotExponent;
+	vec3 spotDirection;
+	float spotCutoff;
+	vec3 ambient;
+	float constantAttenuation;
+	vec3 diffuse;
+	float linearAttenuation;
+	vec3 specular;
+	float quadraticAttenuation;
+};
+
+// per-frame data, shared by all draws; matrices are uploaded in Matrix4's row-major order
+layout(std140, row_major) uniform FrameData
+{
+	mat4 view_matrix;
+	mat4 project_matrix;
+	Light light[3];
+	float shininess;
+	ivec4 cluster_dims;  // clustered lights: tiles across, tiles down, depth slices
+	vec4 cluster_depth; // depth slice = log(view depth / x) * y
+};
+
+// the model's materials, one page of its material buffer bound as a range
+layout(std140) uniform MaterialData
+{
+	PhongMaterial materials[MATERIALS_PER_PAGE];
+};
+
+#if LIGHT_MODE == 3
+// Clustered point and spot lights, filled by updateLightClusters() every frame.
+// Three texels per light: (position, range), (color, spot exponent), (direction, spot cos cutoff), all in view space.
+uniform samplerBuffer cluster_lights;
+uniform usamplerBuffer cluster_grid;	// (offset, count) into cluster_indices per cluster
+uniform usamplerBuffer cluster_indices; // light numbers
+
+vec3 clusteredLighting(vec3 P, vec3 N, PhongMaterial material)
+{
+	// cluster from the NDC tile and the exponential depth slice of the view-space position
+	vec4 clip = project_matrix * vec4(P, 1.0);
+	ivec2 tile = clamp(ivec2((clip.xy / clip.w * 0.5 + 0.5) * vec2(cluster_dims.xy)), ivec2(0), cluster_dims.xy - 1);
+	int slice = clamp(int(log(max(-P.z, 1e-4) / cluster_depth.x) * cluster_depth.y), 0, cluster_dims.z - 1);
+	uvec2 range = texelFetch(cluster_grid, tile.x + cluster_dims.x * (tile.y + cluster_dims.y * slice)).xy;
+
+	vec3 V = normalize(-P);
+	vec3 color = light[0].ambient * material.Ka;
+	for (uint i = 0u; i < range.y; i++)
+	{
+		int texel = 3 * int(texelFetch(cluster_indices, int(range.x + i)).x);
+		vec4 position = texelFetch(cluster_lights, texel);
+		vec4 color_exponent = texelFetch(cluster_lights, texel + 1);
+		vec4 direction = texelFetch(cluster_lights, texel + 2);
+
+		vec3 toLight = position.xyz - P;
+		float dis = max(length(toLight), 1e-4);
+		vec3 Ld = toLight / dis;
+		vec3 Hd = normalize(Ld + V);
+
+		// inverse square falloff, windowed down to zero at the light's range
+		float window = clamp(1.0 - pow(dis / position.w, 4.0), 0.0, 1.0);
+		float f = window * window / (1.0 + dis * dis);
+		float spot = dot(-Ld, direction.xyz);
+		f *= spot < direction.w ? 0.0 : (color_exponent.w > 0.0 ? pow(max(spot, 0.0), color_exponent.w) : 1.0);
+
+		vec3 diffuse = max(dot(Ld, N), 0.0) * material.Kd;
+		vec3 specular = pow(max(dot(Hd, N), 0.0), shininess) * material.Ks;
+		color += f * color_exponent.rgb * (diffuse + specular);
+	}
+	return color;
+}
+#endif
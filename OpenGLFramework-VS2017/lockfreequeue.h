@@ -0,0 +1,111 @@
+#ifndef LOCKFREEQUEUE_H_DEF
+#define LOCKFREEQUEUE_H_DEF
+
+#include <atomic>
+#include <stddef.h>
+
+// Bounded multi-producer/multi-consumer queue without locks (D. Vyukov's sequence-per-cell ring).
+// Each cell's sequence number tells producers and consumers whose turn it is, so push and pop
+// only contend on one atomic counter each. T must be copyable.
+template <typename T>
+class LockFreeQueue
+{
+public:
+	explicit LockFreeQueue(size_t capacity)
+	{
+		size_t size = 2;
+		while (size < capacity)
+		{
+			size *= 2;
+		}
+		mask = size - 1;
+		cells = new Cell[size];
+		for (size_t i = 0; i < size; i++)
+		{
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+		head.store(0, std::memory_order_relaxed);
+		tail.store(0, std::memory_order_relaxed);
+	}
+
+	~LockFreeQueue()
+	{
+		delete[] cells;
+	}
+
+	// false when the queue is full
+	bool tryPush(const T &value)
+	{
+		size_t pos = tail.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			Cell &cell = cells[pos & mask];
+			size_t seq = cell.sequence.load(std::memory_order_acquire);
+			ptrdiff_t diff = (ptrdiff_t)seq - (ptrdiff_t)pos;
+			if (diff == 0)
+			{
+				if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					cell.value = value;
+					cell.sequence.store(pos + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (diff < 0)
+			{
+				return false;
+			}
+			else
+			{
+				pos = tail.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	// false when the queue is empty
+	bool tryPop(T &value)
+	{
+		size_t pos = head.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			Cell &cell = cells[pos & mask];
+			size_t seq = cell.sequence.load(std::memory_order_acquire);
+			ptrdiff_t diff = (ptrdiff_t)seq - (ptrdiff_t)(pos + 1);
+			if (diff == 0)
+			{
+				if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					value = cell.value;
+					cell.sequence.store(pos + mask + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (diff < 0)
+			{
+				return false;
+			}
+			else
+			{
+				pos = head.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+private:
+	LockFreeQueue(const LockFreeQueue &);
+	LockFreeQueue &operator=(const LockFreeQueue &);
+
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		T value;
+	};
+
+	Cell *cells;
+	size_t mask;
+	// producers and consumers on separate cache lines
+	alignas(64) std::atomic<size_t> tail;
+	alignas(64) std::atomic<size_t> head;
+};
+
+#endif
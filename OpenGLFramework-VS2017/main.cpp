@@ -2,7 +2,13 @@
 #include <fstream>
 #include <string>
 #include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 #include <math.h>
+#include <float.h>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include "textfile.h"
@@ -11,11 +17,19 @@
 #include "Matrices.h"
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "tiny_obj_loader.h"
-
-#ifndef max
-#define max(a, b) (((a) > (b)) ? (a) : (b))
-#define min(a, b) (((a) < (b)) ? (a) : (b))
-#endif
+#undef TINYOBJLOADER_IMPLEMENTATION // once, main.h includes it again
+#include "meshcache.h"
+#include "threadpool.h"
+#include "lightclusters.h"
+#include "pointcloud.h"
+#include "Quaternion.h"
+#include "transformbatch.h"
+#include "bufferallocator.h"
+#include "frustum.h"
+#include "bvh.h"
+#include "trianglemesh.h"
+#include "lockfreequeue.h"
+#include "main.h"
 
 using namespace std;
 
@@ -27,36 +41,8 @@ bool mouse_pressed = false;
 int starting_press_x = -1;
 int starting_press_y = -1;
 
-// My additional useful values & function
-const float PI = (float)atan(1) * 4;
-inline float degree_to_radian(double degree)
-{
-	return (float)(degree * PI / 180);
-}
-int is_per_pixel_lighting = 0;
 GLfloat shininess;
 
-enum LightMode
-{
-	DirectionalLight = 0,
-	PointLight = 1,
-	SpotLight = 2
-};
-
-struct iLocLight
-{
-	GLuint position;
-	GLuint ambient;
-	GLuint diffuse;
-	GLuint specular;
-	GLuint spotDirection;
-	GLuint spotCutoff;
-	GLuint spotExponent;
-	GLuint constantAttenuation;
-	GLuint linearAttenuation;
-	GLuint quadraticAttenuation;
-} iLocLight[3];
-
 struct Light
 {
 	Vector3 position;
@@ -83,49 +69,382 @@ enum TransMode
 struct Uniform
 {
 	GLint iLocMVP;
-	GLint iLocM;
-	GLint iLocV;
-	GLint Ka;
-	GLint Kd;
-	GLint Ks;
-	GLint LightMode;
-	GLint Shininess;
+	GLint iLocMV;
+	GLint iLocNormal;
 };
 Uniform uniform;
 
-vector<string> filenames; // .obj filename list
+// Shadow copy of every uniform value sent to a program. GL keeps uniform values per program, so
+// the upload helpers below skip the GL call when the value did not change since the last upload.
+struct UniformCache
+{
+	unordered_map<GLint, vector<GLfloat>> values;
+};
+
+// A linked shader program, the locations of its plain uniforms and the values last sent to them
+struct ShaderProgram
+{
+	GLuint id;
+	Uniform uniform;
+	UniformCache uniforms; // empty after every link, see buildProgram()
+};
+// One variant per light mode and shading mode, specialized with #defines so the shaders do not branch
+ShaderProgram programs[LightModeCount][3];
+const ShaderProgram *current_program = NULL;
+int program_switches = 0; // glUseProgram calls issued by the last RenderScene()
+int material_binds = 0;	  // material page glBindBufferRange calls issued by the last RenderScene()
+int vao_binds = 0;		  // glBindVertexArray calls issued by the last RenderScene()
+bool single_pass_side_by_side = false; // both halves from one vertex pass (P, --single-pass) instead of one per half
+
+// Entry points newer than the GL 4.2 glad was generated for, see loadExtensions()
+typedef void(APIENTRYP MultiDrawElementsIndirectProc)(GLenum mode, GLenum type, const void *indirect, GLsizei drawcount, GLsizei stride);
+MultiDrawElementsIndirectProc multiDrawElementsIndirect = NULL; // GL 4.3
+typedef void(APIENTRYP BufferStorageProc)(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags);
+BufferStorageProc bufferStorage = NULL; // GL 4.4
+#ifndef GL_DYNAMIC_STORAGE_BIT
+#define GL_DYNAMIC_STORAGE_BIT 0x0100
+#endif
+
+MultiDrawSupport multi_draw_support = NoMultiDraw;
+bool multi_draw = false; // RenderScene() draws through a multi-draw list when supported
+
+bool hasExtension(const char *name)
+{
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count; i++)
+	{
+		if (strcmp((const char *)glGetStringi(GL_EXTENSIONS, i), name) == 0)
+			return true;
+	}
+	return false;
+}
+
+bool hasGLVersion(int major, int minor)
+{
+	return GLVersion.major > major || (GLVersion.major == major && GLVersion.minor >= minor);
+}
+
+// Find out how far the context goes, load is the function glad loaded its entry points with
+void loadExtensions(GLADloadproc load)
+{
+	if (hasGLVersion(4, 4) || hasExtension("GL_ARB_buffer_storage"))
+	{
+		bufferStorage = (BufferStorageProc)load("glBufferStorage");
+	}
+
+	multi_draw_support = NoMultiDraw;
+	if (glDrawElementsInstancedBaseVertexBaseInstance == NULL)
+	{
+		return;
+	}
+	multi_draw_support = BaseInstanceLoop;
+	if (hasGLVersion(4, 3) || hasExtension("GL_ARB_multi_draw_indirect"))
+	{
+		multiDrawElementsIndirect = (MultiDrawElementsIndirectProc)load("glMultiDrawElementsIndirect");
+		if (multiDrawElementsIndirect != NULL)
+		{
+			multi_draw_support = IndirectMultiDraw;
+		}
+	}
+}
+
+// Uniform block binding points, see FrameData/MaterialData in the shaders
+enum UniformBlockBinding
+{
+	FrameBinding = 0,
+	MaterialBinding = 1
+};
 
-struct PhongMaterial
+// Texture units of the clustered shaders' buffer textures, reserved for them
+enum ClusterTextureUnit
 {
-	Vector3 Ka;
-	Vector3 Kd;
-	Vector3 Ks;
+	ClusterLightsUnit = 0,
+	ClusterGridUnit = 1,
+	ClusterIndicesUnit = 2
 };
 
-typedef struct
+// std140 mirror of the shaders' Light struct
+struct LightBlock
 {
-	GLuint vao;
-	GLuint vbo;
-	GLuint vboTex;
-	GLuint ebo;
-	GLuint p_color;
-	int vertex_count;
-	GLuint p_normal;
-	PhongMaterial material;
-	int indexCount;
-	GLuint m_texture;
-} Shape;
+	GLfloat position[3];
+	GLfloat spotExponent;
+	GLfloat spotDirection[3];
+	GLfloat spotCutoff;
+	GLfloat ambient[3];
+	GLfloat constantAttenuation;
+	GLfloat diffuse[3];
+	GLfloat linearAttenuation;
+	GLfloat specular[3];
+	GLfloat quadraticAttenuation;
+};
 
-struct model
+// std140 mirror of the FrameData block, matrices row-major as Matrix4 stores them
+struct FrameBlock
 {
-	Vector3 position = Vector3(0, 0, 0);
-	Vector3 scale = Vector3(1, 1, 1);
-	Vector3 rotation = Vector3(0, 0, 0); // Euler form
+	GLfloat view_matrix[16];
+	GLfloat project_matrix[16];
+	LightBlock light[3];
+	GLfloat shininess;
+	GLfloat padding[3];
+	GLint cluster_dims[4];
+	GLfloat cluster_depth[4];
+};
 
-	vector<Shape> shapes;
+// std140 mirror of one MaterialData entry
+struct MaterialBlock
+{
+	GLfloat Ka[3], pad0;
+	GLfloat Kd[3], pad1;
+	GLfloat Ks[3], pad2;
 };
+
+GLuint frame_ubo;
+FrameBlock frame_block;		   // last contents uploaded to frame_ubo
+GLint material_page_stride; // MaterialsPerPage MaterialBlocks rounded up to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+
+UniformCache *uniform_cache = NULL; // the current program's, set by useProgram()
+UniformStats uniform_stats;
+
+void resetUniformStats()
+{
+	uniform_stats.calls = 0;
+	uniform_stats.skipped = 0;
+}
+
+bool uniformChanged(GLint location, const void *data, int count)
+{
+	if (location < 0)
+	{
+		return false;
+	}
+	if (uniform_cache == NULL)
+	{
+		return true; // no program made current through useProgram() yet
+	}
+
+	vector<GLfloat> &cached = uniform_cache->values[location];
+	if (cached.size() == count && memcmp(&cached[0], data, count * sizeof(GLfloat)) == 0)
+	{
+		uniform_stats.skipped++;
+		return false;
+	}
+	cached.resize(count);
+	memcpy(&cached[0], data, count * sizeof(GLfloat));
+	uniform_stats.calls++;
+	return true;
+}
+
+void uploadUniform1i(GLint location, GLint value)
+{
+	if (uniformChanged(location, &value, 1))
+		glUniform1i(location, value);
+}
+
+void uploadUniform1f(GLint location, GLfloat value)
+{
+	if (uniformChanged(location, &value, 1))
+		glUniform1f(location, value);
+}
+
+void uploadUniform3fv(GLint location, const GLfloat *value)
+{
+	if (uniformChanged(location, value, 3))
+		glUniform3fv(location, 1, value);
+}
+
+void uploadUniformMatrix3fv(GLint location, const GLfloat *value)
+{
+	if (uniformChanged(location, value, 9))
+		glUniformMatrix3fv(location, 1, GL_FALSE, value);
+}
+
+// value is a row-major Matrix4, GL transposes it on upload
+void uploadUniformMatrix4fv(GLint location, const Matrix4 &value)
+{
+	if (uniformChanged(location, value.get(), 16))
+		glUniformMatrix4fv(location, 1, GL_TRUE, value.get());
+}
+
+vector<string> filenames; // .obj filename list
+const vector<string> default_filenames{"../NormalModels/bunny5KN.obj", "../NormalModels/dragon10KN.obj", "../NormalModels/lucy25KN.obj", "../NormalModels/teapot4KN.obj", "../NormalModels/dolphinN.obj"};
+
+// half float spacing just below 1, the most a normalized position moves when packed
+const float PackedPositionError = 1.0f / 2048;
+
+VertexLayout vertex_layout = InterleavedFloat;
+
+int vertexStride(VertexLayout layout)
+{
+	return layout == InterleavedPacked ? sizeof(PackedVertex) : sizeof(Vertex);
+}
+
+// Point attributes 0/1/2 (position/color/normal) at the interleaved buffer bound to GL_ARRAY_BUFFER
+void setVertexAttribs(VertexLayout layout)
+{
+	GLsizei stride = vertexStride(layout);
+	if (layout == InterleavedPacked)
+	{
+		glVertexAttribPointer(0, 3, GL_HALF_FLOAT, GL_FALSE, stride, (void *)offsetof(PackedVertex, position));
+		glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride, (void *)offsetof(PackedVertex, color));
+		glVertexAttribPointer(2, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void *)offsetof(PackedVertex, normal));
+	}
+	else
+	{
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void *)offsetof(Vertex, position));
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void *)offsetof(Vertex, color));
+		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride, (void *)offsetof(Vertex, normal));
+	}
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	glEnableVertexAttribArray(2);
+}
+
+// per-instance model matrix, a mat4 attribute spanning locations 3-6, and its normal matrix (mat3, 7-9)
+const GLuint InstanceMatrixLocation = 3;
+const GLuint InstanceNormalMatrixLocation = 7;
+// per-draw material index, an int attribute: set with glVertexAttribI1i() per draw, or an array in multi-draw lists
+const GLuint MaterialIndexLocation = 10;
+
 vector<model> models;
 
+// Geometry pool: the vertices and indices of every shape live in a few large buffers, suballocated
+// by BufferAllocator, instead of a VBO, an EBO and a VAO per shape. A page holds vertices and
+// indices alike and has one VAO, so its shapes only differ by base vertex and index offset.
+const size_t GeometryPageBytes = 64 << 20; // a larger shape gets a page of its own size
+
+struct GeometryPage
+{
+	GLuint buffer = 0; // 0 for a free slot
+	GLuint vao = 0;
+	BufferAllocator allocator;
+};
+vector<GeometryPage> geometry_pages;
+
+GeometryPoolStats geometryPoolStats()
+{
+	GeometryPoolStats stats;
+	memset(&stats, 0, sizeof(stats));
+	for (int i = 0; i < geometry_pages.size(); i++)
+	{
+		const BufferAllocator &allocator = geometry_pages[i].allocator;
+		if (geometry_pages[i].buffer == 0)
+		{
+			continue;
+		}
+		stats.pages++;
+		stats.resident_bytes += allocator.capacity();
+		stats.used_bytes += allocator.usedBytes();
+		stats.free_bytes += allocator.freeBytes();
+		stats.free_blocks += allocator.freeBlocks();
+		stats.largest_free_block = max(stats.largest_free_block, (long long)allocator.largestFreeBlock());
+	}
+	stats.fragmentation = stats.free_bytes > 0 ? 1.0 - (double)stats.largest_free_block / stats.free_bytes : 0.0;
+	return stats;
+}
+
+// Point the bound VAO's vertex attributes (in vertex_layout) and element buffer at a page
+void bindPageGeometry(const GeometryPage &page)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, page.buffer);
+	setVertexAttribs(vertex_layout);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, page.buffer);
+}
+
+// A new page of at least bytes, in a free slot if there is one
+int createGeometryPage(size_t bytes)
+{
+	int slot = 0;
+	while (slot < geometry_pages.size() && geometry_pages[slot].buffer != 0)
+	{
+		slot++;
+	}
+	if (slot == geometry_pages.size())
+	{
+		geometry_pages.push_back(GeometryPage());
+	}
+	GeometryPage &page = geometry_pages[slot];
+	bytes = max(bytes, GeometryPageBytes);
+
+	// sized once: immutable storage where glBufferStorage exists, a buffer never respecified otherwise
+	glGenBuffers(1, &page.buffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, page.buffer);
+	if (bufferStorage != NULL)
+	{
+		bufferStorage(GL_COPY_WRITE_BUFFER, bytes, NULL, GL_DYNAMIC_STORAGE_BIT);
+	}
+	else
+	{
+		glBufferData(GL_COPY_WRITE_BUFFER, bytes, NULL, GL_STATIC_DRAW);
+	}
+	page.allocator.reset(bytes);
+
+	glGenVertexArrays(1, &page.vao);
+	glBindVertexArray(page.vao);
+	bindPageGeometry(page);
+	glBindVertexArray(0);
+	return slot;
+}
+
+// Find room for a shape's vertices and indices in one page and upload them there.
+// The shape's vertex_count, indexCount and indexType say how much.
+void allocateShapeGeometry(Shape &shape, const void *vertices, const void *indices)
+{
+	size_t stride = vertexStride(vertex_layout);
+	size_t index_size = shape.indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+	size_t vertex_bytes = (size_t)shape.vertex_count * stride, index_bytes = (size_t)shape.indexCount * index_size;
+
+	// vertices at a multiple of the stride, so the base vertex is whole
+	size_t vertex_offset = BufferAllocator::NoSpace, index_offset = BufferAllocator::NoSpace;
+	int slot = 0;
+	for (; slot < geometry_pages.size(); slot++)
+	{
+		BufferAllocator &allocator = geometry_pages[slot].allocator;
+		if (geometry_pages[slot].buffer == 0 || (vertex_offset = allocator.allocate(vertex_bytes, stride)) == BufferAllocator::NoSpace)
+		{
+			continue;
+		}
+		if ((index_offset = allocator.allocate(index_bytes, index_size)) != BufferAllocator::NoSpace)
+		{
+			break;
+		}
+		allocator.free(vertex_offset);
+	}
+	if (slot == geometry_pages.size())
+	{
+		// with room for the alignment padding of both
+		slot = createGeometryPage(vertex_bytes + index_bytes + stride + index_size);
+		vertex_offset = geometry_pages[slot].allocator.allocate(vertex_bytes, stride);
+		index_offset = geometry_pages[slot].allocator.allocate(index_bytes, index_size);
+	}
+
+	const GeometryPage &page = geometry_pages[slot];
+	glBindBuffer(GL_COPY_WRITE_BUFFER, page.buffer);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, vertex_offset, vertex_bytes, vertices);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, index_offset, index_bytes, indices);
+
+	shape.page = slot;
+	shape.vao = page.vao;
+	shape.vertexOffset = vertex_offset;
+	shape.indexOffset = index_offset;
+	shape.baseVertex = (GLint)(vertex_offset / stride);
+	shape.firstIndex = (GLuint)(index_offset / index_size);
+}
+
+// Give a shape's ranges back to its page; a page left empty is released, except the first
+void freeShapeGeometry(const Shape &shape)
+{
+	GeometryPage &page = geometry_pages[shape.page];
+	page.allocator.free(shape.vertexOffset);
+	page.allocator.free(shape.indexOffset);
+	if (page.allocator.empty() && shape.page > 0)
+	{
+		glDeleteVertexArrays(1, &page.vao);
+		glDeleteBuffers(1, &page.buffer);
+		page = GeometryPage();
+	}
+}
+
 struct camera
 {
 	Vector3 position;
@@ -151,6 +470,30 @@ Matrix4 project_matrix;
 
 int cur_idx = 0; // represent which model should be rendered now
 
+// Clustered lights: world-space light list, binned into light_clusters every frame in view space
+vector<ClusterLight> scene_lights;
+vector<ClusterLight> view_lights;
+LightClusters light_clusters;
+
+// Workers for per-frame CPU work: light binning and instance transform updates
+ThreadPool *frame_pool = NULL;
+
+ThreadPool *framePool()
+{
+	if (frame_pool == NULL)
+	{
+		frame_pool = new ThreadPool();
+	}
+	return frame_pool;
+}
+
+struct BufferTexture
+{
+	GLuint buffer;
+	GLuint texture;
+};
+BufferTexture cluster_textures[3]; // indexed by ClusterTextureUnit
+
 static GLvoid Normalize(GLfloat v[3])
 {
 	GLfloat l;
@@ -291,29 +634,24 @@ void setPerspective()
 	}
 }
 
-void setGLMatrix(GLfloat *glm, Matrix4 &m)
-{
-	glm[0] = m[0];
-	glm[4] = m[1];
-	glm[8] = m[2];
-	glm[12] = m[3];
-	glm[1] = m[4];
-	glm[5] = m[5];
-	glm[9] = m[6];
-	glm[13] = m[7];
-	glm[2] = m[8];
-	glm[6] = m[9];
-	glm[10] = m[10];
-	glm[14] = m[11];
-	glm[3] = m[12];
-	glm[7] = m[13];
-	glm[11] = m[14];
-	glm[15] = m[15];
-}
-
 // Vertex buffers
 GLuint VAO, VBO;
 
+// Normal matrix of an affine transform, column-major: the inverse transpose of its 3x3 part.
+// Column-major (M^-1)^T is row-major M^-1, so the inverse is copied without transposing.
+void setGLNormalMatrix(GLfloat *glm, const Matrix4 &m)
+{
+	Matrix4 inverse = m;
+	inverse.invertAffine();
+	for (int c = 0; c < 3; c++)
+	{
+		for (int r = 0; r < 3; r++)
+		{
+			glm[c * 3 + r] = inverse[c * 4 + r];
+		}
+	}
+}
+
 // Call back function for window reshape
 void ChangeSize(GLFWwindow *window, int width, int height)
 {
@@ -342,165 +680,1085 @@ void ChangeSize(GLFWwindow *window, int width, int height)
 	}
 }
 
-// Render function for display rendering
-void RenderScene(void)
+void copyVector3(GLfloat *dst, const Vector3 &v)
 {
-	// clear canvas
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
-
-	Matrix4 T, R, S;
-	// [TODO] update translation, rotation and scaling
-	T = translate(models[cur_idx].position);
-	R = rotate(models[cur_idx].rotation);
-	S = scaling(models[cur_idx].scale);
-
-	Matrix4 MVP, model_matrix;
-	GLfloat mvp[16], m[16], v[16];
-
-	// [TODO] multiply all the matrix
-	model_matrix = T * R * S;
-	MVP = project_matrix * view_matrix * model_matrix;
-	// row-major ---> column-major
-	setGLMatrix(mvp, MVP);
-	setGLMatrix(m, model_matrix);
-	setGLMatrix(v, view_matrix);
+	dst[0] = v.x;
+	dst[1] = v.y;
+	dst[2] = v.z;
+}
 
-	// use uniform to send mvp to vertex shader
-	glUniformMatrix4fv(uniform.iLocMVP, 1, GL_FALSE, mvp);
-	// use uniform to send view_matrix to vertex shader
-	glUniformMatrix4fv(uniform.iLocV, 1, GL_FALSE, v);
-	// use uniform to send model_matrix to vertex shader
-	glUniformMatrix4fv(uniform.iLocM, 1, GL_FALSE, m);
-
-	// Update light detail
-	glUniform1i(uniform.LightMode, cur_light_mode);
-	glUniform1f(uniform.Shininess, shininess);
+// Rebuild the FrameData block from the globals and upload it only if something changed
+void updateFrameBlock()
+{
+	FrameBlock block;
+	memset(&block, 0, sizeof(block));
+	memcpy(block.view_matrix, view_matrix.get(), sizeof(block.view_matrix));
+	memcpy(block.project_matrix, project_matrix.get(), sizeof(block.project_matrix));
 	for (int i = 0; i <= 2; i++)
 	{
-		glUniform3fv(iLocLight[i].ambient, 1, &light[i].ambient[0]);
-		glUniform3fv(iLocLight[i].diffuse, 1, &light[i].diffuse[0]);
-		glUniform3fv(iLocLight[i].specular, 1, &light[i].specular[0]);
+		LightBlock &l = block.light[i];
+		copyVector3(l.position, light[i].position);
+		copyVector3(l.spotDirection, light[i].spotDirection);
+		copyVector3(l.ambient, light[i].ambient);
+		copyVector3(l.diffuse, light[i].diffuse);
+		copyVector3(l.specular, light[i].specular);
+		l.spotExponent = light[i].spotExponent;
+		l.spotCutoff = light[i].spotCutoff;
+		l.constantAttenuation = light[i].constantAttenuation;
+		l.linearAttenuation = light[i].linearAttenuation;
+		l.quadraticAttenuation = light[i].quadraticAttenuation;
 	}
-	glUniform3fv(iLocLight[0].position, 1, &light[0].position[0]);
-	glUniform3fv(iLocLight[1].position, 1, &light[1].position[0]);
-	glUniform1f(iLocLight[1].constantAttenuation, light[1].constantAttenuation);
-	glUniform1f(iLocLight[1].linearAttenuation, light[1].linearAttenuation);
-	glUniform1f(iLocLight[1].quadraticAttenuation, light[1].quadraticAttenuation);
-	glUniform3fv(iLocLight[2].position, 1, &light[2].position[0]);
-	glUniform3fv(iLocLight[2].spotDirection, 1, &light[2].spotDirection[0]);
-	glUniform1f(iLocLight[2].spotExponent, light[2].spotExponent);
-	glUniform1f(iLocLight[2].spotCutoff, light[2].spotCutoff);
-	glUniform1f(iLocLight[2].constantAttenuation, light[2].constantAttenuation);
-	glUniform1f(iLocLight[2].linearAttenuation, light[2].linearAttenuation);
-	glUniform1f(iLocLight[2].quadraticAttenuation, light[2].quadraticAttenuation);
-
-	for (int i = 0; i < models[cur_idx].shapes.size(); i++)
+	block.shininess = shininess;
+	block.cluster_dims[0] = light_clusters.dimX();
+	block.cluster_dims[1] = light_clusters.dimY();
+	block.cluster_dims[2] = light_clusters.dimZ();
+	block.cluster_depth[0] = light_clusters.sliceNear();
+	block.cluster_depth[1] = light_clusters.depthScale();
+
+	if (memcmp(&block, &frame_block, sizeof(block)) == 0)
 	{
-		// set glViewport and draw twice ...
-		glUniform3fv(uniform.Ka, 1, &models[cur_idx].shapes[i].material.Ka[0]);
-		glUniform3fv(uniform.Kd, 1, &models[cur_idx].shapes[i].material.Kd[0]);
-		glUniform3fv(uniform.Ks, 1, &models[cur_idx].shapes[i].material.Ks[0]);
+		uniform_stats.skipped++;
+		return;
+	}
+	frame_block = block;
+	glBindBuffer(GL_UNIFORM_BUFFER, frame_ubo);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(block), &block);
+	uniform_stats.calls++;
+}
 
-		/* draw left */
-		glUniform1i(is_per_pixel_lighting, 0);
-		glViewport(0, 0, WINDOW_WIDTH / 2, WINDOW_HEIGHT);
+// count point and spot lights spread over the box around the models. The range shrinks as the
+// count grows, so about the same number of lights reaches any point.
+void scatterLights(int count, vector<ClusterLight> &lights)
+{
+	// additive recurrence on the powers of the plastic number, evenly spread for any count
+	const float g = 1.22074408f;
+	const float step[3] = {1 / g, 1 / (g * g), 1 / (g * g * g)};
 
-		glBindVertexArray(models[cur_idx].shapes[i].vao);
-		glDrawArrays(GL_TRIANGLES, 0, models[cur_idx].shapes[i].vertex_count);
+	lights.resize(count);
+	for (int i = 0; i < count; i++)
+	{
+		ClusterLight &l = lights[i];
+		float p[3];
+		for (int a = 0; a < 3; a++)
+		{
+			p[a] = -1.5f + 3.0f * fmodf(0.5f + i * step[a], 1.0f);
+		}
+		l.position = Vector3(p[0], p[1], p[2]);
+		l.range = 3.0f / cbrtf((float)count);
 
-		/* draw right */
-		glUniform1i(is_per_pixel_lighting, 1);
-		glViewport(WINDOW_WIDTH / 2, 0, WINDOW_WIDTH / 2, WINDOW_HEIGHT);
+		// hues spread by the golden ratio
+		float hue = 2 * PI * fmodf(i * 0.618034f, 1.0f);
+		l.color = Vector3(0.5f + 0.5f * cosf(hue), 0.5f + 0.5f * cosf(hue - 2 * PI / 3), 0.5f + 0.5f * cosf(hue + 2 * PI / 3));
 
-		glBindVertexArray(models[cur_idx].shapes[i].vao);
-		glDrawArrays(GL_TRIANGLES, 0, models[cur_idx].shapes[i].vertex_count);
+		// every fourth light is a spot aimed at the origin
+		l.direction = l.position.length() > 1e-3f ? -l.position / l.position.length() : Vector3(0, -1, 0);
+		l.spotExponent = i % 4 == 3 ? 8.0f : 0.0f;
+		l.spotCosCutoff = i % 4 == 3 ? cosf(degree_to_radian(35.0)) : -1.0f;
 	}
 }
 
-void KeyCallback(GLFWwindow *window, int key, int scancode, int action, int mods)
+// Refill one of the clustered shaders' buffer textures
+void uploadBufferTexture(ClusterTextureUnit unit, GLenum format, const void *data, size_t bytes)
 {
-	// [TODO] Call back function for keyboard
-
-	// fix duplicate execute
-	if (action != GLFW_PRESS)
+	BufferTexture &t = cluster_textures[unit];
+	if (t.texture == 0)
 	{
-		return;
+		glGenBuffers(1, &t.buffer);
+		glGenTextures(1, &t.texture);
 	}
-
-	switch (key)
+	// orphan last frame's storage; an empty list still gets a texel
+	glBindBuffer(GL_TEXTURE_BUFFER, t.buffer);
+	glBufferData(GL_TEXTURE_BUFFER, max(bytes, (size_t)16), NULL, GL_STREAM_DRAW);
+	if (bytes > 0)
 	{
-	case GLFW_KEY_Z:
-		cur_idx = cur_idx == 0 ? models.size() - 1 : cur_idx - 1;
-		std::cout << "Model " << cur_idx + 1 << " is selected.\n";
-		break;
-	case GLFW_KEY_X:
-		cur_idx = cur_idx == models.size() - 1 ? 0 : cur_idx + 1;
-		std::cout << "Model " << cur_idx + 1 << " is selected.\n";
-		break;
-	case GLFW_KEY_LEFT:
-		cur_idx = cur_idx == 0 ? models.size() - 1 : cur_idx - 1;
-		std::cout << "Model " << cur_idx + 1 << " is selected.\n";
-		break;
-	case GLFW_KEY_RIGHT:
-		cur_idx = cur_idx == models.size() - 1 ? 0 : cur_idx + 1;
-		std::cout << "Model " << cur_idx + 1 << " is selected.\n";
-		break;
-	case GLFW_KEY_T:
-		cur_trans_mode = GeoTranslation;
-		break;
-	case GLFW_KEY_S:
-		cur_trans_mode = GeoScaling;
-		break;
-	case GLFW_KEY_R:
-		cur_trans_mode = GeoRotation;
-		break;
-	case GLFW_KEY_L:
-		// Change Light Mode
-		switch (cur_light_mode)
-		{
-		case DirectionalLight:
-			cur_light_mode = PointLight;
-			std::cout << "Light mode: " << "Point light\n";
-			break;
-		case PointLight:
-			cur_light_mode = SpotLight;
-			std::cout << "Light mode: " << "Spot light\n";
-			break;
-		case SpotLight:
-			cur_light_mode = DirectionalLight;
-			std::cout << "Light mode: " << "Directional light\n";
-			break;
-		default:
-			break;
-		}
-		break;
-	case GLFW_KEY_K:
-		cur_trans_mode = LightEdit;
-		break;
-	case GLFW_KEY_J:
-		cur_trans_mode = ShininessEdit;
-		break;
-	default:
-		break;
+		glBufferSubData(GL_TEXTURE_BUFFER, 0, bytes, data);
 	}
+
+	// attach again, some drivers keep the size the buffer had when it was attached
+	glActiveTexture(GL_TEXTURE0 + unit);
+	glBindTexture(GL_TEXTURE_BUFFER, t.texture);
+	glTexBuffer(GL_TEXTURE_BUFFER, format, t.buffer);
+	glActiveTexture(GL_TEXTURE0);
 }
 
-void scroll_callback(GLFWwindow *window, double xoffset, double yoffset)
+// Move the light list to view space, bin it into clusters and upload what the clustered shaders read
+void updateLightClusters()
 {
-	// [TODO] scroll up positive, otherwise it would be negative
-	switch (cur_trans_mode)
+	view_lights.resize(scene_lights.size());
+	for (int i = 0; i < scene_lights.size(); i++)
 	{
-	case GeoTranslation:
-		models[cur_idx].position.z += (float)yoffset / 10.0f;
-		break;
-	case GeoScaling:
-		models[cur_idx].scale.z += (float)yoffset / 10.0f;
-		break;
-	case GeoRotation:
-		models[cur_idx].rotation.z += (float)yoffset / 10.0f;
-		break;
+		const ClusterLight &l = scene_lights[i];
+		Vector4 position = view_matrix * Vector4(l.position.x, l.position.y, l.position.z, 1.0f);
+		view_lights[i] = l;
+		view_lights[i].position = Vector3(position.x, position.y, position.z);
+		view_lights[i].direction = view_matrix * l.direction; // rotation only
+	}
 
-	case LightEdit:
+	light_clusters.build(view_lights, project_matrix, proj.nearClip, proj.farClip, framePool());
+
+	const vector<uint32_t> &grid = light_clusters.grid();
+	const vector<uint16_t> &indices = light_clusters.indices();
+	uploadBufferTexture(ClusterLightsUnit, GL_RGBA32F, view_lights.empty() ? NULL : &view_lights[0], view_lights.size() * sizeof(ClusterLight));
+	uploadBufferTexture(ClusterGridUnit, GL_RG32UI, &grid[0], grid.size() * sizeof(uint32_t));
+	uploadBufferTexture(ClusterIndicesUnit, GL_R16UI, indices.empty() ? NULL : &indices[0], indices.size() * sizeof(uint16_t));
+}
+
+// Make a program current, RenderScene() then uploads to its uniform locations through its cache
+void useProgram(ShaderProgram &program)
+{
+	if (current_program == &program)
+	{
+		return;
+	}
+	current_program = &program;
+	program_switches++;
+	glUseProgram(program.id);
+	uniform = program.uniform;
+	uniform_cache = &program.uniforms;
+}
+
+// Make the variant for the current light mode current
+void useShadingMode(ShadingMode mode)
+{
+	useProgram(programs[cur_light_mode][mode]);
+}
+
+// Switch between the one- and two-pass side-by-side view; the geometry shader writes clip distances
+void useSideBySideMode(bool single_pass)
+{
+	single_pass_side_by_side = single_pass;
+	for (int k = 0; k < 2; k++)
+	{
+		if (single_pass)
+			glEnable(GL_CLIP_DISTANCE0 + k);
+		else
+			glDisable(GL_CLIP_DISTANCE0 + k);
+	}
+}
+
+// Upload the objects changed since the last update; the batch writes them straight into the mapped buffer
+int updateInstanceBuffer(GLuint buffer, TransformBatch &batch, ThreadPool *pool)
+{
+	if (batch.dirtyBegin() >= batch.dirtyEnd())
+	{
+		return 0;
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	// no GL_MAP_INVALIDATE_RANGE_BIT, unchanged instances inside the range keep their contents
+	void *mapped = glMapBufferRange(GL_ARRAY_BUFFER, batch.dirtyBegin() * sizeof(InstanceData),
+									(batch.dirtyEnd() - batch.dirtyBegin()) * sizeof(InstanceData), GL_MAP_WRITE_BIT);
+	if (mapped == NULL)
+	{
+		return 0; // the objects stay dirty for the next try
+	}
+	int updated = batch.update((InstanceData *)mapped, pool);
+	if (glUnmapBuffer(GL_ARRAY_BUFFER) == GL_FALSE)
+	{
+		batch.markAll(); // the buffer's contents were lost, e.g. to a mode switch, write them all again
+	}
+	return updated;
+}
+
+// Upload the instances changed since the last update
+int updateModelInstances(model &m, ThreadPool *pool)
+{
+	if (m.instance_count == 0)
+	{
+		return 0;
+	}
+	int updated = updateInstanceBuffer(m.instance_vbo, m.instances, pool);
+	if (updated > 0)
+	{
+		m.instance_box_stale = true;
+	}
+	return updated;
+}
+
+// Point the instance matrix attributes of the bound VAO at an InstanceData buffer
+// (a matN attribute takes N vecN locations, advanced once per instance)
+void setInstanceAttribs(GLuint buffer)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	for (int k = 0; k < 4; k++)
+	{
+		glVertexAttribPointer(InstanceMatrixLocation + k, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void *)(offsetof(InstanceData, model) + k * 4 * sizeof(GLfloat)));
+		glVertexAttribDivisor(InstanceMatrixLocation + k, 1);
+		glEnableVertexAttribArray(InstanceMatrixLocation + k);
+	}
+	for (int k = 0; k < 3; k++)
+	{
+		glVertexAttribPointer(InstanceNormalMatrixLocation + k, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void *)(offsetof(InstanceData, normal) + k * 3 * sizeof(GLfloat)));
+		glVertexAttribDivisor(InstanceNormalMatrixLocation + k, 1);
+		glEnableVertexAttribArray(InstanceNormalMatrixLocation + k);
+	}
+}
+
+// Size the model's instance buffer to m.instances and fill it, an empty batch goes back to drawing it once.
+// Page VAOs are shared by every model, so an instanced model draws through VAOs of its own.
+void setModelInstances(model &m)
+{
+	for (int i = 0; i < m.instance_vaos.size(); i++)
+	{
+		glDeleteVertexArrays(1, &m.instance_vaos[i]);
+	}
+	m.instance_vaos.clear();
+	for (int i = 0; i < m.shapes.size(); i++)
+	{
+		m.shapes[i].vao = geometry_pages[m.shapes[i].page].vao;
+	}
+	m.instance_count = m.instances.size();
+	m.visible_instances = m.instance_count; // until the next cullModel()
+	m.instance_runs.clear();
+	if (m.instance_count == 0)
+	{
+		return;
+	}
+
+	if (m.instance_vbo == 0)
+	{
+		glGenBuffers(1, &m.instance_vbo);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, m.instance_vbo);
+	glBufferData(GL_ARRAY_BUFFER, m.instance_count * sizeof(InstanceData), NULL, GL_DYNAMIC_DRAW);
+
+	m.instance_vaos.resize(geometry_pages.size(), 0);
+	for (int i = 0; i < m.shapes.size(); i++)
+	{
+		Shape &shape = m.shapes[i];
+		GLuint &vao = m.instance_vaos[shape.page];
+		if (vao == 0)
+		{
+			glGenVertexArrays(1, &vao);
+			glBindVertexArray(vao);
+			bindPageGeometry(geometry_pages[shape.page]);
+			setInstanceAttribs(m.instance_vbo);
+		}
+		shape.vao = vao;
+	}
+	glBindVertexArray(0);
+
+	// the new buffer holds nothing yet
+	m.instances.markAll();
+	updateModelInstances(m, framePool());
+}
+
+// count copies on a cubic grid that fills the [-extent, extent] box, each turned a little differently
+void scatterInstances(int count, TransformBatch &batch, float extent)
+{
+	int side = 1;
+	while (side * side * side < count)
+	{
+		side++;
+	}
+	float cell = 2.0f * extent / side;
+
+	batch.resize(count);
+	for (int i = 0; i < count; i++)
+	{
+		int x = i % side, y = i / side % side, z = i / (side * side);
+		Vector3 center(-extent + (x + 0.5f) * cell, -extent + (y + 0.5f) * cell, -extent + (z + 0.5f) * cell);
+		batch.set(i, center, Vector3(0, degree_to_radian(i * 37 % 360), 0), Vector3(cell, cell, cell) * 0.45f);
+	}
+}
+
+int draw_calls = 0;		   // issued by the last RenderScene()
+int instances_updated = 0; // recomputed and uploaded by the last RenderScene()
+int objects_drawn = 0;	   // shapes of a model drawn once, or instances, the last RenderScene() submitted
+int objects_culled = 0;	   // and skipped as outside the view frustum
+
+bool frustum_culling = true;
+
+// What the last draws left bound, reset at the start of every RenderScene()
+GLuint bound_vao;
+GLuint bound_material_ubo;
+int bound_material_page;
+int bound_material_index; // current value of the material index attribute, -1 unknown
+
+// Reset the per-frame counters and forget what the last frame left bound
+void resetDrawState()
+{
+	resetUniformStats();
+	draw_calls = 0;
+	instances_updated = 0;
+	objects_drawn = 0;
+	objects_culled = 0;
+	program_switches = 0;
+	material_binds = 0;
+	vao_binds = 0;
+	bound_vao = 0;
+	bound_material_ubo = 0;
+	bound_material_index = -1;
+}
+
+// Bind one page of a material buffer to MaterialBinding, unless it is bound already
+void bindMaterialPage(GLuint material_ubo, int page)
+{
+	if (material_ubo != bound_material_ubo || page != bound_material_page)
+	{
+		glBindBufferRange(GL_UNIFORM_BUFFER, MaterialBinding, material_ubo, page * material_page_stride, MaterialsPerPage * sizeof(MaterialBlock));
+		bound_material_ubo = material_ubo;
+		bound_material_page = page;
+		material_binds++;
+	}
+}
+
+// The material index non-array draws read, within the bound page
+void setMaterialIndex(int index)
+{
+	if (index != bound_material_index)
+	{
+		glVertexAttribI1i(MaterialIndexLocation, index);
+		bound_material_index = index;
+	}
+}
+
+// Bind a VAO unless it is bound already
+void bindVertexArray(GLuint vao)
+{
+	if (vao != bound_vao)
+	{
+		glBindVertexArray(vao);
+		bound_vao = vao;
+		vao_binds++;
+	}
+}
+
+// One draw of a shape, instanced when its model carries instance transforms
+void drawShape(const model &m, const Shape &shape)
+{
+	draw_calls++;
+	bindVertexArray(shape.vao);
+	if (m.instance_count > 0)
+	{
+		glDrawElementsInstancedBaseVertex(GL_TRIANGLES, shape.indexCount, shape.indexType, (void *)shape.indexOffset, m.instance_count, shape.baseVertex);
+	}
+	else
+	{
+		glDrawElementsBaseVertex(GL_TRIANGLES, shape.indexCount, shape.indexType, (void *)shape.indexOffset, shape.baseVertex);
+	}
+}
+
+// The visible instances of an instanced shape when some are culled: one draw per run, or one
+// glMultiDrawElementsIndirect over the model's run commands from GL 4.3
+void drawShapeRuns(const model &m, int s)
+{
+	const Shape &shape = m.shapes[s];
+	int runs = m.instance_runs.size();
+	bindVertexArray(shape.vao);
+	if (multi_draw_support == IndirectMultiDraw)
+	{
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m.run_command_buffer);
+		multiDrawElementsIndirect(GL_TRIANGLES, shape.indexType, (void *)(s * runs * sizeof(DrawElementsIndirectCommand)), runs, 0);
+		draw_calls++;
+		return;
+	}
+	for (int r = 0; r < runs; r++)
+	{
+		const InstanceRun &run = m.instance_runs[r];
+		glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, shape.indexCount, shape.indexType, (void *)shape.indexOffset,
+													  run.count, shape.baseVertex, run.first);
+	}
+	draw_calls += runs;
+}
+
+// Every shape of a model in draw_order, so shapes sharing a material follow each other and
+// only material changes reach the driver: a page rebind, or a new material_index otherwise.
+// What the last cullModel() found outside the view is skipped.
+void drawShapes(const model &m)
+{
+	bool some_instances = m.instance_count > 0 && m.visible_instances < m.instance_count;
+	if (m.instance_count > 0 && m.visible_instances == 0)
+	{
+		return;
+	}
+	for (int i = 0; i < m.draw_order.size(); i++)
+	{
+		int s = m.draw_order[i];
+		const Shape &shape = m.shapes[s];
+		if (m.instance_count == 0 && !m.shape_visible.empty() && !m.shape_visible[s])
+		{
+			continue;
+		}
+		bindMaterialPage(m.material_ubo, shape.materialIndex / MaterialsPerPage);
+		setMaterialIndex(shape.materialIndex % MaterialsPerPage);
+		if (some_instances)
+			drawShapeRuns(m, s);
+		else
+			drawShape(m, shape);
+	}
+}
+
+// Send the per-draw matrices to the current program
+void uploadDrawMatrices(const Matrix4 &mvp, const Matrix4 &mv, const GLfloat *normal)
+{
+	// use uniform to send mvp to vertex shader
+	uploadUniformMatrix4fv(uniform.iLocMVP, mvp);
+	// model-view and normal matrix once per draw instead of once per vertex
+	uploadUniformMatrix4fv(uniform.iLocMV, mv);
+	uploadUniformMatrix3fv(uniform.iLocNormal, normal);
+}
+
+// Multi-draw: every shape already lives in the geometry pool, so a whole list of draws goes to the
+// driver as one glMultiDrawElementsIndirect per pool page, material page and index type.
+// The shaders are GLSL 3.30, without gl_DrawID, so per-draw data is found through baseInstance
+// instead: command i has baseInstance i, and the instance matrices and material index are
+// instanced attributes, fetched at baseInstance for a draw of one instance.
+
+// The distinct materials of all models in one buffer, so one binding serves draws of any model
+struct SceneMaterials
+{
+	GLuint material_ubo = 0; // MaterialsPerPage per page
+	int generation = 0;		 // bumped by every build, lists set up against an older one are stale
+	bool stale = true;		 // models were uploaded or released since the last build
+};
+SceneMaterials scene_materials;
+
+// Point list at draws, draw i placed by object i of transforms, and upload its commands and per-draw data.
+// Commands are sorted by geometry page, material page and index type, each run becomes one group.
+void setMultiDrawList(MultiDrawList &list, const vector<ShapeRef> &draws, TransformBatch &transforms)
+{
+	int count = draws.size();
+	vector<int> order(count);
+	for (int i = 0; i < count; i++)
+	{
+		order[i] = i;
+	}
+	auto shapeOf = [&draws](int i) -> const Shape & {
+		return models[draws[i].model].shapes[draws[i].shape];
+	};
+	stable_sort(order.begin(), order.end(), [&shapeOf](int a, int b) {
+		const Shape &shape_a = shapeOf(a), &shape_b = shapeOf(b);
+		if (shape_a.page != shape_b.page)
+			return shape_a.page < shape_b.page;
+		if (shape_a.sceneMaterialIndex / MaterialsPerPage != shape_b.sceneMaterialIndex / MaterialsPerPage)
+			return shape_a.sceneMaterialIndex / MaterialsPerPage < shape_b.sceneMaterialIndex / MaterialsPerPage;
+		return shape_a.indexType < shape_b.indexType;
+	});
+
+	vector<GLint> material_index(count);
+	list.commands.resize(count);
+	list.groups.clear();
+	for (int k = 0; k < count; k++)
+	{
+		int i = order[k];
+		const Shape &shape = shapeOf(i);
+		DrawElementsIndirectCommand &command = list.commands[k];
+		command.count = shape.indexCount;
+		command.instanceCount = 1;
+		command.firstIndex = shape.firstIndex;
+		command.baseVertex = shape.baseVertex;
+		command.baseInstance = i;
+		material_index[i] = shape.sceneMaterialIndex % MaterialsPerPage;
+
+		int page = shape.sceneMaterialIndex / MaterialsPerPage;
+		const MultiDrawGroup *last = list.groups.empty() ? NULL : &list.groups.back();
+		if (last == NULL || last->geometry_page != shape.page || last->page != page || last->index_type != shape.indexType)
+		{
+			MultiDrawGroup group = {shape.page, page, shape.indexType, k, 0};
+			list.groups.push_back(group);
+		}
+		list.groups.back().count++;
+	}
+
+	if (list.command_buffer == 0)
+	{
+		glGenBuffers(1, &list.command_buffer);
+		glGenBuffers(1, &list.instance_vbo);
+		glGenBuffers(1, &list.material_vbo);
+	}
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, list.command_buffer);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, count * sizeof(DrawElementsIndirectCommand), list.commands.empty() ? NULL : &list.commands[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, list.instance_vbo);
+	glBufferData(GL_ARRAY_BUFFER, count * sizeof(InstanceData), NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, list.material_vbo);
+	glBufferData(GL_ARRAY_BUFFER, count * sizeof(GLint), material_index.empty() ? NULL : &material_index[0], GL_STATIC_DRAW);
+
+	// a VAO for every page the list draws from
+	for (int i = 0; i < list.vaos.size(); i++)
+	{
+		glDeleteVertexArrays(1, &list.vaos[i]);
+	}
+	list.vaos.assign(geometry_pages.size(), 0);
+	for (int g = 0; g < list.groups.size(); g++)
+	{
+		GLuint &vao = list.vaos[list.groups[g].geometry_page];
+		if (vao != 0)
+		{
+			continue;
+		}
+		glGenVertexArrays(1, &vao);
+		glBindVertexArray(vao);
+		bindPageGeometry(geometry_pages[list.groups[g].geometry_page]);
+		setInstanceAttribs(list.instance_vbo);
+		glBindBuffer(GL_ARRAY_BUFFER, list.material_vbo);
+		glVertexAttribIPointer(MaterialIndexLocation, 1, GL_INT, sizeof(GLint), (void *)0);
+		glVertexAttribDivisor(MaterialIndexLocation, 1);
+		glEnableVertexAttribArray(MaterialIndexLocation);
+	}
+	glBindVertexArray(0);
+	bound_vao = 0;
+	list.materials_generation = scene_materials.generation;
+
+	// the new buffer holds nothing yet
+	transforms.markAll();
+	updateInstanceBuffer(list.instance_vbo, transforms, framePool());
+}
+
+// Give the commands of culled draws no instance, visible[i] for draw i, and upload the commands if
+// any changed. Every group keeps its one glMultiDrawElementsIndirect, empty commands cost next to nothing.
+void setMultiDrawVisibility(MultiDrawList &list, const vector<uint8_t> &visible)
+{
+	bool changed = false;
+	for (int k = 0; k < list.commands.size(); k++)
+	{
+		DrawElementsIndirectCommand &command = list.commands[k];
+		GLuint instances = visible[command.baseInstance];
+		if (command.instanceCount != instances)
+		{
+			command.instanceCount = instances;
+			changed = true;
+		}
+	}
+	if (changed)
+	{
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, list.command_buffer);
+		glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, list.commands.size() * sizeof(DrawElementsIndirectCommand), &list.commands[0]);
+	}
+}
+
+void releaseMultiDrawList(MultiDrawList &list)
+{
+	for (int i = 0; i < list.vaos.size(); i++)
+	{
+		glDeleteVertexArrays(1, &list.vaos[i]);
+	}
+	glDeleteBuffers(1, &list.command_buffer);
+	glDeleteBuffers(1, &list.instance_vbo);
+	glDeleteBuffers(1, &list.material_vbo);
+	list = MultiDrawList();
+}
+
+// Submit a whole list, one glMultiDrawElementsIndirect per group, or one draw per command before GL 4.3
+void drawMultiDrawList(const MultiDrawList &list)
+{
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, list.command_buffer);
+	for (int i = 0; i < list.groups.size(); i++)
+	{
+		const MultiDrawGroup &group = list.groups[i];
+		bindVertexArray(list.vaos[group.geometry_page]);
+		bindMaterialPage(scene_materials.material_ubo, group.page);
+		if (multi_draw_support == IndirectMultiDraw)
+		{
+			multiDrawElementsIndirect(GL_TRIANGLES, group.index_type, (void *)(group.first * sizeof(DrawElementsIndirectCommand)), group.count, 0);
+			draw_calls++;
+			continue;
+		}
+
+		GLsizeiptr index_size = group.index_type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+		for (int k = group.first; k < group.first + group.count; k++)
+		{
+			const DrawElementsIndirectCommand &command = list.commands[k];
+			if (command.instanceCount == 0)
+			{
+				continue; // culled, see setMultiDrawVisibility()
+			}
+			glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, command.count, group.index_type, (void *)(command.firstIndex * index_size),
+														  command.instanceCount, command.baseVertex, command.baseInstance);
+			draw_calls++;
+		}
+	}
+	// the material index came from an array, its current value is undefined now
+	bound_material_index = -1;
+}
+
+MultiDrawList model_draws; // the shapes of models[model_draws_idx], for RenderScene()
+int model_draws_idx = -1;
+
+// Every shape of a model, as one multi-draw list when multi_draw is on.
+// Instanced models keep drawShapes(): baseInstance already selects their per-draw data.
+void drawModel(int idx)
+{
+	model &m = models[idx];
+	if (!multi_draw || multi_draw_support == NoMultiDraw || m.instance_count > 0)
+	{
+		drawShapes(m);
+		return;
+	}
+
+	if (scene_materials.stale)
+	{
+		buildSceneMaterials();
+	}
+	if (model_draws_idx != idx || model_draws.materials_generation != scene_materials.generation)
+	{
+		// the model transform stays in the uniforms, the per-draw matrices are identities
+		vector<ShapeRef> draws(m.shapes.size());
+		for (int i = 0; i < draws.size(); i++)
+		{
+			draws[i].model = idx;
+			draws[i].shape = i;
+		}
+		TransformBatch identity;
+		identity.resize(draws.size());
+		setMultiDrawList(model_draws, draws, identity);
+		model_draws_idx = idx;
+	}
+	if (!m.shape_visible.empty())
+	{
+		setMultiDrawVisibility(model_draws, m.shape_visible);
+	}
+	drawMultiDrawList(model_draws);
+}
+
+// Test a model against the view frustum of mvp before the frame draws it: the bounding sphere of
+// each shape of a model drawn once, or the model's sphere under each instance transform. Visible
+// instances are then drawn as runs of consecutive ones, which needs base instance (GL 4.2).
+void cullModel(model &m, const Matrix4 &mvp)
+{
+	Frustum frustum(mvp); // planes in model space
+	if (m.instance_count == 0)
+	{
+		int count = m.shapes.size();
+		m.shape_visible.resize(count);
+		int visible = count;
+		if (frustum_culling && count > 0)
+		{
+			visible = frustum.cullSpheres(m.shape_centers, &m.shape_radii[0], &m.shape_visible[0]);
+		}
+		else
+		{
+			fill(m.shape_visible.begin(), m.shape_visible.end(), 1);
+		}
+		objects_drawn += visible;
+		objects_culled += count - visible;
+		return;
+	}
+
+	int visible = m.instance_count;
+	if (frustum_culling && multi_draw_support != NoMultiDraw)
+	{
+		visible = m.instances.cull(frustum, m.bounds.center, m.bounds.radius, m.instance_visible, framePool());
+	}
+	objects_drawn += visible;
+	objects_culled += m.instance_count - visible;
+	m.visible_instances = visible;
+	m.instance_runs.clear();
+	if (visible == m.instance_count || visible == 0)
+	{
+		return;
+	}
+
+	for (int i = 0; i < m.instance_count; i++)
+	{
+		if (!m.instance_visible[i])
+		{
+			continue;
+		}
+		if (!m.instance_runs.empty() && m.instance_runs.back().first + m.instance_runs.back().count == i)
+		{
+			m.instance_runs.back().count++;
+		}
+		else
+		{
+			InstanceRun run = {(GLuint)i, 1};
+			m.instance_runs.push_back(run);
+		}
+	}
+
+	if (multi_draw_support == IndirectMultiDraw)
+	{
+		// shape s draws commands [s * runs, (s + 1) * runs)
+		int runs = m.instance_runs.size();
+		vector<DrawElementsIndirectCommand> commands(m.shapes.size() * runs);
+		for (int s = 0; s < m.shapes.size(); s++)
+		{
+			const Shape &shape = m.shapes[s];
+			for (int r = 0; r < runs; r++)
+			{
+				DrawElementsIndirectCommand &command = commands[s * runs + r];
+				command.count = shape.indexCount;
+				command.instanceCount = m.instance_runs[r].count;
+				command.firstIndex = shape.firstIndex;
+				command.baseVertex = shape.baseVertex;
+				command.baseInstance = m.instance_runs[r].first;
+			}
+		}
+		if (m.run_command_buffer == 0)
+		{
+			glGenBuffers(1, &m.run_command_buffer);
+		}
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m.run_command_buffer);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand), &commands[0], GL_STREAM_DRAW);
+	}
+}
+
+// Scene BVH: one object per model, the world box of its shapes, or of all its instances. Rebuilt
+// when models are uploaded or released, or once refits let its SAH cost drift past RebuildCostRatio
+// times that of a fresh build; a model that moved only refits the path above it.
+const float RebuildCostRatio = 2.0f;
+
+struct SceneBVH
+{
+	BVH tree;
+	vector<uint8_t> visible; // per model, from the last modelInView()
+	bool stale = true;
+};
+SceneBVH scene_bvh;
+
+// A model's box in world space, empty while its geometry is not resident
+AABB sceneBox(model &m)
+{
+	if (!m.resident || m.shapes.empty())
+	{
+		return AABB::empty();
+	}
+	AABB box = {m.bounds.lo, m.bounds.hi};
+	if (m.instance_count > 0)
+	{
+		if (m.instance_box_stale)
+		{
+			m.instance_box = AABB::empty();
+			for (int i = 0; i < m.instance_count; i++)
+			{
+				m.instance_box.grow(transformBox(box, m.instances.matrix(i)));
+			}
+			m.instance_box_stale = false;
+		}
+		box = m.instance_box;
+	}
+	return transformBox(box, composeTRS(m.position, m.rotation, m.scale));
+}
+
+// Bring the scene BVH up to date with the models, once per frame
+void updateSceneBVH()
+{
+	vector<AABB> boxes(models.size());
+	for (int i = 0; i < models.size(); i++)
+	{
+		boxes[i] = sceneBox(models[i]);
+	}
+
+	BVH &tree = scene_bvh.tree;
+	if (scene_bvh.stale || tree.size() != boxes.size())
+	{
+		tree.build(boxes);
+		scene_bvh.stale = false;
+		return;
+	}
+	for (int i = 0; i < boxes.size(); i++)
+	{
+		if (!(tree.box(i).lo == boxes[i].lo && tree.box(i).hi == boxes[i].hi))
+		{
+			tree.update(i, boxes[i]);
+		}
+	}
+	if (tree.sahCost() > RebuildCostRatio * tree.buildCost())
+	{
+		tree.build(boxes);
+	}
+}
+
+// Whether model idx reaches into the view frustum, every model tested at once through the scene BVH
+bool modelInView(int idx)
+{
+	updateSceneBVH();
+	if (!frustum_culling)
+	{
+		return true;
+	}
+	scene_bvh.tree.cull(Frustum(project_matrix * view_matrix), scene_bvh.visible);
+	return scene_bvh.visible[idx] != 0;
+}
+
+// Render function for display rendering
+void RenderScene(void)
+{
+	resetDrawState();
+
+	// clear canvas
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+
+	// still loading
+	if (cur_idx >= models.size() || !models[cur_idx].resident)
+	{
+		return;
+	}
+	instances_updated = updateModelInstances(models[cur_idx], framePool());
+	if (!modelInView(cur_idx))
+	{
+		model &m = models[cur_idx];
+		objects_culled += m.instance_count > 0 ? m.instance_count : m.shapes.size();
+		return;
+	}
+
+	Matrix4 MVP, MV, model_matrix;
+	GLfloat normal[9];
+
+	// translate() * rotate() * scaling() without building and multiplying the four matrices
+	model_matrix = composeTRS(models[cur_idx].position, models[cur_idx].rotation, models[cur_idx].scale);
+	MV = view_matrix * model_matrix;
+	MVP = project_matrix * MV;
+	setGLNormalMatrix(normal, MV);
+	cullModel(models[cur_idx], MVP);
+
+	// view matrix and light detail go through the frame uniform block
+	if (cur_light_mode == ClusteredLights)
+	{
+		updateLightClusters();
+	}
+	updateFrameBlock();
+
+	if (single_pass_side_by_side)
+	{
+		// every shape drawn once, the geometry shader places each triangle in both halves
+		useShadingMode(SideBySideShading);
+		uploadDrawMatrices(MVP, MV, normal);
+		glViewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
+		drawModel(cur_idx);
+		return;
+	}
+
+	// each half has its own program, so draw every shape into the left half before the right
+	/* draw left */
+	useShadingMode(PerVertexShading);
+	uploadDrawMatrices(MVP, MV, normal);
+	glViewport(0, 0, WINDOW_WIDTH / 2, WINDOW_HEIGHT);
+	drawModel(cur_idx);
+
+	/* draw right */
+	useShadingMode(PerPixelShading);
+	uploadDrawMatrices(MVP, MV, normal);
+	glViewport(WINDOW_WIDTH / 2, 0, WINDOW_WIDTH / 2, WINDOW_HEIGHT);
+	drawModel(cur_idx);
+}
+
+// Ray from the near to the far plane through window point (x, y), in the space clip maps from.
+// Both halves of the side-by-side view show the same projection, so x counts from the start of its half.
+void unprojectRay(const Matrix4 &clip, float x, float y, int width, int height, Vector3 &origin, Vector3 &direction)
+{
+	float half = width / 2.0f;
+	float ndc_x = fmodf(x, half) / half * 2 - 1;
+	float ndc_y = 1 - y / height * 2;
+	Matrix4 inverse = clip;
+	inverse.invert();
+	Vector4 near_point = inverse * Vector4(ndc_x, ndc_y, -1, 1);
+	Vector4 far_point = inverse * Vector4(ndc_x, ndc_y, 1, 1);
+	origin = Vector3(near_point.x, near_point.y, near_point.z) / near_point.w;
+	direction = Vector3(far_point.x, far_point.y, far_point.z) / far_point.w - origin;
+}
+
+// Closest triangle of m's shapes along a ray in the model's own space, within t
+bool pickShapes(const model &m, const Vector3 &origin, const Vector3 &direction, float &t, PickHit &hit, bool linear)
+{
+	bool found = false;
+	for (int s = 0; s < m.pick_meshes.size() && s < m.shapes.size(); s++)
+	{
+		const TriangleMesh &mesh = m.pick_meshes[s];
+		int triangle = linear ? mesh.raycastLinear(origin, direction, t) : mesh.raycast(origin, direction, t);
+		if (triangle >= 0)
+		{
+			hit.shape = s;
+			hit.triangle = triangle;
+			found = true;
+		}
+	}
+	return found;
+}
+
+// What window point (x, y) of a width x height window shows: only the current model is drawn, so only
+// it is tested. The ray is taken into model space, and into each instance's space, rather than the
+// triangles out of it; an affine transform keeps t the same in all of them. linear skips the BVHs.
+PickHit pickAt(float x, float y, int width, int height, bool linear)
+{
+	PickHit hit;
+	if (cur_idx >= models.size() || !models[cur_idx].resident)
+	{
+		return hit;
+	}
+	waitForPickMeshes(cur_idx);
+	const model &m = models[cur_idx];
+	Matrix4 view_projection = project_matrix * view_matrix;
+	Matrix4 model_matrix = composeTRS(m.position, m.rotation, m.scale);
+	Vector3 origin, direction, model_origin, model_direction;
+	unprojectRay(view_projection, x, y, width, height, origin, direction);
+	unprojectRay(view_projection * model_matrix, x, y, width, height, model_origin, model_direction);
+
+	float t = 1;
+	bool found = false;
+	if (m.instance_count == 0)
+	{
+		found = pickShapes(m, model_origin, model_direction, t, hit, linear);
+	}
+	else
+	{
+		// the instance's box first, most instances are nowhere near the ray
+		Vector3 inv(1.0f / model_direction.x, 1.0f / model_direction.y, 1.0f / model_direction.z);
+		AABB box = {m.bounds.lo, m.bounds.hi};
+		for (int i = 0; i < m.instance_count; i++)
+		{
+			float t_box;
+			if (!intersectRayBox(model_origin, inv, transformBox(box, m.instances.matrix(i)), t, t_box))
+			{
+				continue;
+			}
+			Matrix4 inverse = m.instances.matrix(i);
+			inverse.invertAffine();
+			Vector4 o = inverse * Vector4(model_origin.x, model_origin.y, model_origin.z, 1);
+			Vector4 d = inverse * Vector4(model_direction.x, model_direction.y, model_direction.z, 0);
+			if (pickShapes(m, Vector3(o.x, o.y, o.z), Vector3(d.x, d.y, d.z), t, hit, linear))
+			{
+				hit.instance = i;
+				found = true;
+			}
+		}
+	}
+
+	if (found)
+	{
+		hit.model = cur_idx;
+		hit.t = t;
+		hit.point = origin + direction * t;
+	}
+	return hit;
+}
+
+// The model step slots away from cur_idx, wrapping around and passing over models that failed to load
+int nextModel(int step)
+{
+	int idx = cur_idx;
+	for (int i = 0; i < models.size(); i++)
+	{
+		idx = (idx + step + models.size()) % models.size();
+		if (!models[idx].failed)
+		{
+			return idx;
+		}
+	}
+	return cur_idx;
+}
+
+void KeyCallback(GLFWwindow *window, int key, int scancode, int action, int mods)
+{
+	// [TODO] Call back function for keyboard
+
+	// fix duplicate execute
+	if (action != GLFW_PRESS)
+	{
+		return;
+	}
+
+	switch (key)
+	{
+	case GLFW_KEY_Z:
+		cur_idx = nextModel(-1);
+		std::cout << "Model " << cur_idx + 1 << " is selected.\n";
+		break;
+	case GLFW_KEY_X:
+		cur_idx = nextModel(1);
+		std::cout << "Model " << cur_idx + 1 << " is selected.\n";
+		break;
+	case GLFW_KEY_LEFT:
+		cur_idx = cur_idx == 0 ? models.size() - 1 : cur_idx - 1;
+		std::cout << "Model " << cur_idx + 1 << " is selected.\n";
+		break;
+	case GLFW_KEY_RIGHT:
+		cur_idx = cur_idx == models.size() - 1 ? 0 : cur_idx + 1;
+		std::cout << "Model " << cur_idx + 1 << " is selected.\n";
+		break;
+	case GLFW_KEY_T:
+		cur_trans_mode = GeoTranslation;
+		break;
+	case GLFW_KEY_S:
+		cur_trans_mode = GeoScaling;
+		break;
+	case GLFW_KEY_R:
+		cur_trans_mode = GeoRotation;
+		break;
+	case GLFW_KEY_L:
+		// Change Light Mode
+		switch (cur_light_mode)
+		{
+		case DirectionalLight:
+			cur_light_mode = PointLight;
+			std::cout << "Light mode: " << "Point light\n";
+			break;
+		case PointLight:
+			cur_light_mode = SpotLight;
+			std::cout << "Light mode: " << "Spot light\n";
+			break;
+		case SpotLight:
+			cur_light_mode = ClusteredLights;
+			std::cout << "Light mode: " << "Clustered lights (" << scene_lights.size() << ")\n";
+			break;
+		case ClusteredLights:
+			cur_light_mode = DirectionalLight;
+			std::cout << "Light mode: " << "Directional light\n";
+			break;
+		default:
+			break;
+		}
+		break;
+	case GLFW_KEY_K:
+		cur_trans_mode = LightEdit;
+		break;
+	case GLFW_KEY_J:
+		cur_trans_mode = ShininessEdit;
+		break;
+	case GLFW_KEY_P:
+		useSideBySideMode(!single_pass_side_by_side);
+		std::cout << "Side-by-side: " << (single_pass_side_by_side ? "single pass\n" : "two passes\n");
+		break;
+	case GLFW_KEY_M:
+		if (multi_draw_support == NoMultiDraw)
+		{
+			std::cout << "Multi-draw needs GL 4.2\n";
+			break;
+		}
+		multi_draw = !multi_draw;
+		std::cout << "Submission: " << (multi_draw ? "multi-draw\n" : "one draw per shape\n");
+		break;
+	case GLFW_KEY_C:
+		frustum_culling = !frustum_culling;
+		std::cout << "Frustum culling: " << (frustum_culling ? "on\n" : "off\n");
+		break;
+	case GLFW_KEY_I:
+		// toggle a crowd of instanced copies of the current model
+		if (cur_idx < models.size() && models[cur_idx].resident)
+		{
+			if (models[cur_idx].instance_count == 0)
+			{
+				scatterInstances(1000, models[cur_idx].instances);
+			}
+			else
+			{
+				models[cur_idx].instances.clear();
+			}
+			setModelInstances(models[cur_idx]);
+			std::cout << "Instances: " << max(models[cur_idx].instance_count, 1) << "\n";
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+void scroll_callback(GLFWwindow *window, double xoffset, double yoffset)
+{
+	// [TODO] scroll up positive, otherwise it would be negative
+	switch (cur_trans_mode)
+	{
+	case GeoTranslation:
+		models[cur_idx].position.z += (float)yoffset / 10.0f;
+		break;
+	case GeoScaling:
+		models[cur_idx].scale.z += (float)yoffset / 10.0f;
+		break;
+	case GeoRotation:
+		models[cur_idx].rotation.z += (float)yoffset / 10.0f;
+		break;
+
+	case LightEdit:
 		if (cur_light_mode == DirectionalLight || cur_light_mode == PointLight)
 		{
 			light[cur_light_mode].diffuse += Vector3(0.1f, 0.1f, 0.1f) * (float)yoffset;
@@ -529,12 +1787,27 @@ void scroll_callback(GLFWwindow *window, double xoffset, double yoffset)
 	}
 }
 
+float current_press_x = (float)starting_press_x;
+float current_press_y = (float)starting_press_y;
+
 void mouse_button_callback(GLFWwindow *window, int button, int action, int mods)
 {
 	// [TODO] mouse press callback function
 	if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS)
 	{
 		mouse_pressed = true;
+
+		// report what was clicked, at the position cursor_pos_callback() last saw
+		PickHit hit = pickAt(current_press_x, current_press_y, WINDOW_WIDTH, WINDOW_HEIGHT);
+		if (hit.model >= 0)
+		{
+			std::cout << "Picked model " << hit.model + 1 << ", shape " << hit.shape << ", triangle " << hit.triangle;
+			if (hit.instance >= 0)
+			{
+				std::cout << ", instance " << hit.instance;
+			}
+			std::cout << " at (" << hit.point.x << ", " << hit.point.y << ", " << hit.point.z << ")\n";
+		}
 	}
 
 	if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_RELEASE)
@@ -543,9 +1816,6 @@ void mouse_button_callback(GLFWwindow *window, int button, int action, int mods)
 	}
 }
 
-float current_press_x = (float)starting_press_x;
-float current_press_y = (float)starting_press_y;
-
 static void cursor_pos_callback(GLFWwindow *window, double xpos, double ypos)
 {
 	// [TODO] cursor position callback function
@@ -579,6 +1849,10 @@ static void cursor_pos_callback(GLFWwindow *window, double xpos, double ypos)
 		// models[cur_idx].rotation.y += PI / 180 * dif_x;
 		break;
 	case LightEdit:
+		if (cur_light_mode == ClusteredLights)
+		{
+			break;
+		}
 		light[cur_light_mode].position[0] += dif_x / 250.0f;
 		light[cur_light_mode].position[1] += dif_y / 250.0f;
 		break;
@@ -587,327 +1861,918 @@ static void cursor_pos_callback(GLFWwindow *window, double xpos, double ypos)
 	}
 }
 
-void setShaders()
+// The text of a shader file; a missing file is reported and gives false
+bool readShaderFile(const char *path, string &source)
+{
+	char *text = textFileRead(path);
+	if (text == NULL)
+	{
+		std::cout << "ERROR: cannot read shader " << path << std::endl;
+		return false;
+	}
+	source = text;
+	free(text);
+	return true;
+}
+
+// Compile one shader stage, with extra #defines and then the shared declarations of common_path
+// (if any) inserted after its #version line
+GLuint compileShader(GLenum type, const char *path, const string &defines, const char *common_path = NULL)
+{
+	string source, common;
+	if (!readShaderFile(path, source) || (common_path != NULL && !readShaderFile(common_path, common)))
+	{
+		return 0;
+	}
+	size_t version_end = source.find('\n') + 1;
+	source.insert(version_end, defines + common);
+
+	GLuint shader = glCreateShader(type);
+	const GLchar *source_ptr = source.c_str();
+	glShaderSource(shader, 1, &source_ptr, NULL);
+
+	GLint success;
+	char infoLog[1000];
+	glCompileShader(shader);
+	// check for shader compile errors
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+	if (!success)
+	{
+		glGetShaderInfoLog(shader, 1000, NULL, infoLog);
+		std::cout << "ERROR: " << path << " COMPILATION FAILED\n"
+				  << infoLog << std::endl;
+	}
+	return shader;
+}
+
+// Link shader.vs/shader.fs (with lighting.glsl) specialized for one light and shading mode, plus shader.gs for the single-pass side-by-side view
+ShaderProgram buildProgram(LightMode light_mode, ShadingMode shading_mode)
+{
+	bool side_by_side = shading_mode == SideBySideShading;
+	string defines = "#define LIGHT_MODE " + to_string((int)light_mode) + "\n";
+	if (shading_mode != PerPixelShading)
+		defines += "#define PER_VERTEX_LIGHTING\n";
+	if (shading_mode != PerVertexShading)
+		defines += "#define PER_PIXEL_LIGHTING\n";
+	if (side_by_side)
+		defines += "#define SIDE_BY_SIDE\n";
+	defines += "#define MATERIALS_PER_PAGE " + to_string(MaterialsPerPage) + "\n";
+
+	GLuint v = compileShader(GL_VERTEX_SHADER, "shader.vs", defines, "lighting.glsl");
+	GLuint f = compileShader(GL_FRAGMENT_SHADER, "shader.fs", defines, "lighting.glsl");
+	GLuint g = side_by_side ? compileShader(GL_GEOMETRY_SHADER, "shader.gs", defines) : 0;
+
+	// create program object
+	GLuint p = glCreateProgram();
+
+	// attach shaders to program object
+	glAttachShader(p, f);
+	glAttachShader(p, v);
+	if (g != 0)
+	{
+		glAttachShader(p, g);
+	}
+
+	// link program
+	GLint success;
+	char infoLog[1000];
+	glLinkProgram(p);
+	// check for linking errors
+	glGetProgramiv(p, GL_LINK_STATUS, &success);
+	if (!success)
+	{
+		glGetProgramInfoLog(p, 1000, NULL, infoLog);
+		std::cout << "ERROR: SHADER PROGRAM LINKING FAILED\n"
+				  << infoLog << std::endl;
+		system("pause");
+		exit(123);
+	}
+
+	glDeleteShader(v);
+	glDeleteShader(f);
+	if (g != 0)
+	{
+		glDeleteShader(g);
+	}
+
+	ShaderProgram program;
+	program.id = p;
+	program.uniform.iLocMVP = glGetUniformLocation(p, "mvp");
+	program.uniform.iLocMV = glGetUniformLocation(p, "model_view_matrix");
+	program.uniform.iLocNormal = glGetUniformLocation(p, "normal_matrix");
+
+	// Directional/Point/Spot light, view matrix and materials come from uniform blocks
+	glUniformBlockBinding(p, glGetUniformBlockIndex(p, "FrameData"), FrameBinding);
+	glUniformBlockBinding(p, glGetUniformBlockIndex(p, "MaterialData"), MaterialBinding);
+
+	// clustered lights are read from buffer textures, -1 locations in the other variants are ignored
+	glUseProgram(p);
+	glUniform1i(glGetUniformLocation(p, "cluster_lights"), ClusterLightsUnit);
+	glUniform1i(glGetUniformLocation(p, "cluster_grid"), ClusterGridUnit);
+	glUniform1i(glGetUniformLocation(p, "cluster_indices"), ClusterIndicesUnit);
+	return program;
+}
+
+void setShaders()
+{
+	// RenderScene() picks among the variants, they are only built here
+	for (int l = 0; l < LightModeCount; l++)
+	{
+		for (int s = 0; s < 3; s++)
+		{
+			if (programs[l][s].id != 0)
+			{
+				glDeleteProgram(programs[l][s].id);
+			}
+			programs[l][s] = buildProgram((LightMode)l, (ShadingMode)s);
+		}
+	}
+	current_program = NULL;
+	uniform_cache = NULL;
+
+	if (frame_ubo == 0)
+	{
+		glGenBuffers(1, &frame_ubo);
+		glBindBuffer(GL_UNIFORM_BUFFER, frame_ubo);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameBlock), NULL, GL_DYNAMIC_DRAW);
+		glBindBufferBase(GL_UNIFORM_BUFFER, FrameBinding, frame_ubo);
+
+		GLint alignment = 1;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		material_page_stride = (MaterialsPerPage * sizeof(MaterialBlock) + alignment - 1) / alignment * alignment;
+	}
+	// force the first updateFrameBlock() to upload
+	memset(&frame_block, 0xff, sizeof(frame_block));
+
+	// shapes without an instance buffer read the current attribute values, identity matrices
+	for (int k = 0; k < 4; k++)
+	{
+		glVertexAttrib4f(InstanceMatrixLocation + k, k == 0, k == 1, k == 2, k == 3);
+	}
+	for (int k = 0; k < 3; k++)
+	{
+		glVertexAttrib3f(InstanceNormalMatrixLocation + k, k == 0, k == 1, k == 2);
+	}
+
+	useSideBySideMode(single_pass_side_by_side);
+}
+
+// Center the whole model at the origin and scale its longest axis to [-1, 1].
+// Runs once per file since every shape indexes into the same attrib->vertices.
+void normalization(tinyobj::attrib_t *attrib)
+{
+	size_t count = attrib->vertices.size();
+	if (count < 3)
+	{
+		return;
+	}
+	float *v = &attrib->vertices[0];
+
+	// min/max of X, Y and Z axis, four vertices (12 floats) per step so the lanes line up
+	float lo[12], hi[12];
+	for (int k = 0; k < 12; k++)
+	{
+		lo[k] = hi[k] = v[k % 3];
+	}
+	size_t i = 0;
+	for (; i + 12 <= count; i += 12)
+	{
+		for (int k = 0; k < 12; k++)
+		{
+			lo[k] = v[i + k] < lo[k] ? v[i + k] : lo[k];
+			hi[k] = v[i + k] > hi[k] ? v[i + k] : hi[k];
+		}
+	}
+	for (; i + 3 <= count; i += 3)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			lo[k] = v[i + k] < lo[k] ? v[i + k] : lo[k];
+			hi[k] = v[i + k] > hi[k] ? v[i + k] : hi[k];
+		}
+	}
+	for (int k = 3; k < 12; k++)
+	{
+		lo[k % 3] = min(lo[k % 3], lo[k]);
+		hi[k % 3] = max(hi[k % 3], hi[k]);
+	}
+
+	float offset[3], greatestAxis = 0;
+	for (int k = 0; k < 3; k++)
+	{
+		offset[k] = (hi[k] + lo[k]) / 2;
+		greatestAxis = max(greatestAxis, hi[k] - lo[k]);
+	}
+	if (greatestAxis <= 0)
+	{
+		return;
+	}
+	float inv_scale = 2 / greatestAxis;
+
+	// single rescale pass
+	for (i = 0; i + 3 <= count; i += 3)
+	{
+		v[i + 0] = (v[i + 0] - offset[0]) * inv_scale;
+		v[i + 1] = (v[i + 1] - offset[1]) * inv_scale;
+		v[i + 2] = (v[i + 2] - offset[2]) * inv_scale;
+	}
+}
+
+// Weld the face corners of one shape into unique (position, normal) vertices plus an index list.
+// Corners sharing vertex_index and normal_index become one vertex, so closed meshes upload
+// about a sixth of the vertices an expanded triangle list would.
+void weldShape(const tinyobj::attrib_t *attrib, const tinyobj::shape_t *shape, vector<Vertex> &vertices, vector<GLuint> &indices)
+{
+	size_t corners = shape->mesh.indices.size();
+	unordered_map<uint64_t, GLuint> unique_vertices;
+	unique_vertices.reserve(corners / 2);
+	indices.reserve(corners);
+
+	for (size_t c = 0; c < corners; c++)
+	{
+		// access to vertex
+		tinyobj::index_t idx = shape->mesh.indices[c];
+		uint64_t key = ((uint64_t)(uint32_t)idx.vertex_index << 32) | (uint32_t)idx.normal_index;
+		auto found = unique_vertices.emplace(key, (GLuint)vertices.size());
+		indices.push_back(found.first->second);
+		if (!found.second)
+		{
+			continue;
+		}
+
+		Vertex vertex;
+		const float *position = &attrib->vertices[3 * idx.vertex_index];
+		const float *color = &attrib->colors[3 * idx.vertex_index];
+		const float *normal = idx.normal_index >= 0 ? &attrib->normals[3 * idx.normal_index] : NULL;
+		for (int k = 0; k < 3; k++)
+		{
+			vertex.position[k] = position[k];
+			vertex.color[k] = color[k];
+			// keep a zero normal when a corner has none
+			vertex.normal[k] = normal ? normal[k] : 0.0f;
+		}
+		vertices.push_back(vertex);
+	}
+}
+
+// IEEE 754 binary16 from binary32, round to nearest, overflow to infinity, tiny values flush to zero
+GLushort floatToHalf(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	uint32_t sign = (bits >> 16) & 0x8000;
+	int exponent = (int)((bits >> 23) & 0xff) - 127 + 15;
+	uint32_t mantissa = bits & 0x7fffff;
+
+	if (exponent <= 0)
+	{
+		return (GLushort)sign;
+	}
+	if (exponent >= 31)
+	{
+		return (GLushort)(sign | 0x7c00);
+	}
+	// the rounding carry may bump the exponent, which is still the right result
+	return (GLushort)(sign | ((exponent << 10) + ((mantissa + 0x1000) >> 13)));
+}
+
+// binary32 from a binary16 as floatToHalf() makes them, which never gives subnormals
+float halfToFloat(GLushort half)
+{
+	uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+	uint32_t exponent = (half >> 10) & 0x1f;
+	uint32_t mantissa = half & 0x3ff;
+	uint32_t bits = sign;
+	if (exponent == 31)
+	{
+		bits |= 0x7f800000 | (mantissa << 13);
+	}
+	else if (exponent > 0)
+	{
+		bits |= ((exponent - 15 + 127) << 23) | (mantissa << 13);
+	}
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+GLuint packSnorm10(float x, float y, float z)
+{
+	float v[3] = {x, y, z};
+	GLuint packed = 0;
+	for (int k = 0; k < 3; k++)
+	{
+		float c = v[k] < -1.0f ? -1.0f : (v[k] > 1.0f ? 1.0f : v[k]);
+		int q = (int)floor(c * 511.0f + 0.5f);
+		packed |= ((GLuint)q & 0x3ff) << (10 * k);
+	}
+	return packed;
+}
+
+GLubyte packUnorm8(float v)
 {
-	GLuint v, f, p;
-	char *vs = NULL;
-	char *fs = NULL;
+	return (GLubyte)(v <= 0.0f ? 0 : (v >= 1.0f ? 255 : (int)(v * 255.0f + 0.5f)));
+}
 
-	v = glCreateShader(GL_VERTEX_SHADER);
-	f = glCreateShader(GL_FRAGMENT_SHADER);
+void packVertices(const vector<Vertex> &vertices, vector<PackedVertex> &packed)
+{
+	packed.resize(vertices.size());
+	for (size_t i = 0; i < vertices.size(); i++)
+	{
+		const Vertex &v = vertices[i];
+		PackedVertex &p = packed[i];
+		p.position[0] = floatToHalf(v.position[0]);
+		p.position[1] = floatToHalf(v.position[1]);
+		p.position[2] = floatToHalf(v.position[2]);
+		p.position[3] = floatToHalf(1.0f);
+		p.normal = packSnorm10(v.normal[0], v.normal[1], v.normal[2]);
+		p.color[0] = packUnorm8(v.color[0]);
+		p.color[1] = packUnorm8(v.color[1]);
+		p.color[2] = packUnorm8(v.color[2]);
+		p.color[3] = 255;
+	}
+}
 
-	vs = textFileRead("shader.vs");
-	fs = textFileRead("shader.fs");
+string GetBaseDir(const string &filepath)
+{
+	if (filepath.find_last_of("/\\") != std::string::npos)
+		return filepath.substr(0, filepath.find_last_of("/\\"));
+	return "";
+}
 
-	glShaderSource(v, 1, (const GLchar **)&vs, NULL);
-	glShaderSource(f, 1, (const GLchar **)&fs, NULL);
+bool use_mesh_cache = true;
 
-	free(vs);
-	free(fs);
+string meshCachePath(const string &model_path)
+{
+	return model_path + ".meshcache";
+}
 
-	GLint success;
-	char infoLog[1000];
-	// compile vertex shader
-	glCompileShader(v);
-	// check for shader compile errors
-	glGetShaderiv(v, GL_COMPILE_STATUS, &success);
-	if (!success)
+// Map the model's cache if it is present and still matches the .obj
+bool readMeshCache(const string &model_path, ModelData &data)
+{
+	uint64_t source_size;
+	int64_t source_time;
+	if (!getFileStamp(model_path, &source_size, &source_time) ||
+		!data.cache.open(meshCachePath(model_path), vertex_layout, vertexStride(vertex_layout), source_size, source_time))
 	{
-		glGetShaderInfoLog(v, 1000, NULL, infoLog);
-		std::cout << "ERROR: VERTEX SHADER COMPILATION FAILED\n"
-				  << infoLog << std::endl;
+		return false;
 	}
 
-	// compile fragment shader
-	glCompileShader(f);
-	// check for shader compile errors
-	glGetShaderiv(f, GL_COMPILE_STATUS, &success);
-	if (!success)
+	data.shapes.resize(data.cache.shapeCount());
+	for (uint32_t i = 0; i < data.cache.shapeCount(); i++)
 	{
-		glGetShaderInfoLog(f, 1000, NULL, infoLog);
-		std::cout << "ERROR: FRAGMENT SHADER COMPILATION FAILED\n"
-				  << infoLog << std::endl;
+		const MeshCacheShape &cached = data.cache.shape(i);
+		ShapeData &shape = data.shapes[i];
+		shape.vertices = data.cache.vertices(i);
+		shape.vertex_count = cached.vertexCount;
+		shape.indices = data.cache.indices(i);
+		shape.index_count = cached.indexCount;
+		shape.index_type = cached.indexSize == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+		shape.material.Ka = Vector3(cached.Ka[0], cached.Ka[1], cached.Ka[2]);
+		shape.material.Kd = Vector3(cached.Kd[0], cached.Kd[1], cached.Kd[2]);
+		shape.material.Ks = Vector3(cached.Ks[0], cached.Ks[1], cached.Ks[2]);
+		shape.bounds.lo = Vector3(cached.boundsMin[0], cached.boundsMin[1], cached.boundsMin[2]);
+		shape.bounds.hi = Vector3(cached.boundsMax[0], cached.boundsMax[1], cached.boundsMax[2]);
+		shape.bounds.center = Vector3(cached.sphere[0], cached.sphere[1], cached.sphere[2]);
+		shape.bounds.radius = cached.sphere[3];
 	}
+	return true;
+}
 
-	// create program object
-	p = glCreateProgram();
+void writeMeshCache(const string &model_path, const ModelData &data)
+{
+	uint64_t source_size;
+	int64_t source_time;
+	if (!getFileStamp(model_path, &source_size, &source_time))
+	{
+		return;
+	}
 
-	// attach shaders to program object
-	glAttachShader(p, f);
-	glAttachShader(p, v);
+	MeshCacheWriter writer;
+	for (int i = 0; i < data.shapes.size(); i++)
+	{
+		const ShapeData &shape = data.shapes[i];
+		GLfloat Ka[3], Kd[3], Ks[3], lo[3], hi[3], sphere[4];
+		copyVector3(Ka, shape.material.Ka);
+		copyVector3(Kd, shape.material.Kd);
+		copyVector3(Ks, shape.material.Ks);
+		copyVector3(lo, shape.bounds.lo);
+		copyVector3(hi, shape.bounds.hi);
+		copyVector3(sphere, shape.bounds.center);
+		sphere[3] = shape.bounds.radius;
+		writer.addShape(shape.vertices, shape.vertex_count, vertexStride(vertex_layout),
+						shape.indices, shape.index_count, shape.index_type == GL_UNSIGNED_SHORT ? 2 : 4,
+						Ka, Kd, Ks, lo, hi, sphere);
+	}
+	if (!writer.write(meshCachePath(model_path), vertex_layout, vertexStride(vertex_layout), source_size, source_time))
+	{
+		cout << "Cannot write mesh cache " << meshCachePath(model_path) << std::endl;
+	}
+}
 
-	// link program
-	glLinkProgram(p);
-	// check for linking errors
-	glGetProgramiv(p, GL_LINK_STATUS, &success);
-	if (!success)
+// Threads each .obj is parsed with, 0: one per hardware thread, -1: see objParseThreads()
+int obj_parse_threads = -1;
+
+// Threads for one of concurrent_files .obj parses running at once. By default a file parsed on its
+// own gets one per hardware thread, and files the loader pool parses side by side one each: the pool
+// already keeps every core busy, threads per parse on top would start about cores^2 of them.
+int objParseThreads(int concurrent_files)
+{
+	if (obj_parse_threads >= 0)
 	{
-		glGetProgramInfoLog(p, 1000, NULL, infoLog);
-		std::cout << "ERROR: SHADER PROGRAM LINKING FAILED\n"
-				  << infoLog << std::endl;
+		return obj_parse_threads;
 	}
+	return concurrent_files > 1 ? 1 : 0;
+}
 
-	glDeleteShader(v);
-	glDeleteShader(f);
+// Parse a memory mapped .obj, its .mtl files are looked up next to it
+bool loadObjFile(const string &model_path, int threads, tinyobj::attrib_t &attrib, vector<tinyobj::shape_t> &shapes,
+				 vector<tinyobj::material_t> &materials, string &warn, string &err)
+{
+	MappedFile file;
+	if (!file.open(model_path))
+	{
+		err = "Cannot open file [" + model_path + "]\n";
+		return false;
+	}
 
-	uniform.iLocMVP = glGetUniformLocation(p, "mvp");
-	uniform.iLocV = glGetUniformLocation(p, "view_matrix");
-	uniform.iLocM = glGetUniformLocation(p, "model_matrix");
+	string base_dir = GetBaseDir(model_path); // handle .mtl with relative path
 
-	uniform.Ka = glGetUniformLocation(p, "material.Ka");
-	uniform.Kd = glGetUniformLocation(p, "material.Kd");
-	uniform.Ks = glGetUniformLocation(p, "material.Ks");
+#ifdef _WIN32
+	base_dir += "\\";
+#else
+	base_dir += "/";
+#endif
 
-	uniform.LightMode = glGetUniformLocation(p, "cur_light_mode");
-	uniform.Shininess = glGetUniformLocation(p, "shininess");
-	is_per_pixel_lighting = glGetUniformLocation(p, "is_per_pixel_lighting");
+	tinyobj::MaterialFileReader material_reader(base_dir);
+	return tinyobj::LoadObjFromBuffer(&attrib, &shapes, &materials, &warn, &err, (const char *)file.data(), file.size(),
+									  &material_reader, true, true, threads);
+}
 
-	// Directional/Point/Spot light
-	for (int i = 0; i <= 2; i++)
+// Parse, normalize and weld an .obj into upload-ready shape data
+bool parseModel(const string &model_path, int parse_threads, ModelData &data)
+{
+	vector<tinyobj::shape_t> shapes;
+	vector<tinyobj::material_t> materials;
+	tinyobj::attrib_t attrib;
+	vector<Vertex> vertices;
+	vector<PackedVertex> packed_vertices;
+	vector<GLuint> indices;
+
+	string err;
+	string warn;
+
+	bool ret = loadObjFile(model_path, parse_threads, attrib, shapes, materials, warn, err);
+
+	if (!warn.empty())
 	{
-		iLocLight[i].position = glGetUniformLocation(p, ("light[" + std::to_string(i) + "].position").c_str());
-		iLocLight[i].ambient = glGetUniformLocation(p, ("light[" + std::to_string(i) + "].ambient").c_str());
-		iLocLight[i].diffuse = glGetUniformLocation(p, ("light[" + std::to_string(i) + "].diffuse").c_str());
-		iLocLight[i].specular = glGetUniformLocation(p, ("light[" + std::to_string(i) + "].specular").c_str());
-		iLocLight[i].constantAttenuation = glGetUniformLocation(p, ("light[" + std::to_string(i) + "].constantAttenuation").c_str());
-		iLocLight[i].linearAttenuation = glGetUniformLocation(p, ("light[" + std::to_string(i) + "].linearAttenuation").c_str());
-		iLocLight[i].quadraticAttenuation = glGetUniformLocation(p, ("light[" + std::to_string(i) + "].quadraticAttenuation").c_str());
-		iLocLight[i].spotDirection = glGetUniformLocation(p, ("light[" + std::to_string(i) + "].spotDirection").c_str());
-		iLocLight[i].spotCutoff = glGetUniformLocation(p, ("light[" + std::to_string(i) + "].spotCutoff").c_str());
-		iLocLight[i].spotExponent = glGetUniformLocation(p, ("light[" + std::to_string(i) + "].spotExponent").c_str());
+		cout << warn << std::endl;
 	}
 
-	if (success)
-		glUseProgram(p);
-	else
+	if (!err.empty())
 	{
-		system("pause");
-		exit(123);
+		cerr << err << std::endl;
 	}
-}
 
-void normalization(tinyobj::attrib_t *attrib, vector<GLfloat> &vertices, vector<GLfloat> &colors, vector<GLfloat> &normals, tinyobj::shape_t *shape)
-{
-	vector<float> xVector, yVector, zVector;
-	float minX = 10000, maxX = -10000, minY = 10000, maxY = -10000, minZ = 10000, maxZ = -10000;
+	if (!ret)
+	{
+		return false;
+	}
+
+	printf("Load Models Success ! Shapes size %d Material size %d\n", int(shapes.size()), int(materials.size()));
+
+	normalization(&attrib);
+
+	vector<PhongMaterial> allMaterial;
+	for (int i = 0; i < materials.size(); i++)
+	{
+		PhongMaterial material;
+		material.Ka = Vector3(materials[i].ambient[0], materials[i].ambient[1], materials[i].ambient[2]);
+		material.Kd = Vector3(materials[i].diffuse[0], materials[i].diffuse[1], materials[i].diffuse[2]);
+		material.Ks = Vector3(materials[i].specular[0], materials[i].specular[1], materials[i].specular[2]);
+		allMaterial.push_back(material);
+	}
 
-	// find out min and max value of X, Y and Z axis
-	for (int i = 0; i < attrib->vertices.size(); i++)
+	data.shapes.reserve(shapes.size());
+	for (int i = 0; i < shapes.size(); i++)
 	{
-		// maxs = max(maxs, attrib->vertices.at(i));
-		if (i % 3 == 0)
+		vertices.clear();
+		indices.clear();
+		weldShape(&attrib, &shapes[i], vertices, indices);
+		if (indices.empty())
 		{
+			continue;
+		}
 
-			xVector.push_back(attrib->vertices.at(i));
+		data.shapes.push_back(ShapeData());
+		ShapeData &shape = data.shapes.back();
 
-			if (attrib->vertices.at(i) < minX)
-			{
-				minX = attrib->vertices.at(i);
-			}
+		// from the float positions, grown by what packing them as half floats can move them
+		shape.bounds = computeBounds(vertices[0].position, vertices.size(), sizeof(Vertex));
+		if (vertex_layout == InterleavedPacked)
+		{
+			padBounds(shape.bounds, PackedPositionError);
+		}
 
-			if (attrib->vertices.at(i) > maxX)
-			{
-				maxX = attrib->vertices.at(i);
-			}
+		// interleaved vertices in the active layout
+		if (vertex_layout == InterleavedPacked)
+		{
+			packVertices(vertices, packed_vertices);
+			shape.vertex_storage.assign((const unsigned char *)&packed_vertices[0], (const unsigned char *)(&packed_vertices[0] + packed_vertices.size()));
 		}
-		else if (i % 3 == 1)
+		else
 		{
-			yVector.push_back(attrib->vertices.at(i));
-
-			if (attrib->vertices.at(i) < minY)
-			{
-				minY = attrib->vertices.at(i);
-			}
+			shape.vertex_storage.assign((const unsigned char *)&vertices[0], (const unsigned char *)(&vertices[0] + vertices.size()));
+		}
+		shape.vertex_count = vertices.size();
 
-			if (attrib->vertices.at(i) > maxY)
-			{
-				maxY = attrib->vertices.at(i);
-			}
+		// 16-bit indices whenever the welded shape fits, they halve the index traffic
+		if (shape.vertex_count <= 65536)
+		{
+			vector<GLushort> short_indices(indices.begin(), indices.end());
+			shape.index_storage.assign((const unsigned char *)&short_indices[0], (const unsigned char *)(&short_indices[0] + short_indices.size()));
+			shape.index_type = GL_UNSIGNED_SHORT;
 		}
-		else if (i % 3 == 2)
+		else
 		{
-			zVector.push_back(attrib->vertices.at(i));
+			shape.index_storage.assign((const unsigned char *)&indices[0], (const unsigned char *)(&indices[0] + indices.size()));
+			shape.index_type = GL_UNSIGNED_INT;
+		}
+		shape.index_count = indices.size();
+		shape.vertices = &shape.vertex_storage[0];
+		shape.indices = &shape.index_storage[0];
+
+		// not support per face material, use material of first face
+		int material_id = shapes[i].mesh.material_ids.empty() ? -1 : shapes[i].mesh.material_ids[0];
+		if (material_id >= 0 && material_id < allMaterial.size())
+			shape.material = allMaterial[material_id];
+	}
+	return true;
+}
 
-			if (attrib->vertices.at(i) < minZ)
+// A triangle mesh per shape for picking, positions read back from the vertices in vertex_layout so
+// the triangles are exactly the ones drawn
+void buildPickMeshes(const ModelData &data, vector<TriangleMesh> &meshes)
+{
+	meshes.resize(data.shapes.size());
+	vector<Vector3> positions;
+	for (int i = 0; i < data.shapes.size(); i++)
+	{
+		const ShapeData &shape = data.shapes[i];
+		positions.resize(shape.vertex_count);
+		for (int v = 0; v < shape.vertex_count; v++)
+		{
+			if (vertex_layout == InterleavedPacked)
 			{
-				minZ = attrib->vertices.at(i);
+				const GLushort *p = ((const PackedVertex *)shape.vertices)[v].position;
+				positions[v] = Vector3(halfToFloat(p[0]), halfToFloat(p[1]), halfToFloat(p[2]));
 			}
-
-			if (attrib->vertices.at(i) > maxZ)
+			else
 			{
-				maxZ = attrib->vertices.at(i);
+				const GLfloat *p = ((const Vertex *)shape.vertices)[v].position;
+				positions[v] = Vector3(p[0], p[1], p[2]);
 			}
 		}
+		meshes[i].build(positions, shape.indices, shape.index_count, shape.index_type == GL_UNSIGNED_SHORT ? 2 : 4);
 	}
+}
 
-	float offsetX = (maxX + minX) / 2;
-	float offsetY = (maxY + minY) / 2;
-	float offsetZ = (maxZ + minZ) / 2;
-
-	for (int i = 0; i < attrib->vertices.size(); i++)
+// Load the model's shape data, from its mesh cache when possible
+bool readModelData(const string &model_path, int parse_threads, ModelData &data)
+{
+	if (use_mesh_cache && readMeshCache(model_path, data))
 	{
-		if (offsetX != 0 && i % 3 == 0)
-		{
-			attrib->vertices.at(i) = attrib->vertices.at(i) - offsetX;
-		}
-		else if (offsetY != 0 && i % 3 == 1)
+		printf("Load Models Success ! Shapes size %d (mesh cache)\n", int(data.shapes.size()));
+	}
+	else
+	{
+		if (!parseModel(model_path, parse_threads, data))
 		{
-			attrib->vertices.at(i) = attrib->vertices.at(i) - offsetY;
+			return false;
 		}
-		else if (offsetZ != 0 && i % 3 == 2)
+		if (use_mesh_cache)
 		{
-			attrib->vertices.at(i) = attrib->vertices.at(i) - offsetZ;
+			writeMeshCache(model_path, data);
 		}
 	}
+	return true;
+}
+
+// Index of material in materials, appended if it is not there yet
+int findOrAddMaterial(vector<PhongMaterial> &materials, const PhongMaterial &material)
+{
+	for (int i = 0; i < materials.size(); i++)
+	{
+		if (materials[i].Ka == material.Ka && materials[i].Kd == material.Kd && materials[i].Ks == material.Ks)
+			return i;
+	}
+	materials.push_back(material);
+	return materials.size() - 1;
+}
 
-	float greatestAxis = maxX - minX;
-	float distanceOfYAxis = maxY - minY;
-	float distanceOfZAxis = maxZ - minZ;
+// Uniform buffer of MaterialBlocks in whole pages, so every page can be bound at full size
+GLuint createMaterialBuffer(const vector<PhongMaterial> &materials)
+{
+	int pages = max(1, ((int)materials.size() + MaterialsPerPage - 1) / MaterialsPerPage);
+	vector<unsigned char> material_data(pages * material_page_stride, 0);
+	for (int i = 0; i < materials.size(); i++)
+	{
+		MaterialBlock block;
+		memset(&block, 0, sizeof(block));
+		copyVector3(block.Ka, materials[i].Ka);
+		copyVector3(block.Kd, materials[i].Kd);
+		copyVector3(block.Ks, materials[i].Ks);
+		memcpy(&material_data[i / MaterialsPerPage * material_page_stride + i % MaterialsPerPage * sizeof(MaterialBlock)], &block, sizeof(block));
+	}
+	GLuint ubo;
+	glGenBuffers(1, &ubo);
+	glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+	glBufferData(GL_UNIFORM_BUFFER, material_data.size(), material_data.empty() ? NULL : &material_data[0], GL_STATIC_DRAW);
+	return ubo;
+}
 
-	if (distanceOfYAxis > greatestAxis)
+// Upload a model from its CPU data: each shape's vertices and indices into the geometry pool, one
+// glBufferSubData each, and the model's materials into a buffer of their own
+void uploadModel(const ModelData &data, model &tmp_model)
+{
+	vector<PhongMaterial> materials; // distinct, shapes refer to them by materialIndex
+	for (int i = 0; i < data.shapes.size(); i++)
 	{
-		greatestAxis = distanceOfYAxis;
+		const ShapeData &shape = data.shapes[i];
+
+		Shape tmp_shape;
+		tmp_shape.vertex_count = shape.vertex_count;
+		tmp_shape.indexType = shape.index_type;
+		tmp_shape.indexCount = shape.index_count;
+		allocateShapeGeometry(tmp_shape, shape.vertices, shape.indices);
+
+		tmp_shape.material = shape.material;
+		tmp_shape.materialIndex = findOrAddMaterial(materials, shape.material);
+		tmp_shape.bounds = shape.bounds;
+		tmp_model.shapes.push_back(tmp_shape);
 	}
 
-	if (distanceOfZAxis > greatestAxis)
+	// shape spheres as arrays for the cull pass, and the bounds of the whole model
+	tmp_model.bounds = computeBounds(NULL, 0, 0);
+	tmp_model.shape_centers.resize(data.shapes.size());
+	tmp_model.shape_radii.resize(data.shapes.size());
+	for (int i = 0; i < data.shapes.size(); i++)
 	{
-		greatestAxis = distanceOfZAxis;
+		const BoundingVolume &bounds = data.shapes[i].bounds;
+		tmp_model.shape_centers.set(i, bounds.center);
+		tmp_model.shape_radii[i] = bounds.radius;
+		tmp_model.bounds = i == 0 ? bounds : mergeBounds(tmp_model.bounds, bounds);
 	}
 
-	float scale = greatestAxis / 2;
+	// shapes sharing a material are drawn back to back
+	vector<Shape> &shapes = tmp_model.shapes;
+	tmp_model.draw_order.resize(shapes.size());
+	for (int i = 0; i < shapes.size(); i++)
+	{
+		tmp_model.draw_order[i] = i;
+	}
+	sort(tmp_model.draw_order.begin(), tmp_model.draw_order.end(), [&shapes](int a, int b) {
+		if (shapes[a].materialIndex != shapes[b].materialIndex)
+			return shapes[a].materialIndex < shapes[b].materialIndex;
+		return shapes[a].vao < shapes[b].vao;
+	});
+
+	// the distinct materials in one uniform buffer
+	tmp_model.material_ubo = createMaterialBuffer(materials);
+	scene_materials.stale = true;
+	scene_bvh.stale = true;
+}
 
-	for (int i = 0; i < attrib->vertices.size(); i++)
+// Delete the GL objects owned by a model
+void releaseModel(model &m)
+{
+	for (int i = 0; i < m.shapes.size(); i++)
 	{
-		// std::cout << i << " = " << (double)(attrib.vertices.at(i) / greatestAxis) << std::endl;
-		attrib->vertices.at(i) = attrib->vertices.at(i) / scale;
+		freeShapeGeometry(m.shapes[i]);
 	}
-	size_t index_offset = 0;
-	for (size_t f = 0; f < shape->mesh.num_face_vertices.size(); f++)
+	for (int i = 0; i < m.instance_vaos.size(); i++)
 	{
-		int fv = shape->mesh.num_face_vertices[f];
+		glDeleteVertexArrays(1, &m.instance_vaos[i]);
+	}
+	glDeleteBuffers(1, &m.material_ubo);
+	glDeleteBuffers(1, &m.instance_vbo);
+	glDeleteBuffers(1, &m.run_command_buffer);
+	m.instance_vbo = 0;
+	m.run_command_buffer = 0;
+	m.instance_vaos.clear();
+	m.shape_visible.clear();
+	m.instance_runs.clear();
+	m.instance_count = 0;
+	m.instances.clear();
+	m.shapes.clear();
+	m.pick_meshes.clear();
+	m.pick_serial = 0; // a build still running is dropped when it arrives
+	scene_materials.stale = true;
+	scene_bvh.stale = true;
+}
 
-		// Loop over vertices in the face.
-		for (size_t v = 0; v < fv; v++)
+// Number the distinct materials of all resident shapes and upload them as one material buffer
+void buildSceneMaterials()
+{
+	vector<PhongMaterial> materials;
+	for (int m = 0; m < models.size(); m++)
+	{
+		for (int i = 0; models[m].resident && i < models[m].shapes.size(); i++)
 		{
-			// access to vertex
-			tinyobj::index_t idx = shape->mesh.indices[index_offset + v];
-			vertices.push_back(attrib->vertices[3 * idx.vertex_index + 0]);
-			vertices.push_back(attrib->vertices[3 * idx.vertex_index + 1]);
-			vertices.push_back(attrib->vertices[3 * idx.vertex_index + 2]);
-			// Optional: vertex colors
-			colors.push_back(attrib->colors[3 * idx.vertex_index + 0]);
-			colors.push_back(attrib->colors[3 * idx.vertex_index + 1]);
-			colors.push_back(attrib->colors[3 * idx.vertex_index + 2]);
-			// Optional: vertex normals
-			if (idx.normal_index >= 0)
-			{
-				normals.push_back(attrib->normals[3 * idx.normal_index + 0]);
-				normals.push_back(attrib->normals[3 * idx.normal_index + 1]);
-				normals.push_back(attrib->normals[3 * idx.normal_index + 2]);
-			}
+			Shape &shape = models[m].shapes[i];
+			shape.sceneMaterialIndex = findOrAddMaterial(materials, shape.material);
 		}
-		index_offset += fv;
 	}
+	glDeleteBuffers(1, &scene_materials.material_ubo);
+	scene_materials.material_ubo = createMaterialBuffer(materials);
+	scene_materials.generation++;
+	scene_materials.stale = false;
 }
 
-string GetBaseDir(const string &filepath)
-{
-	if (filepath.find_last_of("/\\") != std::string::npos)
-		return filepath.substr(0, filepath.find_last_of("/\\"));
-	return "";
-}
+void buildPickMeshesAsync(int index, ModelData *data);
 
 void LoadModels(string model_path)
 {
-	vector<tinyobj::shape_t> shapes;
-	vector<tinyobj::material_t> materials;
-	tinyobj::attrib_t attrib;
-	vector<GLfloat> vertices;
-	vector<GLfloat> colors;
-	vector<GLfloat> normals;
+	ModelData *data = new ModelData();
+	if (!readModelData(model_path, objParseThreads(1), *data))
+	{
+		exit(1);
+	}
 
-	string err;
-	string warn;
+	model tmp_model;
+	uploadModel(*data, tmp_model);
+	tmp_model.resident = true;
+	models.push_back(tmp_model);
+	buildPickMeshesAsync(models.size() - 1, data);
+}
 
-	string base_dir = GetBaseDir(model_path); // handle .mtl with relative path
+// Background loading: loader threads parse (or map) models and hand the CPU data to the GL thread
+struct LoadedModel
+{
+	int index;		 // slot in models
+	ModelData *data; // NULL when loading failed
+};
+ThreadPool *loader_pool = NULL;
+LockFreeQueue<LoadedModel> loaded_models(64);
+int pending_models = 0; // queued for loading but not uploaded yet
+int failed_models = 0;	// could not be loaded, their slots stay empty
+
+// Pick meshes are built on a loader thread once the model is uploaded, behind any parse still
+// queued, so neither a load nor the first frame waits for the BVHs; pickAt() waits if it gets there first
+struct BuiltPickMeshes
+{
+	int index;					  // slot in models
+	int serial;					  // the model's pick_serial when the build was queued
+	vector<TriangleMesh> *meshes; // per shape
+};
+LockFreeQueue<BuiltPickMeshes> built_pick_meshes(64);
+int pending_pick_meshes = 0; // queued builds not handed to their model yet
+int pick_mesh_serial = 0;
 
-#ifdef _WIN32
-	base_dir += "\\";
-#else
-	base_dir += "/";
-#endif
+// Build the pick meshes of models[index] from its CPU data off the GL thread, data is deleted after
+void buildPickMeshesAsync(int index, ModelData *data)
+{
+	if (loader_pool == NULL)
+	{
+		loader_pool = new ThreadPool();
+	}
 
-	bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, model_path.c_str(), base_dir.c_str());
+	int serial = ++pick_mesh_serial;
+	models[index].pick_serial = serial;
+	pending_pick_meshes++;
+	loader_pool->submit([index, serial, data]() {
+		BuiltPickMeshes result = {index, serial, new vector<TriangleMesh>()};
+		buildPickMeshes(*data, *result.meshes);
+		delete data;
+		while (!built_pick_meshes.tryPush(result))
+		{
+			this_thread::yield();
+		}
+	});
+}
 
-	if (!warn.empty())
+// Hand every finished build to its model, unless the model was released or reloaded since
+void collectPickMeshes()
+{
+	BuiltPickMeshes built;
+	while (pending_pick_meshes > 0 && built_pick_meshes.tryPop(built))
 	{
-		cout << warn << std::endl;
+		pending_pick_meshes--;
+		if (built.index < models.size() && models[built.index].pick_serial == built.serial)
+		{
+			models[built.index].pick_meshes.swap(*built.meshes);
+			models[built.index].pick_serial = 0;
+		}
+		delete built.meshes;
 	}
+}
 
-	if (!err.empty())
+// Block until models[index] has its pick meshes
+void waitForPickMeshes(int index)
+{
+	while (models[index].pick_serial != 0)
 	{
-		cerr << err << std::endl;
+		collectPickMeshes();
+		if (models[index].pick_serial != 0)
+		{
+			this_thread::yield();
+		}
 	}
+}
 
-	if (!ret)
+// Reserve a slot in models for every file and start loading them off the GL thread
+void LoadModelsAsync(const vector<string> &model_paths)
+{
+	if (loader_pool == NULL)
 	{
-		exit(1);
+		loader_pool = new ThreadPool();
 	}
 
-	printf("Load Models Success ! Shapes size %d Material size %d\n", int(shapes.size()), int(materials.size()));
-	model tmp_model;
-
-	vector<PhongMaterial> allMaterial;
-	for (int i = 0; i < materials.size(); i++)
+	int first = models.size();
+	models.resize(first + model_paths.size());
+	pending_models += model_paths.size();
+	for (int i = 0; i < model_paths.size(); i++)
 	{
-		PhongMaterial material;
-		material.Ka = Vector3(materials[i].ambient[0], materials[i].ambient[1], materials[i].ambient[2]);
-		material.Kd = Vector3(materials[i].diffuse[0], materials[i].diffuse[1], materials[i].diffuse[2]);
-		material.Ks = Vector3(materials[i].specular[0], materials[i].specular[1], materials[i].specular[2]);
-		allMaterial.push_back(material);
+		string model_path = model_paths[i];
+		int index = first + i;
+		int parse_threads = objParseThreads(min(pending_models, loader_pool->size()));
+		loader_pool->submit([model_path, index, parse_threads]() {
+			LoadedModel result = {index, new ModelData()};
+			if (!readModelData(model_path, parse_threads, *result.data))
+			{
+				cerr << "Cannot load " << model_path << std::endl;
+				delete result.data;
+				result.data = NULL;
+			}
+			while (!loaded_models.tryPush(result))
+			{
+				this_thread::yield();
+			}
+		});
 	}
+}
 
-	for (int i = 0; i < shapes.size(); i++)
+// Upload every model the loader threads finished since the last call, on the GL thread
+void uploadReadyModels()
+{
+	LoadedModel loaded;
+	while (pending_models > 0 && loaded_models.tryPop(loaded))
 	{
+		pending_models--;
+		if (loaded.data == NULL)
+		{
+			models[loaded.index].failed = true;
+			failed_models++;
+			cerr << "Model " << loaded.index + 1 << " is skipped" << std::endl;
+			continue;
+		}
+		uploadModel(*loaded.data, models[loaded.index]);
+		models[loaded.index].resident = true;
+		buildPickMeshesAsync(loaded.index, loaded.data);
+	}
+	collectPickMeshes();
+}
 
-		vertices.clear();
-		colors.clear();
-		normals.clear();
-		normalization(&attrib, vertices, colors, normals, &shapes[i]);
-		// printf("Vertices size: %d", vertices.size() / 3);
-
-		Shape tmp_shape;
-		glGenVertexArrays(1, &tmp_shape.vao);
-		glBindVertexArray(tmp_shape.vao);
-
-		glGenBuffers(1, &tmp_shape.vbo);
-		glBindBuffer(GL_ARRAY_BUFFER, tmp_shape.vbo);
-		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GL_FLOAT), &vertices.at(0), GL_STATIC_DRAW);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-		tmp_shape.vertex_count = vertices.size() / 3;
-
-		glGenBuffers(1, &tmp_shape.p_color);
-		glBindBuffer(GL_ARRAY_BUFFER, tmp_shape.p_color);
-		glBufferData(GL_ARRAY_BUFFER, colors.size() * sizeof(GL_FLOAT), &colors.at(0), GL_STATIC_DRAW);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-		glGenBuffers(1, &tmp_shape.p_normal);
-		glBindBuffer(GL_ARRAY_BUFFER, tmp_shape.p_normal);
-		glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(GL_FLOAT), &normals.at(0), GL_STATIC_DRAW);
-		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-		glEnableVertexAttribArray(0);
-		glEnableVertexAttribArray(1);
-		glEnableVertexAttribArray(2);
+// Block until every queued model is resident (or failed)
+void waitForModels()
+{
+	while (pending_models > 0)
+	{
+		uploadReadyModels();
+		if (pending_models > 0)
+		{
+			this_thread::yield();
+		}
+	}
+}
 
-		// not support per face material, use material of first face
-		if (allMaterial.size() > 0)
-			tmp_shape.material = allMaterial[shapes[i].mesh.material_ids[0]];
-		tmp_model.shapes.push_back(tmp_shape);
+// Join the loader and frame threads before exit. Loaders still running block until their result
+// fits in loaded_models or built_pick_meshes, so finished results are dropped from them while they drain.
+void shutdownThreadPools()
+{
+	LoadedModel loaded;
+	BuiltPickMeshes built;
+	while (pending_models > 0 || pending_pick_meshes > 0)
+	{
+		if (pending_models > 0 && loaded_models.tryPop(loaded))
+		{
+			pending_models--;
+			delete loaded.data;
+		}
+		else if (pending_pick_meshes > 0 && built_pick_meshes.tryPop(built))
+		{
+			pending_pick_meshes--;
+			delete built.meshes;
+		}
+		else
+		{
+			this_thread::yield();
+		}
 	}
-	shapes.clear();
-	materials.clear();
-	models.push_back(tmp_model);
+	delete loader_pool;
+	loader_pool = NULL;
+	delete frame_pool;
+	frame_pool = NULL;
 }
 
 void initParameter()
@@ -959,6 +2824,9 @@ void initParameter()
 
 	shininess = 64.0f;
 
+	// Clustered lights
+	scatterLights(256, scene_lights);
+
 	setViewingMatrix();
 	setPerspective(); // set default projection matrix as perspective matrix
 }
@@ -971,12 +2839,14 @@ void setupRC()
 
 	// OpenGL States and Values
 	glClearColor(0.2, 0.2, 0.2, 1.0);
-	vector<string> model_list{"../NormalModels/bunny5KN.obj", "../NormalModels/dragon10KN.obj", "../NormalModels/lucy25KN.obj", "../NormalModels/teapot4KN.obj", "../NormalModels/dolphinN.obj"};
-	// [TODO] Load five model at here
-	for (int i = 0; i < model_list.size(); i++)
+	// default model list, unless the caller (e.g. benchmark) already filled one in
+	if (filenames.empty())
 	{
-		LoadModels(model_list[i]);
+		filenames = default_filenames;
 	}
+	// [TODO] Load five model at here
+	// parsed on loader threads, RenderScene() draws each model once it is resident
+	LoadModelsAsync(filenames);
 	std::cout << "Model " << cur_idx + 1 << " is selected.\n";
 	std::cout << "Light mode: " << "Directional light\n";
 }
@@ -999,6 +2869,7 @@ void glPrintContextInfo(bool printExtension)
 	}
 }
 
+#ifndef HEADLESS_BENCHMARK
 int main(int argc, char **argv)
 {
 	// initial glfw
@@ -1027,6 +2898,7 @@ int main(int argc, char **argv)
 		std::cout << "Failed to initialize GLAD" << std::endl;
 		return -1;
 	}
+	loadExtensions((GLADloadproc)glfwGetProcAddress);
 
 	// register glfw callback functions
 	glfwSetKeyCallback(window, KeyCallback);
@@ -1042,6 +2914,9 @@ int main(int argc, char **argv)
 	// main loop
 	while (!glfwWindowShouldClose(window))
 	{
+		// pick up models the loader threads finished
+		uploadReadyModels();
+
 		// render
 		RenderScene();
 
@@ -1052,6 +2927,8 @@ int main(int argc, char **argv)
 		glfwPollEvents();
 	}
 
+	shutdownThreadPools();
 	// just for compatibiliy purposes
 	return 0;
 }
+#endif
@@ -0,0 +1,328 @@
+#ifndef MAIN_H_DEF
+#define MAIN_H_DEF
+
+#include <string>
+#include <vector>
+#include <math.h>
+#include <stdint.h>
+#include <glad/glad.h>
+#include "Vectors.h"
+#include "Matrices.h"
+#include "lightclusters.h"
+#include "threadpool.h"
+#include "tiny_obj_loader.h"
+#include "meshcache.h"
+#include "transformbatch.h"
+#include "pointcloud.h"
+#include "frustum.h"
+#include "bvh.h"
+#include "trianglemesh.h"
+
+// The types and state of main.cpp that the benchmark suites in benchmark.cpp drive
+
+#ifndef max
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+
+const float PI = (float)atan(1) * 4;
+inline float degree_to_radian(double degree)
+{
+	return (float)(degree * PI / 180);
+}
+
+enum LightMode
+{
+	DirectionalLight = 0,
+	PointLight = 1,
+	SpotLight = 2,
+	ClusteredLights = 3, // every light of scene_lights at once, binned into view-space clusters
+	LightModeCount = 4
+};
+
+// Which lighting a program variant computes
+enum ShadingMode
+{
+	PerVertexShading = 0, // left half of the two-pass view
+	PerPixelShading = 1,  // right half of the two-pass view
+	SideBySideShading = 2 // both, shader.gs emits both halves from one vertex pass
+};
+
+// Materials in one MaterialData binding; a model with more distinct materials binds a page of them at a time
+const int MaterialsPerPage = 64;
+
+// Uniform uploads since the last resetUniformStats(), the uploadUniform*() helpers and the FrameData block
+struct UniformStats
+{
+	int calls;	 // glUniform* calls issued
+	int skipped; // uploads dropped because the value was unchanged
+};
+
+enum MultiDrawSupport
+{
+	NoMultiDraw = 0,	  // no base instance before GL 4.2, drawShapes() only
+	BaseInstanceLoop = 1, // one glDrawElementsInstancedBaseVertexBaseInstance per command
+	IndirectMultiDraw = 2 // one glMultiDrawElementsIndirect per group of commands
+};
+
+struct PhongMaterial
+{
+	Vector3 Ka;
+	Vector3 Kd;
+	Vector3 Ks;
+};
+
+// Interleaved vertex, 36 bytes
+struct Vertex
+{
+	GLfloat position[3];
+	GLfloat normal[3];
+	GLfloat color[3];
+};
+
+// Packed interleaved vertex, 16 bytes
+struct PackedVertex
+{
+	GLushort position[4]; // half float, w unused
+	GLuint normal;		  // signed normalized 2_10_10_10_REV
+	GLubyte color[4];	  // RGBA8
+};
+
+enum VertexLayout
+{
+	InterleavedFloat = 0,
+	InterleavedPacked = 1
+};
+
+typedef struct
+{
+	GLuint vao; // its geometry page's, or the page's instancing VAO of its model
+	GLuint vboTex;
+	int vertex_count;
+	PhongMaterial material;
+	int indexCount;
+	GLenum indexType;
+	int materialIndex; // into the model's distinct materials
+	GLuint m_texture;
+
+	// where allocateShapeGeometry() put the shape
+	int page;				// into geometry_pages
+	GLintptr vertexOffset;	// bytes, interleaved position/normal/color, see vertex_layout
+	GLintptr indexOffset;	// bytes
+	GLint baseVertex;		// vertexOffset in vertices
+	GLuint firstIndex;		// indexOffset in indices of indexType
+	int sceneMaterialIndex; // into the distinct materials of all models, see buildSceneMaterials()
+
+	BoundingVolume bounds; // in model space, computed when the shape was parsed
+} Shape;
+
+// Consecutive instances found visible by cullModel(), drawn by one base-instance draw
+struct InstanceRun
+{
+	GLuint first;
+	GLuint count;
+};
+
+struct model
+{
+	Vector3 position = Vector3(0, 0, 0);
+	Vector3 scale = Vector3(1, 1, 1);
+	Vector3 rotation = Vector3(0, 0, 0); // Euler form
+
+	std::vector<Shape> shapes;
+	std::vector<int> draw_order; // shape indices sorted by material, then VAO, see drawShapes()
+	GLuint material_ubo = 0;	 // the distinct materials of the shapes, MaterialsPerPage per page
+	bool resident = false;		 // GL buffers uploaded, see uploadReadyModels()
+	bool failed = false;		 // its file could not be loaded, the slot stays empty
+
+	// instanced copies, each placed by its own transform on top of position/rotation/scale
+	TransformBatch instances;		   // changes are uploaded by updateModelInstances(), resizes by setModelInstances()
+	GLuint instance_vbo = 0;		   // InstanceData per instance
+	std::vector<GLuint> instance_vaos; // per geometry page, its vertices plus the instance attributes
+	int instance_count = 0;			   // 0: drawn once, without instancing
+
+	// bounds in model space and what the last cullModel() found inside the view frustum
+	BoundingVolume bounds;					// of all shapes, tested under each instance transform
+	PointCloud shape_centers;				// shape bounding spheres as arrays, for Frustum::cullSpheres()
+	std::vector<float> shape_radii;
+	std::vector<uint8_t> shape_visible;		// per shape, of a model drawn once
+	std::vector<uint8_t> instance_visible;	// per instance
+	int visible_instances = 0;
+	std::vector<InstanceRun> instance_runs; // the visible instances when some are culled
+	GLuint run_command_buffer = 0;			// per shape, a DrawElementsIndirectCommand per run, from GL 4.3
+
+	std::vector<TriangleMesh> pick_meshes; // per shape, its triangles for pickAt(), see buildPickMeshesAsync()
+	int pick_serial = 0;				   // the pick mesh build still running for this model, 0 when none
+
+	// the box around every instance in model space, for the scene BVH, see sceneBox()
+	AABB instance_box;
+	bool instance_box_stale = true; // instances moved since it was computed
+};
+
+struct GeometryPoolStats
+{
+	int pages;
+	long long resident_bytes; // page buffers
+	long long used_bytes;	  // allocated to shapes, alignment padding included
+	long long free_bytes;
+	long long largest_free_block;
+	int free_blocks;
+	double fragmentation;	  // 1 - largest free block / free bytes, 0 when the free space is one block
+};
+
+// Layout glMultiDrawElementsIndirect reads from GL_DRAW_INDIRECT_BUFFER, see multi-draw lists and drawShapeRuns()
+struct DrawElementsIndirectCommand
+{
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;	 // in indices of the draw's index type
+	GLint baseVertex;
+	GLuint baseInstance; // the draw's slot in the per-draw attributes
+};
+
+// One shape of one model
+struct ShapeRef
+{
+	int model;
+	int shape;
+};
+
+// A run of commands sharing a geometry page, material page and index type, submitted as one multi-draw
+struct MultiDrawGroup
+{
+	int geometry_page;
+	int page;
+	GLenum index_type;
+	int first, count; // into MultiDrawList::commands
+};
+
+// A list of draws from the geometry pool, filled by setMultiDrawList()
+struct MultiDrawList
+{
+	std::vector<DrawElementsIndirectCommand> commands; // in group order, also kept for the fallback loop
+	std::vector<MultiDrawGroup> groups;
+	std::vector<GLuint> vaos;  // per geometry page, its vertices and indices plus the per-draw attributes
+	GLuint command_buffer = 0; // commands, for glMultiDrawElementsIndirect
+	GLuint instance_vbo = 0;   // InstanceData per draw
+	GLuint material_vbo = 0;   // material index per draw, within its page
+	int materials_generation = -1;
+};
+
+// Picking: the triangle under a window point, found on the CPU through the models' pick meshes
+struct PickHit
+{
+	int model = -1;	   // -1 when the ray hits nothing
+	int shape = -1;
+	int triangle = -1; // first index / 3 in the shape's indices
+	int instance = -1; // of an instanced model
+	float t = 0;	   // along the ray, 0 on the near plane and 1 on the far plane
+	Vector3 point;	   // world space
+};
+
+// CPU side copy of one shape, ready for glBufferData
+struct ShapeData
+{
+	const void *vertices;  // in vertex_layout
+	int vertex_count;
+	const void *indices;
+	int index_count;
+	GLenum index_type;
+	PhongMaterial material;
+	BoundingVolume bounds; // of the positions, in model space
+
+	// backing store when the shape was parsed rather than mapped from a cache
+	std::vector<unsigned char> vertex_storage;
+	std::vector<unsigned char> index_storage;
+};
+
+// CPU side copy of a whole model, either parsed from the .obj or mapped from its mesh cache
+struct ModelData
+{
+	std::vector<ShapeData> shapes;
+	MeshCacheReader cache;
+};
+
+// main.cpp state
+extern int WINDOW_WIDTH;
+extern int WINDOW_HEIGHT;
+extern int program_switches;
+extern int material_binds;
+extern int vao_binds;
+extern bool single_pass_side_by_side;
+extern MultiDrawSupport multi_draw_support;
+extern bool multi_draw;
+extern UniformStats uniform_stats;
+extern std::vector<std::string> filenames;
+extern const std::vector<std::string> default_filenames;
+extern VertexLayout vertex_layout;
+extern std::vector<model> models;
+extern LightMode cur_light_mode;
+extern Matrix4 view_matrix;
+extern Matrix4 project_matrix;
+extern int cur_idx;
+extern std::vector<ClusterLight> scene_lights;
+extern LightClusters light_clusters;
+extern int draw_calls;
+extern int objects_drawn;
+extern int objects_culled;
+extern bool frustum_culling;
+extern bool use_mesh_cache;
+extern int obj_parse_threads;
+extern int failed_models;
+
+// setup
+void loadExtensions(GLADloadproc load);
+void setShaders();
+void initParameter();
+void setupRC();
+void glPrintContextInfo(bool printExtension);
+ThreadPool *framePool();
+void shutdownThreadPools();
+
+// transforms
+Matrix4 translate(Vector3 vec);
+Matrix4 scaling(Vector3 vec);
+Matrix4 rotate(Vector3 vec);
+Matrix4 rotateY(GLfloat val);
+void setGLNormalMatrix(GLfloat *glm, const Matrix4 &m);
+void copyVector3(GLfloat *dst, const Vector3 &v);
+
+// drawing
+int vertexStride(VertexLayout layout);
+GeometryPoolStats geometryPoolStats();
+void updateFrameBlock();
+void scatterLights(int count, std::vector<ClusterLight> &lights);
+void updateLightClusters();
+void useShadingMode(ShadingMode mode);
+void useSideBySideMode(bool single_pass);
+int updateModelInstances(model &m, ThreadPool *pool);
+void setModelInstances(model &m);
+void scatterInstances(int count, TransformBatch &batch, float extent = 1);
+void resetDrawState();
+void bindMaterialPage(GLuint material_ubo, int page);
+void setMaterialIndex(int index);
+void drawShape(const model &m, const Shape &shape);
+void uploadDrawMatrices(const Matrix4 &mvp, const Matrix4 &mv, const GLfloat *normal);
+void setMultiDrawList(MultiDrawList &list, const std::vector<ShapeRef> &draws, TransformBatch &transforms);
+void releaseMultiDrawList(MultiDrawList &list);
+void drawMultiDrawList(const MultiDrawList &list);
+void cullModel(model &m, const Matrix4 &mvp);
+void RenderScene(void);
+PickHit pickAt(float x, float y, int width, int height, bool linear = false);
+
+// loading
+void normalization(tinyobj::attrib_t *attrib);
+void weldShape(const tinyobj::attrib_t *attrib, const tinyobj::shape_t *shape, std::vector<Vertex> &vertices, std::vector<GLuint> &indices);
+int objParseThreads(int concurrent_files);
+bool loadObjFile(const std::string &model_path, int threads, tinyobj::attrib_t &attrib, std::vector<tinyobj::shape_t> &shapes,
+				 std::vector<tinyobj::material_t> &materials, std::string &warn, std::string &err);
+void buildPickMeshes(const ModelData &data, std::vector<TriangleMesh> &meshes);
+bool readModelData(const std::string &model_path, int parse_threads, ModelData &data);
+void uploadModel(const ModelData &data, model &tmp_model);
+void releaseModel(model &m);
+void buildSceneMaterials();
+void LoadModels(std::string model_path);
+void waitForModels();
+void waitForPickMeshes(int index);
+
+#endif
@@ -0,0 +1,224 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <fstream>
+#include "meshcache.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+static size_t alignBlob(size_t offset)
+{
+	return (offset + 15) & ~(size_t)15;
+}
+
+bool getFileStamp(const std::string &path, uint64_t *size, int64_t *time)
+{
+	struct stat info;
+	if (stat(path.c_str(), &info) != 0)
+	{
+		return false;
+	}
+	*size = (uint64_t)info.st_size;
+	*time = (int64_t)info.st_mtime;
+	return true;
+}
+
+MappedFile::MappedFile() : base(NULL), length(0)
+{
+#ifdef _WIN32
+	file = INVALID_HANDLE_VALUE;
+	mapping = NULL;
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool MappedFile::open(const std::string &path)
+{
+	close();
+#ifdef _WIN32
+	file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+	{
+		close();
+		return false;
+	}
+	mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping == NULL)
+	{
+		close();
+		return false;
+	}
+	base = (const unsigned char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	length = (size_t)fileSize.QuadPart;
+#else
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		return false;
+	}
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size == 0)
+	{
+		::close(fd);
+		return false;
+	}
+	void *address = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd); // the mapping keeps the file alive
+	if (address == MAP_FAILED)
+	{
+		return false;
+	}
+	base = (const unsigned char *)address;
+	length = (size_t)info.st_size;
+#endif
+	if (base == NULL)
+	{
+		close();
+		return false;
+	}
+	return true;
+}
+
+void MappedFile::close()
+{
+#ifdef _WIN32
+	if (base)
+		UnmapViewOfFile(base);
+	if (mapping)
+		CloseHandle(mapping);
+	if (file != INVALID_HANDLE_VALUE)
+		CloseHandle(file);
+	mapping = NULL;
+	file = INVALID_HANDLE_VALUE;
+#else
+	if (base)
+		munmap((void *)base, length);
+#endif
+	base = NULL;
+	length = 0;
+}
+
+bool MeshCacheReader::open(const std::string &path, uint32_t vertexLayout, uint32_t vertexStride, uint64_t sourceSize, int64_t sourceTime)
+{
+	if (!file.open(path))
+	{
+		return false;
+	}
+
+	// reject stale, foreign or truncated caches, the caller falls back to parsing the .obj
+	const MeshCacheHeader &h = header();
+	bool valid = file.size() >= sizeof(MeshCacheHeader) &&
+				 h.magic == MESH_CACHE_MAGIC && h.version == MESH_CACHE_VERSION &&
+				 h.vertexLayout == vertexLayout && h.vertexStride == vertexStride &&
+				 h.sourceSize == sourceSize && h.sourceTime == sourceTime &&
+				 file.size() >= sizeof(MeshCacheHeader) + (uint64_t)h.shapeCount * sizeof(MeshCacheShape);
+	for (uint32_t i = 0; valid && i < h.shapeCount; i++)
+	{
+		const MeshCacheShape &s = shape(i);
+		valid = (s.indexSize == 2 || s.indexSize == 4) &&
+				s.vertexOffset + (uint64_t)s.vertexCount * vertexStride <= file.size() &&
+				s.indexOffset + (uint64_t)s.indexCount * s.indexSize <= file.size();
+	}
+	if (!valid)
+	{
+		file.close();
+	}
+	return valid;
+}
+
+void MeshCacheWriter::addShape(const void *vertices, uint32_t vertexCount, uint32_t vertexStride,
+							   const void *indices, uint32_t indexCount, uint32_t indexSize,
+							   const float Ka[3], const float Kd[3], const float Ks[3],
+							   const float boundsMin[3], const float boundsMax[3], const float sphere[4])
+{
+	MeshCacheShape s;
+	memset(&s, 0, sizeof(s));
+	s.vertexCount = vertexCount;
+	s.indexCount = indexCount;
+	s.indexSize = indexSize;
+	memcpy(s.Ka, Ka, sizeof(s.Ka));
+	memcpy(s.Kd, Kd, sizeof(s.Kd));
+	memcpy(s.Ks, Ks, sizeof(s.Ks));
+	memcpy(s.boundsMin, boundsMin, sizeof(s.boundsMin));
+	memcpy(s.boundsMax, boundsMax, sizeof(s.boundsMax));
+	memcpy(s.sphere, sphere, sizeof(s.sphere));
+
+	size_t vertexBytes = (size_t)vertexCount * vertexStride;
+	size_t indexBytes = (size_t)indexCount * indexSize;
+	s.vertexOffset = alignBlob(blobs.size());
+	s.indexOffset = alignBlob(s.vertexOffset + vertexBytes);
+	blobs.resize(alignBlob(s.indexOffset + indexBytes));
+	memcpy(&blobs[s.vertexOffset], vertices, vertexBytes);
+	memcpy(&blobs[s.indexOffset], indices, indexBytes);
+	shapes.push_back(s);
+}
+
+bool MeshCacheWriter::write(const std::string &path, uint32_t vertexLayout, uint32_t vertexStride, uint64_t sourceSize, int64_t sourceTime)
+{
+	MeshCacheHeader h;
+	memset(&h, 0, sizeof(h));
+	h.magic = MESH_CACHE_MAGIC;
+	h.version = MESH_CACHE_VERSION;
+	h.vertexLayout = vertexLayout;
+	h.vertexStride = vertexStride;
+	h.shapeCount = (uint32_t)shapes.size();
+	h.sourceSize = sourceSize;
+	h.sourceTime = sourceTime;
+
+	// blob offsets become absolute
+	uint64_t base = alignBlob(sizeof(MeshCacheHeader) + shapes.size() * sizeof(MeshCacheShape));
+	std::vector<MeshCacheShape> table(shapes);
+	for (size_t i = 0; i < table.size(); i++)
+	{
+		table[i].vertexOffset += base;
+		table[i].indexOffset += base;
+	}
+
+	// write to a temporary name first so a reader never maps a half written cache
+	std::string tmp = path + ".tmp";
+	{
+		std::ofstream out(tmp.c_str(), std::ios::binary | std::ios::trunc);
+		if (!out)
+		{
+			return false;
+		}
+		out.write((const char *)&h, sizeof(h));
+		if (!table.empty())
+		{
+			out.write((const char *)&table[0], table.size() * sizeof(MeshCacheShape));
+		}
+		std::vector<char> padding(base - sizeof(h) - table.size() * sizeof(MeshCacheShape), 0);
+		if (!padding.empty())
+		{
+			out.write(&padding[0], padding.size());
+		}
+		if (!blobs.empty())
+		{
+			out.write((const char *)&blobs[0], blobs.size());
+		}
+		if (!out)
+		{
+			out.close();
+			remove(tmp.c_str());
+			return false;
+		}
+	}
+	remove(path.c_str());
+	return rename(tmp.c_str(), path.c_str()) == 0;
+}
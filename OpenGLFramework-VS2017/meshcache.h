@@ -0,0 +1,110 @@
+#ifndef MESHCACHE_H_DEF
+#define MESHCACHE_H_DEF
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Binary mesh cache written next to a .obj: already normalized, welded and interleaved
+// shape blobs plus their materials, laid out so a memory mapping can be handed to
+// glBufferData directly.
+//
+// File layout (little endian):
+//   MeshCacheHeader
+//   MeshCacheShape[shapeCount]
+//   vertex/index blobs, each 16-byte aligned, referenced by offset from the file start
+
+const uint32_t MESH_CACHE_MAGIC = 0x4843534d; // "MSCH"
+const uint32_t MESH_CACHE_VERSION = 2;
+
+struct MeshCacheHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t vertexLayout; // VertexLayout the blobs were written in
+	uint32_t vertexStride;
+	uint32_t shapeCount;
+	uint32_t reserved;
+	uint64_t sourceSize; // size and modification time of the .obj the cache was built from
+	int64_t sourceTime;
+};
+
+struct MeshCacheShape
+{
+	uint64_t vertexOffset;
+	uint64_t indexOffset;
+	uint32_t vertexCount;
+	uint32_t indexCount;
+	uint32_t indexSize; // 2 or 4 bytes
+	uint32_t reserved;
+	float Ka[3];
+	float Kd[3];
+	float Ks[3];
+	float boundsMin[3]; // axis-aligned box of the vertex positions
+	float boundsMax[3];
+	float sphere[4]; // bounding sphere, center and radius
+	float padding[1];
+};
+
+// Size and modification time of a file, false if it cannot be stat'ed
+bool getFileStamp(const std::string &path, uint64_t *size, int64_t *time);
+
+// Read-only mapping of a whole file
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	bool open(const std::string &path);
+	void close();
+	const unsigned char *data() const { return base; }
+	size_t size() const { return length; }
+
+private:
+	MappedFile(const MappedFile &);
+	MappedFile &operator=(const MappedFile &);
+
+	const unsigned char *base;
+	size_t length;
+#ifdef _WIN32
+	void *file;
+	void *mapping;
+#endif
+};
+
+// Maps a cache file and checks it against the source file and the expected vertex layout
+class MeshCacheReader
+{
+public:
+	bool open(const std::string &path, uint32_t vertexLayout, uint32_t vertexStride, uint64_t sourceSize, int64_t sourceTime);
+	void close() { file.close(); }
+
+	uint32_t shapeCount() const { return header().shapeCount; }
+	const MeshCacheShape &shape(uint32_t i) const { return ((const MeshCacheShape *)(file.data() + sizeof(MeshCacheHeader)))[i]; }
+	const void *vertices(uint32_t i) const { return file.data() + shape(i).vertexOffset; }
+	const void *indices(uint32_t i) const { return file.data() + shape(i).indexOffset; }
+
+private:
+	const MeshCacheHeader &header() const { return *(const MeshCacheHeader *)file.data(); }
+
+	MappedFile file;
+};
+
+// Collects shape blobs and writes them out as a cache file
+class MeshCacheWriter
+{
+public:
+	void addShape(const void *vertices, uint32_t vertexCount, uint32_t vertexStride,
+				  const void *indices, uint32_t indexCount, uint32_t indexSize,
+				  const float Ka[3], const float Kd[3], const float Ks[3],
+				  const float boundsMin[3], const float boundsMax[3], const float sphere[4]);
+	bool write(const std::string &path, uint32_t vertexLayout, uint32_t vertexStride, uint64_t sourceSize, int64_t sourceTime);
+
+private:
+	std::vector<MeshCacheShape> shapes;
+	std::vector<unsigned char> blobs; // offsets in shapes are relative to this until write()
+};
+
+#endif
@@ -0,0 +1,216 @@
+#include "pointcloud.h"
+
+void PointCloud::resize(size_t count)
+{
+	xs.resize(count);
+	ys.resize(count);
+	zs.resize(count);
+}
+
+void PointCloud::set(size_t i, const Vector3 &v)
+{
+	xs[i] = v.x;
+	ys[i] = v.y;
+	zs[i] = v.z;
+}
+
+void PointCloud::assign(const float *xyz, size_t count)
+{
+	resize(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		xs[i] = xyz[3 * i];
+		ys[i] = xyz[3 * i + 1];
+		zs[i] = xyz[3 * i + 2];
+	}
+}
+
+void PointCloud::storeInterleaved(float *xyz) const
+{
+	for (size_t i = 0; i < xs.size(); i++)
+	{
+		xyz[3 * i] = xs[i];
+		xyz[3 * i + 1] = ys[i];
+		xyz[3 * i + 2] = zs[i];
+	}
+}
+
+// Rows 0-2 of m applied to every vector; w is 1 for points and 0 for directions.
+// Sums run in the scalar order, ((m0*x + m1*y) + m2*z) + m3, in both paths.
+static void transformRows(const Matrix4 &m, const PointCloud &src, PointCloud &dst, bool points)
+{
+	const float *a = m.get();
+	size_t count = src.size();
+	dst.resize(count);
+	const float *x = src.x(), *y = src.y(), *z = src.z();
+	float *out[3] = {dst.x(), dst.y(), dst.z()};
+
+	size_t i = 0;
+#ifdef MATRICES_SSE
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 vx = _mm_loadu_ps(x + i), vy = _mm_loadu_ps(y + i), vz = _mm_loadu_ps(z + i);
+		for (int row = 0; row < 3; row++)
+		{
+			const float *r = a + 4 * row;
+			__m128 o = _mm_mul_ps(_mm_set1_ps(r[0]), vx);
+			o = _mm_add_ps(o, _mm_mul_ps(_mm_set1_ps(r[1]), vy));
+			o = _mm_add_ps(o, _mm_mul_ps(_mm_set1_ps(r[2]), vz));
+			if (points)
+			{
+				o = _mm_add_ps(o, _mm_set1_ps(r[3]));
+			}
+			_mm_storeu_ps(out[row] + i, o);
+		}
+	}
+#endif
+	for (; i < count; i++)
+	{
+		float vx = x[i], vy = y[i], vz = z[i];
+		for (int row = 0; row < 3; row++)
+		{
+			const float *r = a + 4 * row;
+			float o = r[0] * vx + r[1] * vy + r[2] * vz;
+			out[row][i] = points ? o + r[3] : o;
+		}
+	}
+}
+
+void transformPoints(const Matrix4 &m, const PointCloud &src, PointCloud &dst)
+{
+	transformRows(m, src, dst, true);
+}
+
+void transformDirections(const Matrix4 &m, const PointCloud &src, PointCloud &dst)
+{
+	transformRows(m, src, dst, false);
+}
+
+void normalize(PointCloud &cloud)
+{
+	size_t count = cloud.size();
+	float *x = cloud.x(), *y = cloud.y(), *z = cloud.z();
+
+	size_t i = 0;
+#ifdef MATRICES_SSE
+	const __m128 one = _mm_set1_ps(1.0f);
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 vx = _mm_loadu_ps(x + i), vy = _mm_loadu_ps(y + i), vz = _mm_loadu_ps(z + i);
+		__m128 xxyyzz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), _mm_mul_ps(vz, vz));
+		// a true divide and square root rather than rsqrtps, to match Vector3::normalize()
+		__m128 inv_length = _mm_div_ps(one, _mm_sqrt_ps(xxyyzz));
+		_mm_storeu_ps(x + i, _mm_mul_ps(vx, inv_length));
+		_mm_storeu_ps(y + i, _mm_mul_ps(vy, inv_length));
+		_mm_storeu_ps(z + i, _mm_mul_ps(vz, inv_length));
+	}
+#endif
+	for (; i < count; i++)
+	{
+		float inv_length = 1.0f / sqrtf(x[i] * x[i] + y[i] * y[i] + z[i] * z[i]);
+		x[i] *= inv_length;
+		y[i] *= inv_length;
+		z[i] *= inv_length;
+	}
+}
+
+bool bounds(const PointCloud &cloud, Vector3 &lo, Vector3 &hi)
+{
+	size_t count = cloud.size();
+	if (count == 0)
+	{
+		return false;
+	}
+
+	const float *axis[3] = {cloud.x(), cloud.y(), cloud.z()};
+	float axis_lo[3], axis_hi[3];
+	for (int k = 0; k < 3; k++)
+	{
+		const float *v = axis[k];
+		float l = v[0], h = v[0];
+		size_t i = 0;
+#ifdef MATRICES_SSE
+		if (count >= 4)
+		{
+			__m128 vl = _mm_loadu_ps(v), vh = vl;
+			for (i = 4; i + 4 <= count; i += 4)
+			{
+				__m128 c = _mm_loadu_ps(v + i);
+				vl = _mm_min_ps(vl, c);
+				vh = _mm_max_ps(vh, c);
+			}
+			float lanes_lo[4], lanes_hi[4];
+			_mm_storeu_ps(lanes_lo, vl);
+			_mm_storeu_ps(lanes_hi, vh);
+			for (int lane = 0; lane < 4; lane++)
+			{
+				l = lanes_lo[lane] < l ? lanes_lo[lane] : l;
+				h = lanes_hi[lane] > h ? lanes_hi[lane] : h;
+			}
+		}
+#endif
+		for (; i < count; i++)
+		{
+			l = v[i] < l ? v[i] : l;
+			h = v[i] > h ? v[i] : h;
+		}
+		axis_lo[k] = l;
+		axis_hi[k] = h;
+	}
+	lo = Vector3(axis_lo[0], axis_lo[1], axis_lo[2]);
+	hi = Vector3(axis_hi[0], axis_hi[1], axis_hi[2]);
+	return true;
+}
+
+void dot(const PointCloud &a, const PointCloud &b, float *out)
+{
+	size_t count = a.size();
+	const float *ax = a.x(), *ay = a.y(), *az = a.z();
+	const float *bx = b.x(), *by = b.y(), *bz = b.z();
+
+	size_t i = 0;
+#ifdef MATRICES_SSE
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 d = _mm_mul_ps(_mm_loadu_ps(ax + i), _mm_loadu_ps(bx + i));
+		d = _mm_add_ps(d, _mm_mul_ps(_mm_loadu_ps(ay + i), _mm_loadu_ps(by + i)));
+		d = _mm_add_ps(d, _mm_mul_ps(_mm_loadu_ps(az + i), _mm_loadu_ps(bz + i)));
+		_mm_storeu_ps(out + i, d);
+	}
+#endif
+	for (; i < count; i++)
+	{
+		out[i] = ax[i] * bx[i] + ay[i] * by[i] + az[i] * bz[i];
+	}
+}
+
+void cross(const PointCloud &a, const PointCloud &b, PointCloud &out)
+{
+	size_t count = a.size();
+	out.resize(count);
+	const float *ax = a.x(), *ay = a.y(), *az = a.z();
+	const float *bx = b.x(), *by = b.y(), *bz = b.z();
+	float *ox = out.x(), *oy = out.y(), *oz = out.z();
+
+	size_t i = 0;
+#ifdef MATRICES_SSE
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 vax = _mm_loadu_ps(ax + i), vay = _mm_loadu_ps(ay + i), vaz = _mm_loadu_ps(az + i);
+		__m128 vbx = _mm_loadu_ps(bx + i), vby = _mm_loadu_ps(by + i), vbz = _mm_loadu_ps(bz + i);
+		// all six loads first, out may be a or b
+		_mm_storeu_ps(ox + i, _mm_sub_ps(_mm_mul_ps(vay, vbz), _mm_mul_ps(vaz, vby)));
+		_mm_storeu_ps(oy + i, _mm_sub_ps(_mm_mul_ps(vaz, vbx), _mm_mul_ps(vax, vbz)));
+		_mm_storeu_ps(oz + i, _mm_sub_ps(_mm_mul_ps(vax, vby), _mm_mul_ps(vay, vbx)));
+	}
+#endif
+	for (; i < count; i++)
+	{
+		float x = ay[i] * bz[i] - az[i] * by[i];
+		float y = az[i] * bx[i] - ax[i] * bz[i];
+		float z = ax[i] * by[i] - ay[i] * bx[i];
+		ox[i] = x;
+		oy[i] = y;
+		oz[i] = z;
+	}
+}
@@ -0,0 +1,55 @@
+#ifndef POINTCLOUD_H_DEF
+#define POINTCLOUD_H_DEF
+
+#include <stddef.h>
+#include <vector>
+#include "Vectors.h"
+#include "Matrices.h"
+
+// Structure-of-arrays Vector3 stream: x, y and z each in a contiguous array of their own, so the
+// batch kernels below handle four vectors per SSE step with no shuffling (see MATRICES_SSE).
+// Every kernel gives the same bits as the matching Vector3/Matrix4 operation applied one vector at a time.
+class PointCloud
+{
+public:
+	PointCloud() {}
+	explicit PointCloud(size_t count) { resize(count); }
+
+	void resize(size_t count);
+	void clear() { resize(0); }
+	size_t size() const { return xs.size(); }
+
+	Vector3 get(size_t i) const { return Vector3(xs[i], ys[i], zs[i]); }
+	void set(size_t i, const Vector3 &v);
+
+	// convert from and to interleaved xyz triples, e.g. tinyobj's attrib.vertices
+	void assign(const float *xyz, size_t count);
+	void storeInterleaved(float *xyz) const;
+
+	float *x() { return xs.data(); }
+	float *y() { return ys.data(); }
+	float *z() { return zs.data(); }
+	const float *x() const { return xs.data(); }
+	const float *y() const { return ys.data(); }
+	const float *z() const { return zs.data(); }
+
+private:
+	std::vector<float> xs, ys, zs;
+};
+
+// Batch kernels. Outputs are resized to the input size and may be one of the inputs.
+
+// dst[i] = M * (src[i], 1) without the w row
+void transformPoints(const Matrix4 &m, const PointCloud &src, PointCloud &dst);
+// dst[i] = M * src[i], upper 3x3 only (directions, normals under a rigid transform)
+void transformDirections(const Matrix4 &m, const PointCloud &src, PointCloud &dst);
+// cloud[i].normalize()
+void normalize(PointCloud &cloud);
+// per-axis minimum and maximum, false for an empty cloud
+bool bounds(const PointCloud &cloud, Vector3 &lo, Vector3 &hi);
+// out[i] = a[i].dot(b[i])
+void dot(const PointCloud &a, const PointCloud &b, float *out);
+// out[i] = a[i].cross(b[i])
+void cross(const PointCloud &a, const PointCloud &b, PointCloud &out);
+
+#endif
@@ -1,37 +1,25 @@
 #version 330 core
 
 out vec4 FragColor;
-in vec3 vertex_color;
-in vec3 vertex_normal;
-in vec3 vertex_view;
-
-struct PhongMaterial
+in VertexData
 {
-	vec3 Ka;
-	vec3 Kd;
-	vec3 Ks;
+	vec3 vertex_color;
+	vec3 vertex_normal;
+	vec3 vertex_view;
+	flat int material_index; // per draw, into materials
 };
 
-struct Light
-{
-	vec3 position;
-	vec3 spotDirection;
-	vec3 ambient;
-	vec3 diffuse;
-	vec3 specular;
-	float spotExponent;
-	float spotCutoff;
-	float constantAttenuation;
-	float linearAttenuation;
-	float quadraticAttenuation;
-};
+// materials, FrameData and clusteredLighting() come from lighting.glsl, see compileShader()
+#define material materials[material_index]
 
-uniform int cur_light_mode;
-uniform mat4 view_matrix;
-uniform Light light[3];
-uniform PhongMaterial material;
-uniform float shininess;
-uniform int is_per_pixel_lighting;
+// Specialized by compileShader() defines instead of runtime uniforms:
+// LIGHT_MODE 0/1/2 picks the directional, point or spot light, 3 the clustered lights,
+// PER_VERTEX_LIGHTING / PER_PIXEL_LIGHTING say which colors this variant produces,
+// SIDE_BY_SIDE that shader.gs draws both halves in one pass.
+#ifdef SIDE_BY_SIDE
+// from shader.gs: 0 in the left half, 1 in the right half
+flat in int side;
+#endif
 
 vec4 lightInView;
 vec3 L, H;
@@ -39,64 +27,69 @@ vec3 L, H;
 void main()
 {
 	// [TODO]
+	vec3 frag_color;
+#ifdef PER_PIXEL_LIGHTING
 	vec3 N = normalize(vertex_normal);
 	vec3 V = -vertex_view;
-	vec3 frag_color;
 
+#if LIGHT_MODE == 0
 	// Directional light
-	if (cur_light_mode == 0)
-	{
-		lightInView = view_matrix * vec4(light[0].position, 1.0f);
-		L = normalize(lightInView.xyz + V);
-		H = normalize(L + V);
-
-		vec3 ambient = light[0].ambient * material.Ka;
-		vec3 diffuse = light[0].diffuse * max(dot(L, N), 0.0) * material.Kd;
-		vec3 specular = light[0].specular * pow(max(dot(H, N), 0.0), shininess) * material.Ks;
+	lightInView = view_matrix * vec4(light[0].position, 1.0f);
+	L = normalize(lightInView.xyz + V);
+	H = normalize(L + V);
 
-		frag_color = ambient + diffuse + specular;
-	}
+	vec3 ambient = light[0].ambient * material.Ka;
+	vec3 diffuse = light[0].diffuse * max(dot(L, N), 0.0) * material.Kd;
+	vec3 specular = light[0].specular * pow(max(dot(H, N), 0.0), shininess) * material.Ks;
 
+	frag_color = ambient + diffuse + specular;
+#elif LIGHT_MODE == 1
 	// Point light
-	if (cur_light_mode == 1)
-	{
-		lightInView = view_matrix * vec4(light[1].position, 1.0f);
-		L = normalize(lightInView.xyz + V);
-		H = normalize(L + V);
-
-		float dis = length(lightInView.xyz + V);
-		float attenuation = light[1].constantAttenuation +
-							light[1].linearAttenuation * dis +
-							light[1].quadraticAttenuation * pow(dis, 2);
-		float f = 1.0f / attenuation;
-
-		vec3 ambient = light[1].ambient * material.Ka;
-		vec3 diffuse = light[1].diffuse * max(dot(L, N), 0.0) * material.Kd;
-		vec3 specular = light[1].specular * pow(max(dot(H, N), 0.0), shininess) * material.Ks;
-
-		frag_color = ambient + f * (diffuse + specular);
-	}
-
+	lightInView = view_matrix * vec4(light[1].position, 1.0f);
+	L = normalize(lightInView.xyz + V);
+	H = normalize(L + V);
+
+	float dis = length(lightInView.xyz + V);
+	float attenuation = light[1].constantAttenuation +
+						light[1].linearAttenuation * dis +
+						light[1].quadraticAttenuation * pow(dis, 2);
+	float f = 1.0f / attenuation;
+
+	vec3 ambient = light[1].ambient * material.Ka;
+	vec3 diffuse = light[1].diffuse * max(dot(L, N), 0.0) * material.Kd;
+	vec3 specular = light[1].specular * pow(max(dot(H, N), 0.0), shininess) * material.Ks;
+
+	frag_color = ambient + f * (diffuse + specular);
+#elif LIGHT_MODE == 2
 	// Spot light
-	if (cur_light_mode == 2)
-	{
-		lightInView = view_matrix * vec4(light[2].position, 1.0f);
-		L = normalize(lightInView.xyz + V);
-		H = normalize(L + V);
-
-		float spot = dot(-L, normalize(light[2].spotDirection.xyz));
-		float dis = length(lightInView.xyz - V);
-		float attenuation = light[2].constantAttenuation +
-							light[2].linearAttenuation * dis +
-							light[2].quadraticAttenuation * pow(dis, 2);
-		float f = 1.0f / attenuation;
-
-		vec3 ambient = light[2].ambient * material.Ka;
-		vec3 diffuse = light[2].diffuse * max(dot(L, N), 0.0) * material.Kd;
-		vec3 specular = light[2].specular * pow(max(dot(H, N), 0.0), shininess) * material.Ks;
-
-		frag_color = ambient + f * (spot < light[2].spotCutoff ? 0 : pow(max(spot, 0), light[2].spotExponent)) * (diffuse + specular);
-	}
-
-	FragColor = (is_per_pixel_lighting == 0) ? vec4(vertex_color, 1.0f) : vec4(frag_color, 1.0f);
+	lightInView = view_matrix * vec4(light[2].position, 1.0f);
+	L = normalize(lightInView.xyz + V);
+	H = normalize(L + V);
+
+	float spot = dot(-L, normalize(light[2].spotDirection.xyz));
+	float dis = length(lightInView.xyz - V);
+	float attenuation = light[2].constantAttenuation +
+						light[2].linearAttenuation * dis +
+						light[2].quadraticAttenuation * pow(dis, 2);
+	float f = 1.0f / attenuation;
+
+	vec3 ambient = light[2].ambient * material.Ka;
+	vec3 diffuse = light[2].diffuse * max(dot(L, N), 0.0) * material.Kd;
+	vec3 specular = light[2].specular * pow(max(dot(H, N), 0.0), shininess) * material.Ks;
+
+	frag_color = ambient + f * (spot < light[2].spotCutoff ? 0 : pow(max(spot, 0), light[2].spotExponent)) * (diffuse + specular);
+#elif LIGHT_MODE == 3
+	// Clustered lights
+	frag_color = clusteredLighting(vertex_view, N, material);
+#endif
+#endif
+
+#if defined(SIDE_BY_SIDE)
+	// flat per triangle, so every fragment of a primitive takes the same side
+	FragColor = (side == 0) ? vec4(vertex_color, 1.0f) : vec4(frag_color, 1.0f);
+#elif defined(PER_PIXEL_LIGHTING)
+	FragColor = vec4(frag_color, 1.0f);
+#else
+	FragColor = vec4(vertex_color, 1.0f);
+#endif
 }
@@ -0,0 +1,51 @@
+#version 330 core
+
+// Single-pass side-by-side view. The vertex shader runs once per vertex and every triangle is
+// emitted twice into one full-window viewport: squeezed into the left half for per-vertex
+// lighting and into the right half for per-pixel lighting.
+layout(triangles) in;
+layout(triangle_strip, max_vertices = 6) out;
+
+in VertexData
+{
+	vec3 vertex_color;
+	vec3 vertex_normal;
+	vec3 vertex_view;
+	flat int material_index;
+} vertex_in[];
+
+out VertexData
+{
+	vec3 vertex_color;
+	vec3 vertex_normal;
+	vec3 vertex_view;
+	flat int material_index;
+};
+
+flat out int side;
+
+void main()
+{
+	for (int s = 0; s < 2; s++)
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			vec4 p = gl_in[i].gl_Position;
+
+			// clip to -w <= x <= w, as the half's own viewport would
+			gl_ClipDistance[0] = p.w + p.x;
+			gl_ClipDistance[1] = p.w - p.x;
+
+			// map x from [-w, w] to [-w, 0] (left) or [0, w] (right)
+			gl_Position = vec4(0.5 * p.x + (s == 0 ? -0.5 : 0.5) * p.w, p.yzw);
+
+			vertex_color = vertex_in[i].vertex_color;
+			vertex_normal = vertex_in[i].vertex_normal;
+			vertex_view = vertex_in[i].vertex_view;
+			material_index = vertex_in[i].material_index;
+			side = s;
+			EmitVertex();
+		}
+		EndPrimitive();
+	}
+}
@@ -11,7 +11,11 @@ char *textFileRead(const char *fn) {
 	int count = 0;
 
 	if (fn != NULL) {
+#ifdef _WIN32
         auto err = fopen_s(&fp, fn, "rt");
+#else
+        fp = fopen(fn, "rt");
+#endif
 
 		if (fp != NULL) {
 			fseek(fp, 0, SEEK_END);
@@ -38,7 +42,11 @@ int textFileWrite(char *fn, char *s) {
 	int status = 0;
 
 	if (fn != NULL) {
+#ifdef _WIN32
 		auto err = fopen_s(&fp, fn, "rt");
+#else
+		fp = fopen(fn, "rt");
+#endif
         
 		if (fp != NULL) {
 			if (fwrite(s, sizeof(char), strlen(s), fp) == strlen(s))
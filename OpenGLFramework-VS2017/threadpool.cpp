@@ -0,0 +1,75 @@
+#include "threadpool.h"
+
+ThreadPool::ThreadPool(int threads) : busy(0), stopping(false)
+{
+	if (threads <= 0)
+	{
+		threads = (int)std::thread::hardware_concurrency() - 1;
+		if (threads < 1)
+		{
+			threads = 1;
+		}
+	}
+	for (int i = 0; i < threads; i++)
+	{
+		workers.push_back(std::thread(&ThreadPool::run, this));
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	task_available.notify_all();
+	for (size_t i = 0; i < workers.size(); i++)
+	{
+		workers[i].join();
+	}
+}
+
+void ThreadPool::submit(const std::function<void()> &task)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		tasks.push_back(task);
+	}
+	task_available.notify_one();
+}
+
+void ThreadPool::wait()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	all_done.wait(lock, [this] { return tasks.empty() && busy == 0; });
+}
+
+void ThreadPool::run()
+{
+	for (;;)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			task_available.wait(lock, [this] { return stopping || !tasks.empty(); });
+			if (tasks.empty())
+			{
+				return; // stopping and drained
+			}
+			task = tasks.front();
+			tasks.pop_front();
+			busy++;
+		}
+
+		task();
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			busy--;
+			if (tasks.empty() && busy == 0)
+			{
+				all_done.notify_all();
+			}
+		}
+	}
+}
@@ -0,0 +1,37 @@
+#ifndef THREADPOOL_H_DEF
+#define THREADPOOL_H_DEF
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads pulling tasks from a shared FIFO
+class ThreadPool
+{
+public:
+	explicit ThreadPool(int threads = 0); // 0: one per hardware thread, minus the caller's
+	~ThreadPool();						  // finishes the queued tasks, then joins
+
+	void submit(const std::function<void()> &task);
+	void wait(); // block until every submitted task has finished
+	int size() const { return (int)workers.size(); }
+
+private:
+	ThreadPool(const ThreadPool &);
+	ThreadPool &operator=(const ThreadPool &);
+
+	void run();
+
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> tasks;
+	std::mutex mutex;
+	std::condition_variable task_available;
+	std::condition_variable all_done;
+	int busy;
+	bool stopping;
+};
+
+#endif
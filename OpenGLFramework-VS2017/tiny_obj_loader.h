@@ -491,7 +491,14 @@ struct ObjReaderConfig {
   ///
   std::string mtl_search_path;
 
-  ObjReaderConfig() : triangulate(true), vertex_color(true) {}
+  ///
+  /// Number of threads used to parse the .obj text.
+  /// 1 = serial(default), 0 = one per hardware thread.
+  /// The parsed data is the same for any value.
+  ///
+  int num_threads;
+
+  ObjReaderConfig() : triangulate(true), vertex_color(true), num_threads(1) {}
 };
 
 ///
@@ -596,6 +603,21 @@ bool LoadObj(attrib_t *attrib, std::vector<shape_t> *shapes,
              MaterialReader *readMatFn = NULL, bool triangulate = true,
              bool default_vcols_fallback = true);
 
+/// Loads object from a memory buffer(e.g. a memory mapped file), uses
+/// `readMatFn` to retrieve std::istream for materials.
+/// `num_threads` > 1 splits the text into line-aligned chunks and parses
+/// their v/vn/vt/f lines concurrently; 0 = one thread per hardware thread.
+/// The parsed data is the same as the serial parse of the same text.
+/// Returns true when loading .obj become success.
+/// Returns warning message into `warn`, and error message into `err`
+bool LoadObjFromBuffer(attrib_t *attrib, std::vector<shape_t> *shapes,
+                       std::vector<material_t> *materials, std::string *warn,
+                       std::string *err, const char *buf, size_t len,
+                       MaterialReader *readMatFn = NULL,
+                       bool triangulate = true,
+                       bool default_vcols_fallback = true,
+                       int num_threads = 1);
+
 /// Loads materials into std::map
 void LoadMtl(std::map<std::string, int> *material_map,
              std::vector<material_t> *materials, std::istream *inStream,
@@ -625,12 +647,18 @@ bool ParseTextureNameAndOption(std::string *texname, texture_option_t *texopt,
 #include <cstddef>
 #include <cstdlib>
 #include <cstring>
+#include <iterator>
 #include <limits>
 #include <utility>
 
 #include <fstream>
 #include <sstream>
 
+#if __cplusplus > 199711L || (defined(_MSVC_LANG) && _MSVC_LANG > 199711L)
+#define TINYOBJLOADER_HAS_THREADS
+#include <thread>
+#endif
+
 namespace tinyobj {
 
 MaterialReader::~MaterialReader() {}
@@ -2170,13 +2198,8 @@ bool LoadObj(attrib_t *attrib, std::vector<shape_t> *shapes,
                  trianglulate, default_vcols_fallback);
 }
 
-bool LoadObj(attrib_t *attrib, std::vector<shape_t> *shapes,
-             std::vector<material_t> *materials, std::string *warn,
-             std::string *err, std::istream *inStream,
-             MaterialReader *readMatFn /*= NULL*/, bool triangulate,
-             bool default_vcols_fallback) {
-  std::stringstream errss;
-
+// Parser state of LoadObj(), shared by the serial and the parallel paths.
+struct obj_parse_state_t {
   std::vector<real_t> v;
   std::vector<real_t> vn;
   std::vector<real_t> vt;
@@ -2187,497 +2210,947 @@ bool LoadObj(attrib_t *attrib, std::vector<shape_t> *shapes,
 
   // material
   std::map<std::string, int> material_map;
-  int material = -1;
+  int material;
 
   // smoothing group id
-  unsigned int current_smoothing_id =
-      0;  // Initial value. 0 means no smoothing.
+  unsigned int current_smoothing_id;
+
+  // Number of v/vn/vt lines before the current line. Relative(negative)
+  // indices are resolved against these.
+  int num_v;
+  int num_vn;
+  int num_vt;
 
-  int greatest_v_idx = -1;
-  int greatest_vn_idx = -1;
-  int greatest_vt_idx = -1;
+  int greatest_v_idx;
+  int greatest_vn_idx;
+  int greatest_vt_idx;
 
   shape_t shape;
 
-  bool found_all_colors = true;
+  bool found_all_colors;
+
+  std::vector<shape_t> *shapes;
+  std::vector<material_t> *materials;
+  std::string *warn;
+  std::string *err;
+  MaterialReader *readMatFn;
+  bool triangulate;
+  bool default_vcols_fallback;
+
+  obj_parse_state_t(std::vector<shape_t> *_shapes,
+                    std::vector<material_t> *_materials, std::string *_warn,
+                    std::string *_err, MaterialReader *_readMatFn,
+                    bool _triangulate, bool _default_vcols_fallback)
+      : material(-1),
+        current_smoothing_id(0),  // Initial value. 0 means no smoothing.
+        num_v(0),
+        num_vn(0),
+        num_vt(0),
+        greatest_v_idx(-1),
+        greatest_vn_idx(-1),
+        greatest_vt_idx(-1),
+        found_all_colors(true),
+        shapes(_shapes),
+        materials(_materials),
+        warn(_warn),
+        err(_err),
+        readMatFn(_readMatFn),
+        triangulate(_triangulate),
+        default_vcols_fallback(_default_vcols_fallback) {}
+};
 
-  size_t line_num = 0;
-  std::string linebuf;
-  while (inStream->peek() != -1) {
-    safeGetline(*inStream, linebuf);
+// Parses the vertex indices of a `f' line. `token' points past "f ".
+static bool parseFace(const char *token, int vsize, int vnsize, int vtsize,
+                      face_t *face, int *greatest_v_idx, int *greatest_vn_idx,
+                      int *greatest_vt_idx) {
+  token += strspn(token, " \t");
 
-    line_num++;
+  face->vertex_indices.reserve(3);
 
-    // Trim newline '\r\n' or '\n'
-    if (linebuf.size() > 0) {
-      if (linebuf[linebuf.size() - 1] == '\n')
-        linebuf.erase(linebuf.size() - 1);
-    }
-    if (linebuf.size() > 0) {
-      if (linebuf[linebuf.size() - 1] == '\r')
-        linebuf.erase(linebuf.size() - 1);
+  while (!IS_NEW_LINE(token[0])) {
+    vertex_index_t vi;
+    if (!parseTriple(&token, vsize, vnsize, vtsize, &vi)) {
+      return false;
     }
 
-    // Skip if empty line.
-    if (linebuf.empty()) {
-      continue;
-    }
+    (*greatest_v_idx) =
+        (*greatest_v_idx) > vi.v_idx ? (*greatest_v_idx) : vi.v_idx;
+    (*greatest_vn_idx) =
+        (*greatest_vn_idx) > vi.vn_idx ? (*greatest_vn_idx) : vi.vn_idx;
+    (*greatest_vt_idx) =
+        (*greatest_vt_idx) > vi.vt_idx ? (*greatest_vt_idx) : vi.vt_idx;
 
-    // Skip leading space.
-    const char *token = linebuf.c_str();
-    token += strspn(token, " \t");
+    face->vertex_indices.push_back(vi);
+    size_t n = strspn(token, " \t\r");
+    token += n;
+  }
 
-    assert(token);
-    if (token[0] == '\0') continue;  // empty line
+  return true;
+}
 
-    if (token[0] == '#') continue;  // comment line
+static void reportFaceError(std::string *err, size_t line_num) {
+  if (err) {
+    std::stringstream ss;
+    ss << "Failed parse `f' line(e.g. zero value for face index. line "
+       << line_num << ".)\n";
+    (*err) += ss.str();
+  }
+}
 
-    // vertex
-    if (token[0] == 'v' && IS_SPACE((token[1]))) {
-      token += 2;
-      real_t x, y, z;
-      real_t r, g, b;
+// Parses one line of .obj text. `token' points past the leading spaces.
+// Returns false on a parse error.
+static bool parseObjLine(obj_parse_state_t *st, const char *token,
+                         size_t line_num) {
+  assert(token);
+  if (token[0] == '\0') return true;  // empty line
 
-      found_all_colors &= parseVertexWithColor(&x, &y, &z, &r, &g, &b, &token);
+  if (token[0] == '#') return true;  // comment line
 
-      v.push_back(x);
-      v.push_back(y);
-      v.push_back(z);
+  // vertex
+  if (token[0] == 'v' && IS_SPACE((token[1]))) {
+    token += 2;
+    real_t x, y, z;
+    real_t r, g, b;
 
-      if (found_all_colors || default_vcols_fallback) {
-        vc.push_back(r);
-        vc.push_back(g);
-        vc.push_back(b);
-      }
+    st->found_all_colors &=
+        parseVertexWithColor(&x, &y, &z, &r, &g, &b, &token);
 
-      continue;
-    }
+    st->v.push_back(x);
+    st->v.push_back(y);
+    st->v.push_back(z);
 
-    // normal
-    if (token[0] == 'v' && token[1] == 'n' && IS_SPACE((token[2]))) {
-      token += 3;
-      real_t x, y, z;
-      parseReal3(&x, &y, &z, &token);
-      vn.push_back(x);
-      vn.push_back(y);
-      vn.push_back(z);
-      continue;
+    if (st->found_all_colors || st->default_vcols_fallback) {
+      st->vc.push_back(r);
+      st->vc.push_back(g);
+      st->vc.push_back(b);
     }
 
-    // texcoord
-    if (token[0] == 'v' && token[1] == 't' && IS_SPACE((token[2]))) {
-      token += 3;
-      real_t x, y;
-      parseReal2(&x, &y, &token);
-      vt.push_back(x);
-      vt.push_back(y);
-      continue;
-    }
+    st->num_v++;
+    return true;
+  }
 
-    // line
-    if (token[0] == 'l' && IS_SPACE((token[1]))) {
-      token += 2;
+  // normal
+  if (token[0] == 'v' && token[1] == 'n' && IS_SPACE((token[2]))) {
+    token += 3;
+    real_t x, y, z;
+    parseReal3(&x, &y, &z, &token);
+    st->vn.push_back(x);
+    st->vn.push_back(y);
+    st->vn.push_back(z);
+    st->num_vn++;
+    return true;
+  }
 
-      __line_t line;
+  // texcoord
+  if (token[0] == 'v' && token[1] == 't' && IS_SPACE((token[2]))) {
+    token += 3;
+    real_t x, y;
+    parseReal2(&x, &y, &token);
+    st->vt.push_back(x);
+    st->vt.push_back(y);
+    st->num_vt++;
+    return true;
+  }
 
-      while (!IS_NEW_LINE(token[0])) {
-        vertex_index_t vi;
-        if (!parseTriple(&token, static_cast<int>(v.size() / 3),
-                         static_cast<int>(vn.size() / 3),
-                         static_cast<int>(vt.size() / 2), &vi)) {
-          if (err) {
-            std::stringstream ss;
-            ss << "Failed parse `l' line(e.g. zero value for vertex index. "
-                  "line "
-               << line_num << ".)\n";
-            (*err) += ss.str();
-          }
-          return false;
-        }
+  // line
+  if (token[0] == 'l' && IS_SPACE((token[1]))) {
+    token += 2;
 
-        line.vertex_indices.push_back(vi);
+    __line_t line;
 
-        size_t n = strspn(token, " \t\r");
-        token += n;
+    while (!IS_NEW_LINE(token[0])) {
+      vertex_index_t vi;
+      if (!parseTriple(&token, st->num_v, st->num_vn, st->num_vt, &vi)) {
+        if (st->err) {
+          std::stringstream ss;
+          ss << "Failed parse `l' line(e.g. zero value for vertex index. "
+                "line "
+             << line_num << ".)\n";
+          (*st->err) += ss.str();
+        }
+        return false;
       }
 
-      prim_group.lineGroup.push_back(line);
+      line.vertex_indices.push_back(vi);
 
-      continue;
+      size_t n = strspn(token, " \t\r");
+      token += n;
     }
 
-    // points
-    if (token[0] == 'p' && IS_SPACE((token[1]))) {
-      token += 2;
+    st->prim_group.lineGroup.push_back(line);
 
-      __points_t pts;
+    return true;
+  }
 
-      while (!IS_NEW_LINE(token[0])) {
-        vertex_index_t vi;
-        if (!parseTriple(&token, static_cast<int>(v.size() / 3),
-                         static_cast<int>(vn.size() / 3),
-                         static_cast<int>(vt.size() / 2), &vi)) {
-          if (err) {
-            std::stringstream ss;
-            ss << "Failed parse `p' line(e.g. zero value for vertex index. "
-                  "line "
-               << line_num << ".)\n";
-            (*err) += ss.str();
-          }
-          return false;
-        }
+  // points
+  if (token[0] == 'p' && IS_SPACE((token[1]))) {
+    token += 2;
 
-        pts.vertex_indices.push_back(vi);
+    __points_t pts;
 
-        size_t n = strspn(token, " \t\r");
-        token += n;
+    while (!IS_NEW_LINE(token[0])) {
+      vertex_index_t vi;
+      if (!parseTriple(&token, st->num_v, st->num_vn, st->num_vt, &vi)) {
+        if (st->err) {
+          std::stringstream ss;
+          ss << "Failed parse `p' line(e.g. zero value for vertex index. "
+                "line "
+             << line_num << ".)\n";
+          (*st->err) += ss.str();
+        }
+        return false;
       }
 
-      prim_group.pointsGroup.push_back(pts);
+      pts.vertex_indices.push_back(vi);
 
-      continue;
+      size_t n = strspn(token, " \t\r");
+      token += n;
     }
 
-    // face
-    if (token[0] == 'f' && IS_SPACE((token[1]))) {
-      token += 2;
-      token += strspn(token, " \t");
+    st->prim_group.pointsGroup.push_back(pts);
 
-      face_t face;
-
-      face.smoothing_group_id = current_smoothing_id;
-      face.vertex_indices.reserve(3);
-
-      while (!IS_NEW_LINE(token[0])) {
-        vertex_index_t vi;
-        if (!parseTriple(&token, static_cast<int>(v.size() / 3),
-                         static_cast<int>(vn.size() / 3),
-                         static_cast<int>(vt.size() / 2), &vi)) {
-          if (err) {
-            std::stringstream ss;
-            ss << "Failed parse `f' line(e.g. zero value for face index. line "
-               << line_num << ".)\n";
-            (*err) += ss.str();
-          }
-          return false;
-        }
+    return true;
+  }
 
-        greatest_v_idx = greatest_v_idx > vi.v_idx ? greatest_v_idx : vi.v_idx;
-        greatest_vn_idx =
-            greatest_vn_idx > vi.vn_idx ? greatest_vn_idx : vi.vn_idx;
-        greatest_vt_idx =
-            greatest_vt_idx > vi.vt_idx ? greatest_vt_idx : vi.vt_idx;
+  // face
+  if (token[0] == 'f' && IS_SPACE((token[1]))) {
+    face_t face;
 
-        face.vertex_indices.push_back(vi);
-        size_t n = strspn(token, " \t\r");
-        token += n;
-      }
-
-      // replace with emplace_back + std::move on C++11
-      prim_group.faceGroup.push_back(face);
+    face.smoothing_group_id = st->current_smoothing_id;
 
-      continue;
+    if (!parseFace(token + 2, st->num_v, st->num_vn, st->num_vt, &face,
+                   &st->greatest_v_idx, &st->greatest_vn_idx,
+                   &st->greatest_vt_idx)) {
+      reportFaceError(st->err, line_num);
+      return false;
     }
 
-    // use mtl
-    if ((0 == strncmp(token, "usemtl", 6))) {
-      token += 6;
-      std::string namebuf = parseString(&token);
+    // replace with emplace_back + std::move on C++11
+    st->prim_group.faceGroup.push_back(face);
 
-      int newMaterialId = -1;
-      std::map<std::string, int>::const_iterator it = material_map.find(namebuf);
-      if (it != material_map.end()) {
-        newMaterialId = it->second;
-      } else {
-        // { error!! material not found }
-        if (warn) {
-          (*warn) += "material [ '" + namebuf + "' ] not found in .mtl\n";
-        }
-      }
+    return true;
+  }
+
+  // use mtl
+  if ((0 == strncmp(token, "usemtl", 6))) {
+    token += 6;
+    std::string namebuf = parseString(&token);
 
-      if (newMaterialId != material) {
-        // Create per-face material. Thus we don't add `shape` to `shapes` at
-        // this time.
-        // just clear `faceGroup` after `exportGroupsToShape()` call.
-        exportGroupsToShape(&shape, prim_group, tags, material, name,
-                            triangulate, v);
-        prim_group.faceGroup.clear();
-        material = newMaterialId;
+    int newMaterialId = -1;
+    std::map<std::string, int>::const_iterator it =
+        st->material_map.find(namebuf);
+    if (it != st->material_map.end()) {
+      newMaterialId = it->second;
+    } else {
+      // { error!! material not found }
+      if (st->warn) {
+        (*st->warn) += "material [ '" + namebuf + "' ] not found in .mtl\n";
       }
+    }
 
-      continue;
+    if (newMaterialId != st->material) {
+      // Create per-face material. Thus we don't add `shape` to `shapes` at
+      // this time.
+      // just clear `faceGroup` after `exportGroupsToShape()` call.
+      exportGroupsToShape(&st->shape, st->prim_group, st->tags, st->material,
+                          st->name, st->triangulate, st->v);
+      st->prim_group.faceGroup.clear();
+      st->material = newMaterialId;
     }
 
-    // load mtl
-    if ((0 == strncmp(token, "mtllib", 6)) && IS_SPACE((token[6]))) {
-      if (readMatFn) {
-        token += 7;
+    return true;
+  }
 
-        std::vector<std::string> filenames;
-        SplitString(std::string(token), ' ', filenames);
+  // load mtl
+  if ((0 == strncmp(token, "mtllib", 6)) && IS_SPACE((token[6]))) {
+    if (st->readMatFn) {
+      token += 7;
 
-        if (filenames.empty()) {
-          if (warn) {
-            std::stringstream ss;
-            ss << "Looks like empty filename for mtllib. Use default "
-                  "material (line "
-               << line_num << ".)\n";
+      std::vector<std::string> filenames;
+      SplitString(std::string(token), ' ', filenames);
 
-            (*warn) += ss.str();
+      if (filenames.empty()) {
+        if (st->warn) {
+          std::stringstream ss;
+          ss << "Looks like empty filename for mtllib. Use default "
+                "material (line "
+             << line_num << ".)\n";
+
+          (*st->warn) += ss.str();
+        }
+      } else {
+        bool found = false;
+        for (size_t s = 0; s < filenames.size(); s++) {
+          std::string warn_mtl;
+          std::string err_mtl;
+          bool ok = (*st->readMatFn)(filenames[s].c_str(), st->materials,
+                                     &st->material_map, &warn_mtl, &err_mtl);
+          if (st->warn && (!warn_mtl.empty())) {
+            (*st->warn) += warn_mtl;
           }
-        } else {
-          bool found = false;
-          for (size_t s = 0; s < filenames.size(); s++) {
-            std::string warn_mtl;
-            std::string err_mtl;
-            bool ok = (*readMatFn)(filenames[s].c_str(), materials,
-                                   &material_map, &warn_mtl, &err_mtl);
-            if (warn && (!warn_mtl.empty())) {
-              (*warn) += warn_mtl;
-            }
 
-            if (err && (!err_mtl.empty())) {
-              (*err) += err_mtl;
-            }
+          if (st->err && (!err_mtl.empty())) {
+            (*st->err) += err_mtl;
+          }
 
-            if (ok) {
-              found = true;
-              break;
-            }
+          if (ok) {
+            found = true;
+            break;
           }
+        }
 
-          if (!found) {
-            if (warn) {
-              (*warn) +=
-                  "Failed to load material file(s). Use default "
-                  "material.\n";
-            }
+        if (!found) {
+          if (st->warn) {
+            (*st->warn) +=
+                "Failed to load material file(s). Use default "
+                "material.\n";
           }
         }
       }
-
-      continue;
     }
 
-    // group name
-    if (token[0] == 'g' && IS_SPACE((token[1]))) {
-      // flush previous face group.
-      bool ret = exportGroupsToShape(&shape, prim_group, tags, material, name,
-                                     triangulate, v);
-      (void)ret;  // return value not used.
+    return true;
+  }
 
-      if (shape.mesh.indices.size() > 0) {
-        shapes->push_back(shape);
-      }
+  // group name
+  if (token[0] == 'g' && IS_SPACE((token[1]))) {
+    // flush previous face group.
+    bool ret = exportGroupsToShape(&st->shape, st->prim_group, st->tags,
+                                   st->material, st->name, st->triangulate,
+                                   st->v);
+    (void)ret;  // return value not used.
 
-      shape = shape_t();
+    if (st->shape.mesh.indices.size() > 0) {
+      st->shapes->push_back(st->shape);
+    }
 
-      // material = -1;
-      prim_group.clear();
+    st->shape = shape_t();
 
-      std::vector<std::string> names;
+    // material = -1;
+    st->prim_group.clear();
 
-      while (!IS_NEW_LINE(token[0])) {
-        std::string str = parseString(&token);
-        names.push_back(str);
-        token += strspn(token, " \t\r");  // skip tag
-      }
+    std::vector<std::string> names;
 
-      // names[0] must be 'g'
+    while (!IS_NEW_LINE(token[0])) {
+      std::string str = parseString(&token);
+      names.push_back(str);
+      token += strspn(token, " \t\r");  // skip tag
+    }
 
-      if (names.size() < 2) {
-        // 'g' with empty names
-        if (warn) {
-          std::stringstream ss;
-          ss << "Empty group name. line: " << line_num << "\n";
-          (*warn) += ss.str();
-          name = "";
-        }
-      } else {
-        std::stringstream ss;
-        ss << names[1];
+    // names[0] must be 'g'
 
-        // tinyobjloader does not support multiple groups for a primitive.
-        // Currently we concatinate multiple group names with a space to get
-        // single group name.
+    if (names.size() < 2) {
+      // 'g' with empty names
+      if (st->warn) {
+        std::stringstream ss;
+        ss << "Empty group name. line: " << line_num << "\n";
+        (*st->warn) += ss.str();
+        st->name = "";
+      }
+    } else {
+      std::stringstream ss;
+      ss << names[1];
 
-        for (size_t i = 2; i < names.size(); i++) {
-          ss << " " << names[i];
-        }
+      // tinyobjloader does not support multiple groups for a primitive.
+      // Currently we concatinate multiple group names with a space to get
+      // single group name.
 
-        name = ss.str();
+      for (size_t i = 2; i < names.size(); i++) {
+        ss << " " << names[i];
       }
 
-      continue;
+      st->name = ss.str();
     }
 
-    // object name
-    if (token[0] == 'o' && IS_SPACE((token[1]))) {
-      // flush previous face group.
-      bool ret = exportGroupsToShape(&shape, prim_group, tags, material, name,
-                                     triangulate, v);
-      (void)ret;  // return value not used.
-
-      if (shape.mesh.indices.size() > 0 || shape.lines.indices.size() > 0 ||
-          shape.points.indices.size() > 0) {
-        shapes->push_back(shape);
-      }
-
-      // material = -1;
-      prim_group.clear();
-      shape = shape_t();
+    return true;
+  }
 
-      // @todo { multiple object name? }
-      token += 2;
-      std::stringstream ss;
-      ss << token;
-      name = ss.str();
+  // object name
+  if (token[0] == 'o' && IS_SPACE((token[1]))) {
+    // flush previous face group.
+    bool ret = exportGroupsToShape(&st->shape, st->prim_group, st->tags,
+                                   st->material, st->name, st->triangulate,
+                                   st->v);
+    (void)ret;  // return value not used.
 
-      continue;
+    if (st->shape.mesh.indices.size() > 0 ||
+        st->shape.lines.indices.size() > 0 ||
+        st->shape.points.indices.size() > 0) {
+      st->shapes->push_back(st->shape);
     }
 
-    if (token[0] == 't' && IS_SPACE(token[1])) {
-      const int max_tag_nums = 8192;  // FIXME(syoyo): Parameterize.
-      tag_t tag;
+    // material = -1;
+    st->prim_group.clear();
+    st->shape = shape_t();
 
-      token += 2;
+    // @todo { multiple object name? }
+    token += 2;
+    std::stringstream ss;
+    ss << token;
+    st->name = ss.str();
 
-      tag.name = parseString(&token);
+    return true;
+  }
 
-      tag_sizes ts = parseTagTriple(&token);
+  if (token[0] == 't' && IS_SPACE(token[1])) {
+    const int max_tag_nums = 8192;  // FIXME(syoyo): Parameterize.
+    tag_t tag;
 
-      if (ts.num_ints < 0) {
-        ts.num_ints = 0;
-      }
-      if (ts.num_ints > max_tag_nums) {
-        ts.num_ints = max_tag_nums;
-      }
+    token += 2;
 
-      if (ts.num_reals < 0) {
-        ts.num_reals = 0;
-      }
-      if (ts.num_reals > max_tag_nums) {
-        ts.num_reals = max_tag_nums;
-      }
+    tag.name = parseString(&token);
 
-      if (ts.num_strings < 0) {
-        ts.num_strings = 0;
-      }
-      if (ts.num_strings > max_tag_nums) {
-        ts.num_strings = max_tag_nums;
-      }
+    tag_sizes ts = parseTagTriple(&token);
 
-      tag.intValues.resize(static_cast<size_t>(ts.num_ints));
+    if (ts.num_ints < 0) {
+      ts.num_ints = 0;
+    }
+    if (ts.num_ints > max_tag_nums) {
+      ts.num_ints = max_tag_nums;
+    }
 
-      for (size_t i = 0; i < static_cast<size_t>(ts.num_ints); ++i) {
-        tag.intValues[i] = parseInt(&token);
-      }
+    if (ts.num_reals < 0) {
+      ts.num_reals = 0;
+    }
+    if (ts.num_reals > max_tag_nums) {
+      ts.num_reals = max_tag_nums;
+    }
 
-      tag.floatValues.resize(static_cast<size_t>(ts.num_reals));
-      for (size_t i = 0; i < static_cast<size_t>(ts.num_reals); ++i) {
-        tag.floatValues[i] = parseReal(&token);
-      }
+    if (ts.num_strings < 0) {
+      ts.num_strings = 0;
+    }
+    if (ts.num_strings > max_tag_nums) {
+      ts.num_strings = max_tag_nums;
+    }
 
-      tag.stringValues.resize(static_cast<size_t>(ts.num_strings));
-      for (size_t i = 0; i < static_cast<size_t>(ts.num_strings); ++i) {
-        tag.stringValues[i] = parseString(&token);
-      }
+    tag.intValues.resize(static_cast<size_t>(ts.num_ints));
 
-      tags.push_back(tag);
+    for (size_t i = 0; i < static_cast<size_t>(ts.num_ints); ++i) {
+      tag.intValues[i] = parseInt(&token);
+    }
 
-      continue;
+    tag.floatValues.resize(static_cast<size_t>(ts.num_reals));
+    for (size_t i = 0; i < static_cast<size_t>(ts.num_reals); ++i) {
+      tag.floatValues[i] = parseReal(&token);
     }
 
-    if (token[0] == 's' && IS_SPACE(token[1])) {
-      // smoothing group id
-      token += 2;
+    tag.stringValues.resize(static_cast<size_t>(ts.num_strings));
+    for (size_t i = 0; i < static_cast<size_t>(ts.num_strings); ++i) {
+      tag.stringValues[i] = parseString(&token);
+    }
 
-      // skip space.
-      token += strspn(token, " \t");  // skip space
+    st->tags.push_back(tag);
 
-      if (token[0] == '\0') {
-        continue;
-      }
+    return true;
+  }
 
-      if (token[0] == '\r' || token[1] == '\n') {
-        continue;
-      }
+  if (token[0] == 's' && IS_SPACE(token[1])) {
+    // smoothing group id
+    token += 2;
+
+    // skip space.
+    token += strspn(token, " \t");  // skip space
+
+    if (token[0] == '\0') {
+      return true;
+    }
 
-      if (strlen(token) >= 3 && token[0] == 'o' && token[1] == 'f' &&
-          token[2] == 'f') {
-        current_smoothing_id = 0;
+    if (token[0] == '\r' || token[1] == '\n') {
+      return true;
+    }
+
+    if (strlen(token) >= 3 && token[0] == 'o' && token[1] == 'f' &&
+        token[2] == 'f') {
+      st->current_smoothing_id = 0;
+    } else {
+      // assume number
+      int smGroupId = parseInt(&token);
+      if (smGroupId < 0) {
+        // parse error. force set to 0.
+        // FIXME(syoyo): Report warning.
+        st->current_smoothing_id = 0;
       } else {
-        // assume number
-        int smGroupId = parseInt(&token);
-        if (smGroupId < 0) {
-          // parse error. force set to 0.
-          // FIXME(syoyo): Report warning.
-          current_smoothing_id = 0;
-        } else {
-          current_smoothing_id = static_cast<unsigned int>(smGroupId);
-        }
+        st->current_smoothing_id = static_cast<unsigned int>(smGroupId);
       }
+    }
 
-      continue;
-    }  // smoothing group id
+    return true;
+  }  // smoothing group id
 
-    // Ignore unknown command.
-  }
+  // Ignore unknown command.
+  return true;
+}
 
+// Flushes the last shape and moves the attributes into `attrib'.
+// `line_num' is the number of lines read.
+static bool finishObjParse(obj_parse_state_t *st, attrib_t *attrib,
+                           size_t line_num) {
   // not all vertices have colors, no default colors desired? -> clear colors
-  if (!found_all_colors && !default_vcols_fallback) {
-    vc.clear();
+  if (!st->found_all_colors && !st->default_vcols_fallback) {
+    st->vc.clear();
   }
 
-  if (greatest_v_idx >= static_cast<int>(v.size() / 3)) {
-    if (warn) {
+  if (st->greatest_v_idx >= static_cast<int>(st->v.size() / 3)) {
+    if (st->warn) {
       std::stringstream ss;
       ss << "Vertex indices out of bounds (line " << line_num << ".)\n"
          << std::endl;
-      (*warn) += ss.str();
+      (*st->warn) += ss.str();
     }
   }
-  if (greatest_vn_idx >= static_cast<int>(vn.size() / 3)) {
-    if (warn) {
+  if (st->greatest_vn_idx >= static_cast<int>(st->vn.size() / 3)) {
+    if (st->warn) {
       std::stringstream ss;
       ss << "Vertex normal indices out of bounds (line " << line_num << ".)\n"
          << std::endl;
-      (*warn) += ss.str();
+      (*st->warn) += ss.str();
     }
   }
-  if (greatest_vt_idx >= static_cast<int>(vt.size() / 2)) {
-    if (warn) {
+  if (st->greatest_vt_idx >= static_cast<int>(st->vt.size() / 2)) {
+    if (st->warn) {
       std::stringstream ss;
-      ss << "Vertex texcoord indices out of bounds (line " << line_num << ".)\n"
+      ss << "Vertex texcoord indices out of bounds (line " << line_num
+         << ".)\n"
          << std::endl;
-      (*warn) += ss.str();
+      (*st->warn) += ss.str();
     }
   }
 
-  bool ret = exportGroupsToShape(&shape, prim_group, tags, material, name,
-                                 triangulate, v);
+  bool ret = exportGroupsToShape(&st->shape, st->prim_group, st->tags,
+                                 st->material, st->name, st->triangulate,
+                                 st->v);
   // exportGroupsToShape return false when `usemtl` is called in the last
   // line.
   // we also add `shape` to `shapes` when `shape.mesh` has already some
   // faces(indices)
-  if (ret || shape.mesh.indices
+  if (ret || st->shape.mesh.indices
                  .size()) {  // FIXME(syoyo): Support other prims(e.g. lines)
-    shapes->push_back(shape);
+    st->shapes->push_back(st->shape);
   }
-  prim_group.clear();  // for safety
+  st->prim_group.clear();  // for safety
 
-  if (err) {
-    (*err) += errss.str();
+  attrib->vertices.swap(st->v);
+  attrib->vertex_weights.swap(st->v);
+  attrib->normals.swap(st->vn);
+  attrib->texcoords.swap(st->vt);
+  attrib->texcoord_ws.swap(st->vt);
+  attrib->colors.swap(st->vc);
+
+  return true;
+}
+
+bool LoadObj(attrib_t *attrib, std::vector<shape_t> *shapes,
+             std::vector<material_t> *materials, std::string *warn,
+             std::string *err, std::istream *inStream,
+             MaterialReader *readMatFn /*= NULL*/, bool triangulate,
+             bool default_vcols_fallback) {
+  obj_parse_state_t st(shapes, materials, warn, err, readMatFn, triangulate,
+                       default_vcols_fallback);
+
+  size_t line_num = 0;
+  std::string linebuf;
+  while (inStream->peek() != -1) {
+    safeGetline(*inStream, linebuf);
+
+    line_num++;
+
+    // Trim newline '\r\n' or '\n'
+    if (linebuf.size() > 0) {
+      if (linebuf[linebuf.size() - 1] == '\n')
+        linebuf.erase(linebuf.size() - 1);
+    }
+    if (linebuf.size() > 0) {
+      if (linebuf[linebuf.size() - 1] == '\r')
+        linebuf.erase(linebuf.size() - 1);
+    }
+
+    // Skip if empty line.
+    if (linebuf.empty()) {
+      continue;
+    }
+
+    // Skip leading space.
+    const char *token = linebuf.c_str();
+    token += strspn(token, " \t");
+
+    if (!parseObjLine(&st, token, line_num)) {
+      return false;
+    }
   }
 
-  attrib->vertices.swap(v);
-  attrib->vertex_weights.swap(v);
-  attrib->normals.swap(vn);
-  attrib->texcoords.swap(vt);
-  attrib->texcoord_ws.swap(vt);
-  attrib->colors.swap(vc);
+  return finishObjParse(&st, attrib, line_num);
+}
 
-  return true;
+// Finds the end of the line starting at `p' the same way safeGetline() does:
+// a line ends at "\n", "\r\n", "\r" or the end of the buffer.
+// Stores the end of the line text(without terminator) into `line_end' and
+// returns the start of the next line.
+static const char *nextLine(const char *p, const char *end,
+                            const char **line_end) {
+  while (p < end && (*p) != '\n' && (*p) != '\r') {
+    p++;
+  }
+  (*line_end) = p;
+  if (p < end) {
+    if ((*p) == '\r' && p + 1 < end && p[1] == '\n') {
+      p++;
+    }
+    p++;
+  }
+  return p;
+}
+
+// Line kinds the parallel parser handles on its own. Everything else is
+// replayed through parseObjLine() in file order.
+enum obj_line_kind_t {
+  OBJ_LINE_SKIP,
+  OBJ_LINE_V,
+  OBJ_LINE_VN,
+  OBJ_LINE_VT,
+  OBJ_LINE_F,
+  OBJ_LINE_OTHER
+};
+
+// Same dispatch as parseObjLine(), on a line that is not NUL terminated.
+static obj_line_kind_t classifyLine(const char *p, const char *line_end) {
+  while (p < line_end && IS_SPACE(*p)) {
+    p++;
+  }
+  const char c0 = p < line_end ? p[0] : '\0';
+  const char c1 = p + 1 < line_end ? p[1] : '\0';
+  const char c2 = p + 2 < line_end ? p[2] : '\0';
+
+  if (c0 == '\0' || c0 == '#') return OBJ_LINE_SKIP;
+  if (c0 == 'v' && IS_SPACE(c1)) return OBJ_LINE_V;
+  if (c0 == 'v' && c1 == 'n' && IS_SPACE(c2)) return OBJ_LINE_VN;
+  if (c0 == 'v' && c1 == 't' && IS_SPACE(c2)) return OBJ_LINE_VT;
+  if (c0 == 'f' && IS_SPACE(c1)) return OBJ_LINE_F;
+  return OBJ_LINE_OTHER;
+}
+
+// Run of faces or a single line for the serial replay of a chunk.
+struct obj_chunk_record_t {
+  enum { FACES, FACE_ERROR, LINE } kind;
+  size_t count;  // FACES: number of consecutive faces
+  size_t line_num;
+  const char *begin;  // LINE: text of the line
+  const char *end;
+  int num_v, num_vn, num_vt;  // LINE: attribute counts before the line
+};
+
+// Line-aligned slice of the .obj text parsed by one thread.
+struct obj_chunk_t {
+  const char *begin;
+  const char *end;
+
+  // counted in the first pass
+  size_t num_lines;
+  size_t num_v;
+  size_t num_vn;
+  size_t num_vt;
+
+  // filled in the second pass
+  std::vector<face_t> faces;
+  std::vector<obj_chunk_record_t> records;
+  int greatest_v_idx;
+  int greatest_vn_idx;
+  int greatest_vt_idx;
+  bool found_all_colors;
+
+  obj_chunk_t()
+      : begin(NULL),
+        end(NULL),
+        num_lines(0),
+        num_v(0),
+        num_vn(0),
+        num_vt(0),
+        greatest_v_idx(-1),
+        greatest_vn_idx(-1),
+        greatest_vt_idx(-1),
+        found_all_colors(true) {}
+};
+
+// First pass: count lines and v/vn/vt records of a chunk.
+static void countObjChunk(obj_chunk_t *chunk) {
+  const char *p = chunk->begin;
+  while (p < chunk->end) {
+    const char *line_end;
+    const char *next = nextLine(p, chunk->end, &line_end);
+    chunk->num_lines++;
+    switch (classifyLine(p, line_end)) {
+      case OBJ_LINE_V:
+        chunk->num_v++;
+        break;
+      case OBJ_LINE_VN:
+        chunk->num_vn++;
+        break;
+      case OBJ_LINE_VT:
+        chunk->num_vt++;
+        break;
+      default:
+        break;
+    }
+    p = next;
+  }
+}
+
+// Second pass: parse v/vn/vt straight into their final place in `st' and
+// parse faces, recording every other line for the serial replay. `*_base'
+// are the counts of lines and records in the chunks before this one.
+static void parseObjChunk(obj_chunk_t *chunk, obj_parse_state_t *st,
+                          size_t line_base, size_t v_base, size_t vn_base,
+                          size_t vt_base) {
+  size_t line_num = line_base;
+  size_t iv = v_base, ivn = vn_base, ivt = vt_base;
+  std::string linebuf;
+
+  const char *p = chunk->begin;
+  while (p < chunk->end) {
+    const char *line_end;
+    const char *line_begin = p;
+    p = nextLine(p, chunk->end, &line_end);
+    line_num++;
+
+    obj_line_kind_t kind = classifyLine(line_begin, line_end);
+    if (kind == OBJ_LINE_SKIP) {
+      continue;
+    }
+
+    if (kind == OBJ_LINE_OTHER) {
+      obj_chunk_record_t record;
+      record.kind = obj_chunk_record_t::LINE;
+      record.count = 0;
+      record.line_num = line_num;
+      record.begin = line_begin;
+      record.end = line_end;
+      record.num_v = static_cast<int>(iv);
+      record.num_vn = static_cast<int>(ivn);
+      record.num_vt = static_cast<int>(ivt);
+      chunk->records.push_back(record);
+      continue;
+    }
+
+    // Parse from a copy, like the serial path, so the parse functions see
+    // the same NUL terminated text.
+    linebuf.assign(line_begin, line_end);
+    const char *token = linebuf.c_str();
+    token += strspn(token, " \t");
+
+    if (kind == OBJ_LINE_V) {
+      token += 2;
+      real_t *xyz = &st->v[3 * iv];
+      real_t *rgb = &st->vc[3 * iv];
+      chunk->found_all_colors &= parseVertexWithColor(
+          &xyz[0], &xyz[1], &xyz[2], &rgb[0], &rgb[1], &rgb[2], &token);
+      iv++;
+    } else if (kind == OBJ_LINE_VN) {
+      token += 3;
+      real_t *xyz = &st->vn[3 * ivn];
+      parseReal3(&xyz[0], &xyz[1], &xyz[2], &token);
+      ivn++;
+    } else if (kind == OBJ_LINE_VT) {
+      token += 3;
+      real_t *xy = &st->vt[2 * ivt];
+      parseReal2(&xy[0], &xy[1], &token);
+      ivt++;
+    } else {  // OBJ_LINE_F
+      face_t face;
+      if (!parseFace(token + 2, static_cast<int>(iv), static_cast<int>(ivn),
+                     static_cast<int>(ivt), &face, &chunk->greatest_v_idx,
+                     &chunk->greatest_vn_idx, &chunk->greatest_vt_idx)) {
+        obj_chunk_record_t record = obj_chunk_record_t();
+        record.kind = obj_chunk_record_t::FACE_ERROR;
+        record.line_num = line_num;
+        chunk->records.push_back(record);
+        return;  // the replay stops here
+      }
+      chunk->faces.push_back(face_t());
+      chunk->faces.back().vertex_indices.swap(face.vertex_indices);
+
+      if (chunk->records.empty() ||
+          chunk->records.back().kind != obj_chunk_record_t::FACES) {
+        obj_chunk_record_t record = obj_chunk_record_t();
+        record.kind = obj_chunk_record_t::FACES;
+        chunk->records.push_back(record);
+      }
+      chunk->records.back().count++;
+    }
+  }
+}
+
+bool LoadObjFromBuffer(attrib_t *attrib, std::vector<shape_t> *shapes,
+                       std::vector<material_t> *materials, std::string *warn,
+                       std::string *err, const char *buf, size_t len,
+                       MaterialReader *readMatFn /*= NULL*/, bool triangulate,
+                       bool default_vcols_fallback, int num_threads) {
+  attrib->vertices.clear();
+  attrib->normals.clear();
+  attrib->texcoords.clear();
+  attrib->colors.clear();
+  shapes->clear();
+
+  obj_parse_state_t st(shapes, materials, warn, err, readMatFn, triangulate,
+                       default_vcols_fallback);
+
+  const char *end = buf + len;
+
+#ifdef TINYOBJLOADER_HAS_THREADS
+  if (num_threads <= 0) {
+    num_threads = static_cast<int>(std::thread::hardware_concurrency());
+  }
+#endif
+  // Small files are not worth the threads.
+  const size_t min_chunk_size = 64 * 1024;
+  size_t num_chunks = len / min_chunk_size;
+  if (num_threads < 1) {
+    num_threads = 1;
+  }
+  if (num_chunks > static_cast<size_t>(num_threads)) {
+    num_chunks = static_cast<size_t>(num_threads);
+  }
+#ifndef TINYOBJLOADER_HAS_THREADS
+  num_chunks = 1;
+#endif
+
+  if (num_chunks <= 1) {
+    size_t line_num = 0;
+    std::string linebuf;
+    const char *p = buf;
+    while (p < end) {
+      const char *line_end;
+      const char *line_begin = p;
+      p = nextLine(p, end, &line_end);
+      line_num++;
+
+      // Skip if empty line.
+      if (line_begin == line_end) {
+        continue;
+      }
+
+      linebuf.assign(line_begin, line_end);
+
+      // Skip leading space.
+      const char *token = linebuf.c_str();
+      token += strspn(token, " \t");
+
+      if (!parseObjLine(&st, token, line_num)) {
+        return false;
+      }
+    }
+
+    return finishObjParse(&st, attrib, line_num);
+  }
+
+#ifdef TINYOBJLOADER_HAS_THREADS
+  // Split at line starts, so every chunk holds whole lines.
+  std::vector<obj_chunk_t> chunks(num_chunks);
+  const char *chunk_begin = buf;
+  for (size_t c = 0; c < num_chunks; c++) {
+    const char *chunk_end = end;
+    if (c + 1 < num_chunks) {
+      chunk_end = buf + len / num_chunks * (c + 1);
+      if (chunk_end < chunk_begin) {
+        chunk_end = chunk_begin;
+      }
+      // a split right after '\n' is a line start, whether "\n" or "\r\n"
+      // ended the line
+      while (chunk_end < end && chunk_end[-1] != '\n') {
+        chunk_end++;
+      }
+    }
+    chunks[c].begin = chunk_begin;
+    chunks[c].end = chunk_end;
+    chunk_begin = chunk_end;
+  }
+
+  std::vector<std::thread> workers;
+  for (size_t c = 0; c < num_chunks; c++) {
+    workers.push_back(std::thread(countObjChunk, &chunks[c]));
+  }
+  for (size_t c = 0; c < num_chunks; c++) {
+    workers[c].join();
+  }
+  workers.clear();
+
+  // Prefix sums give every chunk its first line number and the offsets of
+  // its v/vn/vt records in the merged arrays.
+  std::vector<size_t> line_base(num_chunks), v_base(num_chunks),
+      vn_base(num_chunks), vt_base(num_chunks);
+  size_t num_lines = 0, num_v = 0, num_vn = 0, num_vt = 0;
+  for (size_t c = 0; c < num_chunks; c++) {
+    line_base[c] = num_lines;
+    v_base[c] = num_v;
+    vn_base[c] = num_vn;
+    vt_base[c] = num_vt;
+    num_lines += chunks[c].num_lines;
+    num_v += chunks[c].num_v;
+    num_vn += chunks[c].num_vn;
+    num_vt += chunks[c].num_vt;
+  }
+  st.v.resize(3 * num_v);
+  st.vc.resize(3 * num_v);
+  st.vn.resize(3 * num_vn);
+  st.vt.resize(2 * num_vt);
+
+  for (size_t c = 0; c < num_chunks; c++) {
+    workers.push_back(std::thread(parseObjChunk, &chunks[c], &st,
+                                  line_base[c], v_base[c], vn_base[c],
+                                  vt_base[c]));
+  }
+  for (size_t c = 0; c < num_chunks; c++) {
+    workers[c].join();
+  }
+
+  // Replay faces and the remaining lines in file order, so groups, materials
+  // and smoothing groups come out exactly as in the serial parse.
+  std::string linebuf;
+  for (size_t c = 0; c < num_chunks; c++) {
+    obj_chunk_t &chunk = chunks[c];
+    size_t face_idx = 0;
+    for (size_t r = 0; r < chunk.records.size(); r++) {
+      const obj_chunk_record_t &record = chunk.records[r];
+      if (record.kind == obj_chunk_record_t::FACES) {
+        for (size_t i = 0; i < record.count; i++) {
+          st.prim_group.faceGroup.push_back(face_t());
+          face_t &face = st.prim_group.faceGroup.back();
+          face.smoothing_group_id = st.current_smoothing_id;
+          face.vertex_indices.swap(chunk.faces[face_idx++].vertex_indices);
+        }
+      } else if (record.kind == obj_chunk_record_t::FACE_ERROR) {
+        reportFaceError(err, record.line_num);
+        return false;
+      } else {
+        st.num_v = record.num_v;
+        st.num_vn = record.num_vn;
+        st.num_vt = record.num_vt;
+
+        linebuf.assign(record.begin, record.end);
+        const char *token = linebuf.c_str();
+        token += strspn(token, " \t");
+
+        if (!parseObjLine(&st, token, record.line_num)) {
+          return false;
+        }
+      }
+    }
+    chunk.faces.clear();
+
+    st.found_all_colors &= chunk.found_all_colors;
+    st.greatest_v_idx = st.greatest_v_idx > chunk.greatest_v_idx
+                            ? st.greatest_v_idx
+                            : chunk.greatest_v_idx;
+    st.greatest_vn_idx = st.greatest_vn_idx > chunk.greatest_vn_idx
+                             ? st.greatest_vn_idx
+                             : chunk.greatest_vn_idx;
+    st.greatest_vt_idx = st.greatest_vt_idx > chunk.greatest_vt_idx
+                             ? st.greatest_vt_idx
+                             : chunk.greatest_vt_idx;
+  }
+
+  return finishObjParse(&st, attrib, num_lines);
+#else
+  return false;  // never reach here.
+#endif
 }
 
 bool LoadObjWithCallback(std::istream &inStream, const callback_t &callback,
@@ -2980,9 +3453,40 @@ bool ObjReader::ParseFromFile(const std::string &filename,
     mtl_search_path = config.mtl_search_path;
   }
 
-  valid_ = LoadObj(&attrib_, &shapes_, &materials_, &warning_, &error_,
-                   filename.c_str(), mtl_search_path.c_str(),
-                   config.triangulate, config.vertex_color);
+  if (config.num_threads == 1) {
+    valid_ = LoadObj(&attrib_, &shapes_, &materials_, &warning_, &error_,
+                     filename.c_str(), mtl_search_path.c_str(),
+                     config.triangulate, config.vertex_color);
+
+    return valid_;
+  }
+
+  std::ifstream ifs(filename.c_str(), std::ios::binary);
+  if (!ifs) {
+    std::stringstream ss;
+    ss << "Cannot open file [" << filename << "]" << std::endl;
+    error_ = ss.str();
+    valid_ = false;
+    return valid_;
+  }
+  std::string obj_text((std::istreambuf_iterator<char>(ifs)),
+                       std::istreambuf_iterator<char>());
+
+  if (!mtl_search_path.empty()) {
+#ifndef _WIN32
+    const char dirsep = '/';
+#else
+    const char dirsep = '\\';
+#endif
+    if (mtl_search_path[mtl_search_path.length() - 1] != dirsep)
+      mtl_search_path += dirsep;
+  }
+  MaterialFileReader matFileReader(mtl_search_path);
+
+  valid_ = LoadObjFromBuffer(&attrib_, &shapes_, &materials_, &warning_,
+                             &error_, obj_text.data(), obj_text.size(),
+                             &matFileReader, config.triangulate,
+                             config.vertex_color, config.num_threads);
 
   return valid_;
 }
@@ -2990,14 +3494,22 @@ bool ObjReader::ParseFromFile(const std::string &filename,
 bool ObjReader::ParseFromString(const std::string &obj_text,
                                 const std::string &mtl_text,
                                 const ObjReaderConfig &config) {
-  std::stringbuf obj_buf(obj_text);
   std::stringbuf mtl_buf(mtl_text);
-
-  std::istream obj_ifs(&obj_buf);
   std::istream mtl_ifs(&mtl_buf);
-
   MaterialStreamReader mtl_ss(mtl_ifs);
 
+  if (config.num_threads != 1) {
+    valid_ = LoadObjFromBuffer(&attrib_, &shapes_, &materials_, &warning_,
+                               &error_, obj_text.data(), obj_text.size(),
+                               &mtl_ss, config.triangulate,
+                               config.vertex_color, config.num_threads);
+
+    return valid_;
+  }
+
+  std::stringbuf obj_buf(obj_text);
+  std::istream obj_ifs(&obj_buf);
+
   valid_ = LoadObj(&attrib_, &shapes_, &materials_, &warning_, &error_,
                    &obj_ifs, &mtl_ss, config.triangulate, config.vertex_color);
 
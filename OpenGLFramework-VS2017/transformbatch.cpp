@@ -0,0 +1,172 @@
+#include "transformbatch.h"
+#include "threadpool.h"
+#include "frustum.h"
+
+#include <algorithm>
+#include <atomic>
+#include <string.h>
+
+// below this many objects per task, handing work to the pool costs more than it saves
+static const int MinObjectsPerTask = 2048;
+
+// Split [begin, end) into contiguous chunks, one per task, run on the pool's workers and the caller
+template <typename Work>
+static void forChunks(int begin, int end, ThreadPool *pool, Work work)
+{
+	int count = end - begin;
+	int tasks = pool != NULL ? std::min(pool->size() + 1, count / MinObjectsPerTask) : 1;
+	tasks = std::max(tasks, 1);
+	for (int t = 1; t < tasks; t++)
+	{
+		int first = begin + (int)((long long)count * t / tasks), last = begin + (int)((long long)count * (t + 1) / tasks);
+		pool->submit([work, first, last]() {
+			work(first, last);
+		});
+	}
+	work(begin, begin + count / tasks);
+	if (tasks > 1)
+	{
+		pool->wait();
+	}
+}
+
+void TransformBatch::resize(int count)
+{
+	int old_count = size();
+	positions.resize(count, Vector3(0, 0, 0));
+	rotations.resize(count, Vector3(0, 0, 0));
+	scales.resize(count, Vector3(1, 1, 1));
+	matrices.resize(count);
+	dirty.resize(count, 1);
+	if (count > old_count)
+	{
+		// the new objects join the changed range
+		dirty_begin = dirty_begin < dirty_end ? std::min(dirty_begin, old_count) : old_count;
+		dirty_end = count;
+	}
+	else if (dirty_end > count)
+	{
+		dirty_end = count;
+		dirty_begin = std::min(dirty_begin, dirty_end);
+	}
+}
+
+void TransformBatch::markDirty(int i)
+{
+	dirty[i] = 1;
+	if (dirty_begin >= dirty_end)
+	{
+		dirty_begin = i;
+		dirty_end = i + 1;
+	}
+	else
+	{
+		dirty_begin = std::min(dirty_begin, i);
+		dirty_end = std::max(dirty_end, i + 1);
+	}
+}
+
+void TransformBatch::markAll()
+{
+	std::fill(dirty.begin(), dirty.end(), 1);
+	dirty_begin = 0;
+	dirty_end = size();
+}
+
+void TransformBatch::set(int i, const Vector3 &position, const Vector3 &rotation, const Vector3 &scale)
+{
+	positions[i] = position;
+	rotations[i] = rotation;
+	scales[i] = scale;
+	markDirty(i);
+}
+
+void TransformBatch::setPosition(int i, const Vector3 &position)
+{
+	positions[i] = position;
+	markDirty(i);
+}
+
+void TransformBatch::setRotation(int i, const Vector3 &rotation)
+{
+	rotations[i] = rotation;
+	markDirty(i);
+}
+
+void TransformBatch::setScale(int i, const Vector3 &scale)
+{
+	scales[i] = scale;
+	markDirty(i);
+}
+
+int TransformBatch::updateRange(int first, int last, InstanceData *out)
+{
+	int updated = 0;
+	for (int i = first; i < last; i++)
+	{
+		if (!dirty[i])
+		{
+			continue;
+		}
+		dirty[i] = 0;
+		updated++;
+
+		const Matrix4 &m = matrices[i] = composeTRS(positions[i], rotations[i], scales[i]);
+		if (out == NULL)
+		{
+			continue;
+		}
+		// M = T * R * S, so the inverse transpose of its 3x3 part is R * S^-1: column c is
+		// column c of M divided by scale_c twice, no general inverse needed
+		InstanceData &instance = out[i - dirty_begin];
+		memcpy(instance.model, m.get(), sizeof(instance.model));
+		const float inv_scale2[3] = {1.0f / (scales[i].x * scales[i].x), 1.0f / (scales[i].y * scales[i].y), 1.0f / (scales[i].z * scales[i].z)};
+		for (int c = 0; c < 3; c++)
+		{
+			for (int r = 0; r < 3; r++)
+			{
+				instance.normal[c * 3 + r] = m[r * 4 + c] * inv_scale2[c];
+			}
+		}
+	}
+	return updated;
+}
+
+int TransformBatch::update(InstanceData *out, ThreadPool *pool)
+{
+	if (dirty_begin >= dirty_end)
+	{
+		return 0;
+	}
+
+	std::atomic<int> updated(0);
+	forChunks(dirty_begin, dirty_end, pool, [this, out, &updated](int first, int last) {
+		updated += updateRange(first, last, out);
+	});
+	dirty_begin = dirty_end = 0;
+	return updated;
+}
+
+void TransformBatch::computeMVP(const Matrix4 &viewProjection, std::vector<Matrix4> &mvp, ThreadPool *pool) const
+{
+	mvp.resize(matrices.size());
+	Matrix4 *dst = mvp.empty() ? NULL : &mvp[0];
+	forChunks(0, size(), pool, [this, &viewProjection, dst](int first, int last) {
+		for (int i = first; i < last; i++)
+		{
+			dst[i] = viewProjection * matrices[i];
+		}
+	});
+}
+
+int TransformBatch::cull(const Frustum &frustum, const Vector3 &center, float radius, std::vector<uint8_t> &visible, ThreadPool *pool) const
+{
+	visible.resize(matrices.size());
+	const Matrix4 *src = matrices.empty() ? NULL : &matrices[0];
+	uint8_t *dst = visible.empty() ? NULL : &visible[0];
+	std::atomic<int> inside(0);
+	forChunks(0, size(), pool, [&frustum, &center, radius, src, dst, &inside](int first, int last) {
+		inside += frustum.cullTransformedSpheres(src + first, last - first, center, radius, dst + first);
+	});
+	return inside;
+}
@@ -0,0 +1,71 @@
+#ifndef TRANSFORMBATCH_H_DEF
+#define TRANSFORMBATCH_H_DEF
+
+#include <stdint.h>
+#include <vector>
+#include "Vectors.h"
+#include "Matrices.h"
+
+class ThreadPool;
+class Frustum;
+
+// One instance as the vertex shader reads it from an instance buffer: the model matrix rows
+// as stored by Matrix4 (the shader applies them from the right) and the column-major normal matrix.
+struct InstanceData
+{
+	float model[16];
+	float normal[9];
+};
+
+// Position, Euler rotation and scale of many objects, and the model matrices they give.
+// The setters only record what changed; update() recomputes the changed objects, spread
+// over a thread pool, and can write them straight into a mapped instance buffer.
+class TransformBatch
+{
+public:
+	TransformBatch() : dirty_begin(0), dirty_end(0) {}
+
+	void resize(int count); // new objects are at the origin, unrotated, unit scale
+	void clear() { resize(0); }
+	int size() const { return (int)matrices.size(); }
+
+	void set(int i, const Vector3 &position, const Vector3 &rotation, const Vector3 &scale);
+	void setPosition(int i, const Vector3 &position);
+	void setRotation(int i, const Vector3 &rotation); // radians, composed as in composeTRS()
+	void setScale(int i, const Vector3 &scale);
+	void markAll(); // e.g. after the buffer update() writes to was reallocated
+
+	const Vector3 &position(int i) const { return positions[i]; }
+	const Vector3 &rotation(int i) const { return rotations[i]; }
+	const Vector3 &scale(int i) const { return scales[i]; }
+
+	// [dirtyBegin(), dirtyEnd()) covers every object changed since the last update(), empty if none
+	int dirtyBegin() const { return dirty_begin; }
+	int dirtyEnd() const { return dirty_end; }
+
+	// Recompute the changed objects and write their InstanceData to out[i - dirtyBegin()]
+	// (skipped when out is NULL); unchanged objects inside the range are left alone.
+	// Returns the number of objects recomputed.
+	int update(InstanceData *out, ThreadPool *pool);
+
+	// model matrix as of the last update()
+	const Matrix4 &matrix(int i) const { return matrices[i]; }
+
+	// mvp[i] = viewProjection * matrix(i) for every object
+	void computeMVP(const Matrix4 &viewProjection, std::vector<Matrix4> &mvp, ThreadPool *pool) const;
+
+	// visible[i] = whether object i's copy of a sphere (center and radius in the objects' own space),
+	// placed by matrix(i), reaches into the frustum; returns the number of visible objects
+	int cull(const Frustum &frustum, const Vector3 &center, float radius, std::vector<uint8_t> &visible, ThreadPool *pool) const;
+
+private:
+	void markDirty(int i);
+	int updateRange(int first, int last, InstanceData *out);
+
+	std::vector<Vector3> positions, rotations, scales;
+	std::vector<Matrix4> matrices;
+	std::vector<uint8_t> dirty;
+	int dirty_begin, dirty_end;
+};
+
+#endif
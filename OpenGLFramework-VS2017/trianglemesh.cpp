@@ -0,0 +1,84 @@
+#include "trianglemesh.h"
+
+#include <math.h>
+#include <stdint.h>
+
+void TriangleMesh::build(const std::vector<Vector3> &positions, const void *indices, int index_count, int index_size)
+{
+	int count = index_count / 3;
+	corners.resize(3 * count);
+	std::vector<AABB> boxes(count);
+	for (int i = 0; i < count; i++)
+	{
+		Vector3 p[3];
+		for (int k = 0; k < 3; k++)
+		{
+			uint32_t index = index_size == 2 ? ((const uint16_t *)indices)[3 * i + k] : ((const uint32_t *)indices)[3 * i + k];
+			p[k] = positions[index];
+		}
+		corners[3 * i] = p[0];
+		corners[3 * i + 1] = p[1] - p[0];
+		corners[3 * i + 2] = p[2] - p[0];
+
+		AABB box = {p[0], p[0]};
+		for (int k = 1; k < 3; k++)
+		{
+			AABB point = {p[k], p[k]};
+			box.grow(point);
+		}
+		boxes[i] = box;
+	}
+	bvh.build(boxes);
+}
+
+bool TriangleMesh::intersectTriangle(int triangle, const Vector3 &origin, const Vector3 &direction, float &t) const
+{
+	// Moller-Trumbore: barycentric u, v and the distance from one 3x3 solve by Cramer's rule
+	const Vector3 &a = corners[3 * triangle], &e1 = corners[3 * triangle + 1], &e2 = corners[3 * triangle + 2];
+	Vector3 p = direction.cross(e2);
+	float det = e1.dot(p);
+	if (fabsf(det) < 1e-12f)
+	{
+		return false; // parallel to the triangle, or the triangle is degenerate
+	}
+	float inv_det = 1.0f / det;
+	Vector3 s = origin - a;
+	float u = s.dot(p) * inv_det;
+	if (u < 0 || u > 1)
+	{
+		return false;
+	}
+	Vector3 q = s.cross(e1);
+	float v = direction.dot(q) * inv_det;
+	if (v < 0 || u + v > 1)
+	{
+		return false;
+	}
+	float distance = e2.dot(q) * inv_det;
+	if (distance < 0 || distance >= t)
+	{
+		return false;
+	}
+	t = distance;
+	return true;
+}
+
+int TriangleMesh::raycast(const Vector3 &origin, const Vector3 &direction, float &t) const
+{
+	return bvh.raycast(origin, direction, t, [this, &origin, &direction](int triangle, float &t_hit) {
+		return intersectTriangle(triangle, origin, direction, t_hit);
+	});
+}
+
+int TriangleMesh::raycastLinear(const Vector3 &origin, const Vector3 &direction, float &t) const
+{
+	int hit = -1;
+	for (int i = 0; i < triangleCount(); i++)
+	{
+		if (intersectTriangle(i, origin, direction, t))
+		{
+			hit = i;
+		}
+	}
+	return hit;
+}
@@ -0,0 +1,32 @@
+#ifndef TRIANGLEMESH_H_DEF
+#define TRIANGLEMESH_H_DEF
+
+#include <vector>
+#include "Vectors.h"
+#include "bvh.h"
+
+// The triangles of one shape kept on the CPU, with a BVH over their boxes, for ray queries such as
+// picking. Built once per shape after upload; the shape's transform is applied to the ray instead.
+class TriangleMesh
+{
+public:
+	// index_count indices of index_size bytes (2 or 4) into positions, three per triangle
+	void build(const std::vector<Vector3> &positions, const void *indices, int index_count, int index_size);
+
+	int triangleCount() const { return bvh.size(); }
+	const BVH &tree() const { return bvh; }
+
+	// Closest triangle along origin + t * direction within t, front or back facing, t lowered to the
+	// hit. Returns the triangle, its first index / 3, or -1 with t unchanged.
+	int raycast(const Vector3 &origin, const Vector3 &direction, float &t) const;
+	// the same test against every triangle, without the BVH
+	int raycastLinear(const Vector3 &origin, const Vector3 &direction, float &t) const;
+
+private:
+	bool intersectTriangle(int triangle, const Vector3 &origin, const Vector3 &direction, float &t) const;
+
+	BVH bvh;
+	std::vector<Vector3> corners; // per triangle a, b - a, c - a
+};
+
+#endif